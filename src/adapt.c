@@ -0,0 +1,247 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <ctype.h>
+
+#include "adapt.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Adaptive concurrency (-M auto), AIMD style:
+**  - Start at the floor, and add one slot per healthy completion ("slow
+**    start", doubling the limit for every round of completions) until
+**    the first sign of congestion.
+**  - After that, add one slot per round of healthy completions.
+**  - Upon congestion, halve the limit (but not below the floor).  Only
+**    children spawned after the last decrease may trigger another one,
+**    so that a single episode isn't punished more than once.
+**
+** Congestion is either a failure to connect (reported by the caller
+** through adapt_result()), or latency (time to first byte) degrading
+** beyond ADAPT_SLOWDOWN times the best (smoothed) value observed for the
+** same phase.  The time it takes to feed each command its input (-i) is
+** treated the same way: all commands get the same input, so it growing
+** means our own bandwidth is exhausted.
+*/
+#define ADAPT_FLOOR	1	/* Default floor */
+#define ADAPT_CEILING	100	/* Default ceiling */
+#define ADAPT_WARMUP	5	/* Latency samples needed to get a baseline */
+#define ADAPT_ALPHA	0.2	/* Latency smoothing factor */
+#define ADAPT_SLOWDOWN	2.0	/* Latency degradation factor */
+#define ADAPT_DRIFT	0.05	/* Baseline drift factor (at the floor) */
+
+static int floor_, ceiling, limit;	/* 0: disabled */
+static int slowstart, credit;
+static u_int spawned, lastcut;
+static double smoothed[3], baseline[3];
+static int samples[3];
+
+static void congestion(u_int, char *);
+
+/*
+** adapt_init
+**	Parse a "auto[:<floor>-<ceiling>]" -M argument, and return the
+**	ceiling.  NULL disables the adaptive mode.
+*/
+int
+adapt_init(spec)
+char *spec;
+{
+    char *range, *dash;
+
+    floor_ = ceiling = limit = 0;
+    if (spec == NULL)
+	return 0;
+
+    if (strncmp(spec, "auto", 4) != 0
+	|| (spec[4] != '\0' && spec[4] != ':'))
+      {
+	fprintf(stderr, "%s: Invalid -M argument: %s\n", myname, spec);
+	exit(RC_ERROR);
+      }
+
+    floor_ = ADAPT_FLOOR;
+    ceiling = ADAPT_CEILING;
+    if (spec[4] == ':')
+      {
+	range = spec + 5;
+	dash = strchr(range, '-');
+	if (dash == NULL
+	    || (range != dash && isdigit((int) *range) == 0)
+	    || (dash[1] != '\0' && isdigit((int) dash[1]) == 0))
+	  {
+	    fprintf(stderr, "%s: Invalid -M range: %s\n", myname, range);
+	    exit(RC_ERROR);
+	  }
+	if (range != dash)
+	    floor_ = atoi(range);
+	if (dash[1] != '\0')
+	    ceiling = atoi(dash + 1);
+      }
+    if (floor_ <= 0 || ceiling < floor_)
+      {
+	fprintf(stderr, "%s: Invalid -M range: %d-%d\n",
+		myname, floor_, ceiling);
+	exit(RC_ERROR);
+      }
+
+    limit = floor_;
+    slowstart = 1;
+    credit = 0;
+    spawned = lastcut = 0;
+    samples[ADAPT_TEST] = samples[ADAPT_CMD] = samples[ADAPT_INPUT] = 0;
+    return ceiling;
+}
+
+/*
+** adapt_ceiling
+**	Lower the ceiling (e.g. because of system limitations)
+*/
+void
+adapt_ceiling(max)
+int max;
+{
+    if (limit == 0 || max >= ceiling)
+	return;
+    ceiling = max;
+    if (floor_ > ceiling)
+	floor_ = ceiling;
+    if (limit > ceiling)
+	limit = ceiling;
+}
+
+/*
+** adapt_disable
+**	Stop adapting, e.g. when the user sets the limit explicitly.
+*/
+void
+adapt_disable(void)
+{
+    if (limit != 0)
+	iprint("Adaptive concurrency disabled");
+    floor_ = ceiling = limit = 0;
+}
+
+/*
+** adapt_limit
+**	Current number of slots, or 0 when disabled.
+*/
+int
+adapt_limit(void)
+{
+    return limit;
+}
+
+/*
+** adapt_spawned
+**	Account for a new child, and return its sequence number.
+*/
+u_int
+adapt_spawned(void)
+{
+    return ++spawned;
+}
+
+/*
+** adapt_sample
+**	Account for a latency (time to first byte) or input sample.
+*/
+void
+adapt_sample(phase, seq, latency)
+int phase;
+u_int seq;
+double latency;
+{
+    assert( phase == ADAPT_TEST || phase == ADAPT_CMD
+	    || phase == ADAPT_INPUT );
+
+    if (limit == 0)
+	return;
+
+    if (samples[phase] == 0)
+	smoothed[phase] = latency;
+    else
+	smoothed[phase] += ADAPT_ALPHA * (latency - smoothed[phase]);
+    samples[phase] += 1;
+
+    if (samples[phase] < ADAPT_WARMUP)
+	return;
+    if (samples[phase] == ADAPT_WARMUP || smoothed[phase] < baseline[phase])
+      {
+	baseline[phase] = smoothed[phase];
+	return;
+      }
+    if (smoothed[phase] > ADAPT_SLOWDOWN * baseline[phase])
+      {
+	char why[80];
+
+	snprintf(why, sizeof(why), "%s %.2fs, was %.2fs",
+		 (phase == ADAPT_TEST) ? "test latency"
+		 : (phase == ADAPT_CMD) ? "command latency" : "input time",
+		 smoothed[phase], baseline[phase]);
+	congestion(seq, why);
+	/* Can't back off any further, slowly accept this as the norm. */
+	if (limit == floor_)
+	    baseline[phase] += ADAPT_DRIFT * (smoothed[phase]
+					      - baseline[phase]);
+      }
+}
+
+/*
+** adapt_result
+**	Account for a completed child: healthy, or failed to connect.
+*/
+void
+adapt_result(seq, healthy)
+u_int seq;
+int healthy;
+{
+    if (limit == 0)
+	return;
+
+    if (healthy == 0)
+      {
+	congestion(seq, "connection failure or timeout");
+	return;
+      }
+
+    if (limit >= ceiling)
+	return;
+    if (slowstart == 0 && ++credit < limit)
+	return;
+    credit = 0;
+    limit += 1;
+    dprint("Concurrency increased to %d", limit);
+}
+
+/*
+** congestion
+**	Back off.
+*/
+static void
+congestion(seq, why)
+u_int seq;
+char *why;
+{
+    if (seq <= lastcut)
+	return;
+
+    slowstart = 0;
+    credit = 0;
+    lastcut = spawned;
+    if (limit > floor_)
+      {
+	limit = (limit / 2 < floor_) ? floor_ : limit / 2;
+	iprint("Concurrency reduced to %d (%s)", limit, why);
+      }
+}
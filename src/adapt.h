@@ -0,0 +1,25 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_ADAPT_H_)
+# define _ADAPT_H_
+
+#define ADAPT_TEST	0	/* latency of test commands */
+#define ADAPT_CMD	1	/* latency of commands */
+#define ADAPT_INPUT	2	/* time to feed commands their input (-i) */
+
+int   adapt_init(char *);
+void  adapt_ceiling(int);
+void  adapt_disable(void);
+int   adapt_limit(void);
+u_int adapt_spawned(void);
+void  adapt_sample(int, u_int, double);
+void  adapt_result(u_int, int);
+
+#endif
@@ -11,11 +11,17 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <regex.h>
-#if defined(HAVE_PCRE_H)
-# include <pcre.h>
+#if defined(HAVE_DLFCN_H)
+# include <dlfcn.h>
+#endif
+#if defined(HAVE_PCRE2_H)
+# define PCRE2_CODE_UNIT_WIDTH 8
+# include <pcre2.h>
 #endif
 
 #include "analyzer.h"
+#include "plugin.h"
+#include "prefilter.h"
 #include "target.h"
 #include "term.h"
 #include "units.h"
@@ -24,31 +30,104 @@ static char const rcsid[] = "@(#)$Id$";
 
 extern char *myname;
 
+#if defined(HAVE_PCRE2_H)
+struct pcre
+{
+    pcre2_code		*code;
+    pcre2_match_data	*data;		/* allocated once, and reused */
+    size_t		lookbehind;	/* see pcre_feed() */
+};
+#endif
+
 struct condition
 {
     int ok;
     union
     {
 	regex_t re;
-#if defined(HAVE_PCRE_H)
-	pcre *pcre;
+#if defined(HAVE_PCRE2_H)
+	struct pcre pcre;
 #endif
     } val;
 };
 
 static struct condition *out, *err;
+static struct prefilter *outpf, *errpf;	/* line conditions, see loadfile() */
+
+/*
+** Whole output analysis as the output arrives, see analyzer_open(): as
+** expressions are compiled with REG_NEWLINE, a match can't span several
+** lines unless the expression itself can match a newline (see
+** stream_safe()).  So complete lines can be matched as soon as they
+** arrive, and the last (incomplete, possibly empty) one once the output
+** is closed, which gives the same results as analyzer_run() without
+** having to read the output files.
+*/
+struct stream
+{
+    u_int	type;		/* ANALYZE_RE or ANALYZE_PCRE */
+    char	*line;		/* incomplete line (pcre: unmatched output) */
+    size_t	len, size;
+    size_t	off;		/* pcre: where to start matching in line */
+    int		notbol;		/* pcre: line isn't the start of the output */
+    int		matched;	/* 0: no match (yet), 1: match, -1: error */
+};
+
+/*
+** Whole output analysis, see analyzer_map(): the outputs are mapped and
+** the results reported by the caller, while the matching in between may
+** be done by another thread (see apool.c).
+*/
+struct whole
+{
+    u_int	type;		/* ANALYZE_RE, ANALYZE_PCRE or ANALYZE_PLUGIN */
+    char	*target;	/* target name */
+    int		status;		/* command exit status */
+    int		ofd, efd;
+    char	*oname, *ename;
+    void	*output, *errput; /* mapped outputs (NUL terminated) */
+    size_t	olen, elen;
+#if defined(HAVE_PCRE2_H)
+    pcre2_match_data *data;	/* per analysis, see compile_pcre() */
+#endif
+    int		o, e;		/* stdout/stderr matches (-2: not tried) */
+    int		ok;		/* verdict */
+    char	msg[256];	/* plugin explanation */
+    char	error[256];	/* problem to report */
+};
+
+static int streams;		/* can the conditions be used on streams?
+				** 0: unknown, 1: yes, -1: no */
 
 static char    *run_cmd;
 static u_int	run_timeout;
+static int	run_procs;	/* number of co-processes */
+
+static shmux_analyzer_analyze_t *plugin_analyze;	/* see plugin.h */
+static shmux_analyzer_finish_t *plugin_finish;
 
 static void *mapfile(int, int, char *, size_t *);
 static void unmapfile(int, char *, void *, size_t);
 static void compile_re(int, void *, char *);
-#if defined(HAVE_PCRE_H)
+#if defined(HAVE_PCRE2_H)
 static void compile_pcre(int, void *, char *);
+static int  pcre_match(struct pcre *, char *, size_t, size_t, u_int);
+static int  pcre_feed(struct condition *, struct stream *, char *, size_t);
+static int  whole_pcre(struct whole *, struct pcre *, char *, size_t);
 #endif
+static int  whole_re(struct whole *, regex_t *, char *);
 static void restr_init(void *, void (*)(int, void *, char *), int *, char *);
-static void loadfile(int, char *, struct condition **list);
+static void loadfile(int, char *, struct condition **list,
+		     struct prefilter **);
+static int  map_outputs(int, char *, int, char *, void **, size_t *, void **,
+			size_t *);
+static void unmap_outputs(int, char *, int, char *, void *, size_t, void *,
+			  size_t);
+static void plugin_load(char *, char *);
+static int  stream_safe(char *);
+static void stream_match(struct condition *, struct stream *, char *);
+static int  stream_feed(struct condition *, struct stream *, char *, size_t);
+static int  stream_keep(struct stream *, char *, size_t);
 
 /*
 ** mapfile
@@ -157,10 +236,12 @@ char *str;
       }
 }
 
-#if defined(HAVE_PCRE_H)
+#if defined(HAVE_PCRE2_H)
 /*
 ** compile_pcre
-**	Perl Compatible Regular Expression (pcre) initialization
+**	Perl Compatible Regular Expression (pcre) initialization: the
+**	expression is JIT compiled when possible, and gets its own match
+**	data to be reused for every match.
 */
 void
 compile_pcre(mline, pcreptr, str)
@@ -168,19 +249,114 @@ int mline;
 void *pcreptr;
 char *str;
 {
-    pcre **re;
-    const char *error;
-    int erroffset;
+    struct pcre *re;
+    PCRE2_UCHAR error[256];
+    PCRE2_SIZE erroffset;
+    uint32_t lookbehind;
+    int errcode;
 
     re = pcreptr;
-    *re = pcre_compile(str, (mline != 0) ? PCRE_MULTILINE : 0,
-		       &error, &erroffset, NULL);
-    if (*re == NULL)
+    re->code = pcre2_compile((PCRE2_SPTR) str, PCRE2_ZERO_TERMINATED,
+			     (mline != 0) ? PCRE2_MULTILINE : 0,
+			     &errcode, &erroffset, NULL);
+    if (re->code == NULL)
+      {
+	pcre2_get_error_message(errcode, error, sizeof(error));
+	fprintf(stderr, "%s: Bad PCRE (offset %lu): %s\n",
+		myname, (u_long) erroffset, (char *) error);
+	exit(RC_ERROR);
+      }
+    /* Not fatal, the interpreter is then used */
+    pcre2_jit_compile(re->code, PCRE2_JIT_COMPLETE
+		      | ((mline != 0) ? PCRE2_JIT_PARTIAL_HARD : 0));
+
+    /* Only whether there's a match matters, not where */
+    re->data = pcre2_match_data_create(1, NULL);
+    if (re->data == NULL)
       {
-	fprintf(stderr, "%s: Bad PCRE (offset %d): %s\n",
-		myname, erroffset, error);
+	fprintf(stderr, "%s: pcre2_match_data_create() failed\n", myname);
 	exit(RC_ERROR);
       }
+
+    /* At least one character, for ^ (and \b) */
+    if (pcre2_pattern_info(re->code, PCRE2_INFO_MAXLOOKBEHIND,
+			   &lookbehind) != 0)
+	lookbehind = 255;
+    re->lookbehind = (lookbehind > 0) ? lookbehind : 1;
+}
+
+/*
+** pcre_match
+**	Match some output, returns 1 for a match, 0 for no match, -1 for a
+**	partial match (PCRE2_PARTIAL_HARD), or -2 if something went wrong.
+*/
+static int
+pcre_match(re, str, len, start, options)
+struct pcre *re;
+char *str;
+size_t len, start;
+u_int options;
+{
+    int r;
+
+    r = pcre2_match(re->code, (PCRE2_SPTR) str, len, start, options,
+		    re->data, NULL);
+    if (r >= 0)
+	return 1;
+    if (r == PCRE2_ERROR_NOMATCH)
+	return 0;
+    if (r == PCRE2_ERROR_PARTIAL)
+	return -1;
+
+    /* Something bad happened */
+    eprint("Fatal error for %s output analysis: pcre2_match() failed with code %d", target_getname(), r);
+    return -2;
+}
+
+/*
+** pcre_feed
+**	Match some more output, as a new segment of what came before: only
+**	what could still be part of a match is kept for later, that is a
+**	partial match (if any) and enough of what precedes for lookbehind
+**	assertions.  Returns -1 if something went wrong.
+*/
+static int
+pcre_feed(cond, st, buf, len)
+struct condition *cond;
+struct stream *st;
+char *buf;
+size_t len;
+{
+    struct pcre *re;
+    size_t from, keep;
+    int r;
+
+    if (st->matched != 0 || len == 0)
+	return (st->matched == -1) ? -1 : 0;
+
+    re = &(cond->val.pcre);
+    if (stream_keep(st, buf, len) == -1)
+	return -1;
+    r = pcre_match(re, st->line, st->len, st->off,
+		   PCRE2_PARTIAL_HARD | ((st->notbol != 0) ? PCRE2_NOTBOL : 0));
+    if (r == 1)
+	st->matched = 1;
+    else if (r < -1)
+	st->matched = -1;
+    if (st->matched != 0)
+	return (st->matched == -1) ? -1 : 0;
+
+    /* Where the next match attempt should start */
+    from = (r == -1) ? pcre2_get_ovector_pointer(re->data)[0] : st->len;
+    keep = (from > re->lookbehind) ? from - re->lookbehind : 0;
+    if (keep > 0)
+      {
+	memmove(st->line, st->line + keep, st->len - keep);
+	st->len -= keep;
+	st->notbol = 1;
+      }
+    st->off = from - keep;
+    return 0;
 }
 #endif
 
@@ -243,6 +419,8 @@ char *str;
         rbuf = str;
 
     comp(1, re, rbuf);
+    if (stream_safe(rbuf) == 0)
+	streams = -1;
 
     if (fname != NULL)
         free(rbuf);
@@ -252,13 +430,15 @@ char *str;
 
 /*
 ** loadfile
-**	Read a list of one line conditions from a file
+**	Read a list of one line conditions from a file, and build their
+**	prefilter (if worthwhile)
 */
 static void
-loadfile(type, file, list)
+loadfile(type, file, list, pf)
 int type;
 char *file;
 struct condition **list;
+struct prefilter **pf;
 {
     int fd, lineno, cond, max;
     size_t len;
@@ -275,6 +455,7 @@ struct condition **list;
 	exit(RC_ERROR);
       }
     cond = 0;
+    *pf = prefilter_new();
 
     fd = -1;
     len = 0;
@@ -323,7 +504,7 @@ struct condition **list;
 	{
 	  max *= 2;
 	  *list = (struct condition *) realloc(*list,
-					       max* sizeof(struct condition *));
+					       max * sizeof(struct condition));
 	  if (*list == NULL)
 	    {
 	      fprintf(stderr, "%s: realloc() failed: %s\n", myname,
@@ -342,7 +523,7 @@ struct condition **list;
 	  if (type == ANALYZE_LNRE)
 	      compile_re(0, (void *) &((*list)[cond].val.re), ln + 1);
 	  else if (type == ANALYZE_LNPCRE)
-#if defined(HAVE_PCRE_H)
+#if defined(HAVE_PCRE2_H)
 	      compile_pcre(0, (void *) &((*list)[cond].val.pcre), ln + 1);
 #else
 	  {
@@ -353,6 +534,7 @@ struct condition **list;
 #endif
 	  else
 	      abort();
+	  prefilter_add(*pf, ln + 1);
 	  cond += 1;
 	}
       else if (*ln != '\0')
@@ -367,6 +549,12 @@ struct condition **list;
 
     (*list)[cond].ok = -1; /* Mark the end of the list */
 
+    if (prefilter_build(*pf) == 0)
+      {
+	prefilter_free(*pf);
+	*pf = NULL;
+      }
+
     if (lndup != NULL)
 	free(lndup);
 
@@ -377,6 +565,47 @@ struct condition **list;
 	close(fd);
 }
 
+/*
+** plugin_load
+**	Load and initialize an analyzer plugin
+*/
+static void
+plugin_load(file, arg)
+char *file, *arg;
+{
+#if defined(HAVE_DLFCN_H)
+    void *handle;
+    shmux_analyzer_init_t *init;
+
+    handle = dlopen(file, RTLD_NOW|RTLD_LOCAL);
+    if (handle == NULL)
+      {
+	fprintf(stderr, "%s: %s\n", myname, dlerror());
+	exit(RC_ERROR);
+      }
+    plugin_analyze = (shmux_analyzer_analyze_t *)
+	dlsym(handle, "shmux_analyzer_analyze");
+    if (plugin_analyze == NULL)
+      {
+	fprintf(stderr, "%s: %s: No shmux_analyzer_analyze() function!\n",
+		myname, file);
+	exit(RC_ERROR);
+      }
+    plugin_finish = (shmux_analyzer_finish_t *)
+	dlsym(handle, "shmux_analyzer_finish");
+    init = (shmux_analyzer_init_t *) dlsym(handle, "shmux_analyzer_init");
+    if (init != NULL && init(SHMUX_PLUGIN_VERSION, arg) != 0)
+      {
+	fprintf(stderr, "%s: %s: Initialization failed!\n", myname, file);
+	exit(RC_ERROR);
+      }
+#else
+    fprintf(stderr, "%s: This binary was built without plugin support.\n",
+	    myname);
+    exit(RC_ERROR);
+#endif
+}
+
 /*
 ** analyzer_init
 **	Initialization for the analyzer, called early on.
@@ -402,6 +631,39 @@ char *type, *outdef, *errdef;
 	    run_timeout = unit_time(errdef);
 	return ANALYZE_RUN;
       }
+    else if (strcmp(type, "plugin") == 0)
+      {
+	if (outdef == NULL)
+	  {
+	    fprintf(stderr, "%s: No analyzer plugin supplied!\n", myname);
+	    exit(RC_ERROR);
+	  }
+	plugin_load(outdef, errdef);
+	return ANALYZE_PLUGIN;
+      }
+    else if (strcmp(type, "coproc") == 0)
+      {
+	if (outdef == NULL)
+	  {
+	    fprintf(stderr, "%s: No analyzer co-process supplied!\n", myname);
+	    exit(RC_ERROR);
+	  }
+	run_cmd = outdef;
+	run_procs = 1;
+	if (errdef != NULL)
+	  {
+	    char *end;
+
+	    run_procs = strtol(errdef, &end, 10);
+	    if (*end != '\0' || run_procs < 1 || run_procs > 64)
+	      {
+		fprintf(stderr, "%s: Invalid number of analyzer co-processes: %s\n",
+			myname, errdef);
+		exit(RC_ERROR);
+	      }
+	  }
+	return ANALYZE_COPROC;
+      }
     else if (strcmp(type, "regex") == 0 || strcmp(type, "re") == 0
 	     || strcmp(type, "pcre") == 0)
       {
@@ -421,7 +683,7 @@ char *type, *outdef, *errdef;
 	    restr_init((void *) &(out->val.re), compile_re,
 		       &(out->ok), outdef);
 	else
-#if defined(HAVE_PCRE_H)
+#if defined(HAVE_PCRE2_H)
 	    restr_init((void *) &(out->val.pcre), compile_pcre,
 		       &(out->ok), outdef);
 #else
@@ -447,7 +709,7 @@ char *type, *outdef, *errdef;
 	    restr_init((void *) &(err->val.re), compile_re,
 		       &(err->ok), errdef);
 	else
-#if defined(HAVE_PCRE_H)
+#if defined(HAVE_PCRE2_H)
 	    restr_init((void *) &(err->val.pcre), compile_pcre,
 		       &(err->ok), errdef);
 #else
@@ -455,29 +717,26 @@ char *type, *outdef, *errdef;
 #endif
 
 	if (type[0] != 'p')
+	  {
+	    if (streams == 0)
+		streams = 1;
 	    return ANALYZE_RE;
+	  }
 	else
 	    return ANALYZE_PCRE;
       }
     else if (strcmp(type, "lnregex") == 0 || strcmp(type, "lnre") == 0
 	     || strcmp(type, "lnpcre") == 0)
       {
-	if (outdef == NULL)
-	    out = NULL;
-	else
-	    loadfile((type[0] != 'p') ? ANALYZE_LNRE : ANALYZE_LNPCRE,
-		     outdef, &out);
-
-	if (errdef == NULL)
-	    err = NULL;
-	else
-	    loadfile((type[0] != 'p') ? ANALYZE_LNRE : ANALYZE_LNPCRE,
-		     errdef, &err);
+	u_int lntype;
 
-	if (type[0] != 'p')
-	    return ANALYZE_LNRE;
-	else
-	    return ANALYZE_LNPCRE;
+	/* "ln" + "pcre" */
+	lntype = (type[2] != 'p') ? ANALYZE_LNRE : ANALYZE_LNPCRE;
+	if (outdef != NULL)
+	    loadfile(lntype, outdef, &out, &outpf);
+	if (errdef != NULL)
+	    loadfile(lntype, errdef, &err, &errpf);
+	return lntype;
       }
     else
       {
@@ -487,23 +746,17 @@ char *type, *outdef, *errdef;
 }
 
 /*
-** analyzer_run
-**	Analyze output from a target according to user specified regular
-**	expressions.
+** map_outputs
+**	Map the output files of a target, a NUL character being appended to
+**	each of them (see unmap_outputs()).
 */
-int
-analyzer_run(type, ofd, oname, efd, ename)
-u_int type;
+static int
+map_outputs(ofd, oname, efd, ename, output, olen, errput, elen)
 int ofd, efd;
 char *oname, *ename;
+void **output, **errput;
+size_t *olen, *elen;
 {
-    size_t olen, elen;
-    void *output, *errput;
-    int o, e, ok;
-
-    assert( type == ANALYZE_RE || type == ANALYZE_PCRE );
-    assert( out != NULL && err != NULL );
-
     if (oname == NULL || ename == NULL || ofd == -1 || efd == -1)
       {
 	eprint("Unable to analyze output for %s!  (Missing output)",
@@ -521,8 +774,8 @@ char *oname, *ename;
 	eprint("write(%s): %s", oname, strerror(errno));
 	return -1;
       }
-    output = mapfile(2, ofd, oname, &olen);
-    if (output == NULL)
+    *output = mapfile(2, ofd, oname, olen);
+    if (*output == NULL)
 	return -1;
 
     if (lseek(efd, 0, SEEK_END) == -1)
@@ -535,125 +788,614 @@ char *oname, *ename;
 	eprint("write(%s): %s", ename, strerror(errno));
 	return -1;
       }
-    errput = mapfile(2, efd, ename, &elen);
-    if (errput == NULL)
+    *errput = mapfile(2, efd, ename, elen);
+    if (*errput == NULL)
       {
-	unmapfile(2, oname, output, olen);
-        if (ftruncate(ofd, olen-1) != 0)
+	unmapfile(2, oname, *output, *olen);
+        if (ftruncate(ofd, *olen - 1) != 0)
             eprint("ftruncate(%s): %s", oname, strerror(errno));
 	return -1;
       }
-    
-    ok = 0;
-    if (type == ANALYZE_RE)
+
+    return 0;
+}
+
+/*
+** unmap_outputs
+**	Undo map_outputs().
+*/
+static void
+unmap_outputs(ofd, oname, efd, ename, output, olen, errput, elen)
+int ofd, efd;
+char *oname, *ename;
+void *output, *errput;
+size_t olen, elen;
+{
+    unmapfile(2, oname, output, olen);
+    if (ftruncate(ofd, olen-1) != 0)
+        eprint("ftruncate(%s): %s", oname, strerror(errno));
+    unmapfile(2, ename, errput, elen);
+    if (ftruncate(efd, elen-1) != 0)
+        eprint("ftruncate(%s): %s", ename, strerror(errno));
+}
+
+/*
+** analyzer_map
+**	First step of a whole output analysis (-a regex, pcre or plugin):
+**	map the outputs of the current target.  Returns NULL (the problem
+**	having been reported) if they can't be analyzed.
+*/
+void *
+analyzer_map(type, ofd, oname, efd, ename, status)
+u_int type;
+int ofd, efd, status;
+char *oname, *ename;
+{
+    struct whole *wa;
+
+    assert( type == ANALYZE_RE || type == ANALYZE_PCRE
+	    || type == ANALYZE_PLUGIN );
+    assert( type == ANALYZE_PLUGIN || (out != NULL && err != NULL) );
+    assert( type != ANALYZE_PLUGIN || plugin_analyze != NULL );
+
+    wa = (struct whole *) malloc(sizeof(struct whole));
+    if (wa == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    memset((void *) wa, 0, sizeof(struct whole));
+    wa->type = type;
+    wa->ofd = ofd;
+    wa->oname = oname;
+    wa->efd = efd;
+    wa->ename = ename;
+    wa->status = status;
+    wa->target = target_getname();
+
+    if (map_outputs(ofd, oname, efd, ename, &(wa->output), &(wa->olen),
+		    &(wa->errput), &(wa->elen)) == -1)
+      {
+	free(wa);
+	return NULL;
+      }
+#if defined(HAVE_PCRE2_H)
+    if (type == ANALYZE_PCRE)
       {
-	/* First check stdout */
-	o = regexec(&(out->val.re), (char *) output, 0, NULL, 0);
-	if (o != 0 && o != REG_NOMATCH)
+	/* The one in struct pcre can't be shared */
+	wa->data = pcre2_match_data_create(1, NULL);
+	if (wa->data == NULL)
 	  {
-	    /* Something bad happened */
-	    char buf[1024];
-	    
-	    if (regerror(o, &(out->val.re), buf, 1024) != 0)
-		eprint("Fatal error for %s output analysis: regexec() failed with code %s", target_getname(), buf);
-	    else
-		eprint("Fatal error for %s output analysis: regexec() failed with code %d", target_getname(), o);
-	    ok = -1;
+	    perror("pcre2_match_data_create failed");
+	    exit(RC_FATAL);
 	  }
-	else if ((o == 0 && out->ok != 0)
-		 || (o == REG_NOMATCH && out->ok == 0))
-	  {
+      }
+#endif
+    return wa;
+}
+
+/*
+** analyzer_size
+**	Size of the outputs mapped by analyzer_map().
+*/
+size_t
+analyzer_size(wap)
+void *wap;
+{
+    struct whole *wa;
+
+    wa = (struct whole *) wap;
+    return wa->olen + wa->elen - 2;
+}
+
+#if defined(HAVE_PCRE2_H)
+/*
+** whole_pcre
+**	Match a whole output for analyzer_match(), returns 1 for a match, 0
+**	for no match, -1 if something went wrong.
+*/
+static int
+whole_pcre(wa, re, str, len)
+struct whole *wa;
+struct pcre *re;
+char *str;
+size_t len;
+{
+    int r;
+
+    r = pcre2_match(re->code, (PCRE2_SPTR) str, len, 0, 0, wa->data, NULL);
+    if (r >= 0)
+	return 1;
+    if (r == PCRE2_ERROR_NOMATCH)
+	return 0;
+    snprintf(wa->error, sizeof(wa->error),
+	     "pcre2_match() failed with code %d", r);
+    return -1;
+}
+#endif
+
+/*
+** whole_re
+**	Match a whole output for analyzer_match(), returns 1 for a match, 0
+**	for no match, -1 if something went wrong.
+*/
+static int
+whole_re(wa, re, str)
+struct whole *wa;
+regex_t *re;
+char *str;
+{
+    char buf[200];
+    int r;
+
+    r = regexec(re, str, 0, NULL, 0);
+    if (r == 0)
+	return 1;
+    if (r == REG_NOMATCH)
+	return 0;
+    /* Something bad happened */
+    if (regerror(r, re, buf, sizeof(buf)) != 0)
+	snprintf(wa->error, sizeof(wa->error),
+		 "regexec() failed with code %s", buf);
+    else
+	snprintf(wa->error, sizeof(wa->error),
+		 "regexec() failed with code %d", r);
+    return -1;
+}
+
+/*
+** analyzer_match
+**	Second step of a whole output analysis: get the verdict.  This uses
+**	no shared state (and reports nothing), so it may be done by another
+**	thread, except for plugins which are never called concurrently.
+*/
+void
+analyzer_match(wap)
+void *wap;
+{
+    struct whole *wa;
+    int o, e;
+
+    wa = (struct whole *) wap;
+    assert( wa != NULL );
+
+    wa->ok = 0;
+    if (wa->type == ANALYZE_PLUGIN)
+      {
+	struct shmux_output po, pe;
+
+	/* Without the \0 added by map_outputs() */
+	po.data = wa->output;
+	po.len = wa->olen - 1;
+	pe.data = wa->errput;
+	pe.len = wa->elen - 1;
+	wa->ok = plugin_analyze(wa->target, wa->status, &po, &pe,
+				wa->msg, sizeof(wa->msg));
+	wa->msg[sizeof(wa->msg) - 1] = '\0';
+	return;
+      }
+
+    /* First check stdout, then stderr if needed */
+#if defined(HAVE_PCRE2_H)
+    if (wa->type == ANALYZE_PCRE)
+	/* (without the \0 added by map_outputs()) */
+	o = whole_pcre(wa, &(out->val.pcre), (char *) wa->output,
+		       wa->olen - 1);
+    else
+#endif
+	o = whole_re(wa, &(out->val.re), (char *) wa->output);
+    wa->o = o;
+    wa->e = -2;
+    if (o == -1)
+	wa->ok = -1;
+    else if ((o == 1 && out->ok != 0) || (o == 0 && out->ok == 0))
+	/* Matched but shouldn't have, or the other way around */
+	wa->ok = 1;
+    else
+      {
+#if defined(HAVE_PCRE2_H)
+	if (wa->type == ANALYZE_PCRE)
+	    e = whole_pcre(wa, &(err->val.pcre), (char *) wa->errput,
+			   wa->elen - 1);
+	else
+#endif
+	    e = whole_re(wa, &(err->val.re), (char *) wa->errput);
+	wa->e = e;
+	if (e == -1)
+	    wa->ok = -1;
+	else if ((e == 1 && err->ok != 0) || (e == 0 && err->ok == 0))
 	    /* Matched but shouldn't have, or the other way around */
-	    ok = 1;
-	    dprint("Analysis for %s: out=%d[%d] err=?[%d] ok=%d (REG_NOMATCH=%d)", target_getname(), o, out->ok, err->ok, ok, REG_NOMATCH);
+	    wa->ok = 1;
+      }
+}
+
+/*
+** analyzer_unmap
+**	Last step of a whole output analysis, for the current target:
+**	report problems, undo analyzer_map(), and return the verdict, 0 if
+**	the command was successful, 1 if not, -1 if the analysis failed.
+**	The plugin's explanation (if any) is left in msg (if not NULL).
+*/
+int
+analyzer_unmap(wap, msg, msglen)
+void *wap;
+char *msg;
+size_t msglen;
+{
+    struct whole *wa;
+    int ok;
+
+    wa = (struct whole *) wap;
+    assert( wa != NULL );
+
+    if (msg != NULL)
+	msg[0] = '\0';
+    if (wa->type == ANALYZE_PLUGIN)
+      {
+	dprint("Analysis for %s: %d (%s)", target_getname(), wa->ok,
+	       wa->msg);
+	if (wa->ok != 0 && wa->ok != 1)
+	  {
+	    eprint("Fatal error for %s output analysis%s%s",
+		   target_getname(), (wa->msg[0] != '\0') ? ": " : "",
+		   wa->msg);
+	    wa->ok = -1;
 	  }
+	else if (msg != NULL)
+	    strlcpy(msg, wa->msg, msglen);
+      }
+    else if (wa->ok == -1)
+	eprint("Fatal error for %s output analysis: %s", target_getname(),
+	       wa->error);
+    else if (wa->e == -2)
+	dprint("Analysis for %s: out=%d[%d] err=?[%d] ok=%d",
+	       target_getname(), wa->o, out->ok, err->ok, wa->ok);
+    else
+	dprint("Analysis for %s: out=%d[%d] err=%d[%d] ok=%d",
+	       target_getname(), wa->o, out->ok, wa->e, err->ok, wa->ok);
+
+    unmap_outputs(wa->ofd, wa->oname, wa->efd, wa->ename,
+		  wa->output, wa->olen, wa->errput, wa->elen);
+#if defined(HAVE_PCRE2_H)
+    if (wa->data != NULL)
+	pcre2_match_data_free(wa->data);
+#endif
+    ok = wa->ok;
+    free(wa);
+    return ok;
+}
+
+/*
+** analyzer_run
+**	Analyze output from a target according to user specified regular
+**	expressions.
+*/
+int
+analyzer_run(type, ofd, oname, efd, ename)
+u_int type;
+int ofd, efd;
+char *oname, *ename;
+{
+    void *wa;
+
+    assert( type == ANALYZE_RE || type == ANALYZE_PCRE );
+
+    wa = analyzer_map(type, ofd, oname, efd, ename, 0);
+    if (wa == NULL)
+	return -1;
+    analyzer_match(wa);
+    return analyzer_unmap(wa, NULL, 0);
+}
+
+/*
+** analyzer_plugin
+**	Analyze output from a target using the plugin (see plugin.h).
+*/
+int
+analyzer_plugin(ofd, oname, efd, ename, status, msg, msglen)
+int ofd, efd, status;
+char *oname, *ename, *msg;
+size_t msglen;
+{
+    void *wa;
+
+    assert( msg != NULL && msglen > 0 );
+
+    msg[0] = '\0';
+    wa = analyzer_map(ANALYZE_PLUGIN, ofd, oname, efd, ename, status);
+    if (wa == NULL)
+	return -1;
+    analyzer_match(wa);
+    return analyzer_unmap(wa, msg, msglen);
+}
+
+/*
+** analyzer_end
+**	Called before exiting.
+*/
+void
+analyzer_end(void)
+{
+    if (plugin_finish != NULL)
+	plugin_finish();
+    plugin_finish = NULL;
+}
+
+/*
+** stream_safe
+**	Can a regular expression be used on streams?  REG_NEWLINE keeps "."
+**	and non-matching lists from matching a newline, but a newline (or
+**	any control character, which could be part of a range) as well as
+**	some character classes still can.
+*/
+static int
+stream_safe(str)
+char *str;
+{
+    static char *unsafe[] = { "\\s", "\\W", "[:space:]", "[:cntrl:]",
+			      NULL };
+    int i;
+
+    for (i = 0; str[i] != '\0'; i++)
+	if ((u_char) str[i] < ' ' && str[i] != '\t')
+	    return 0;
+    for (i = 0; unsafe[i] != NULL; i++)
+	if (strstr(str, unsafe[i]) != NULL)
+	    return 0;
+    return 1;
+}
+
+/*
+** stream_match
+**	Match a (complete) line from a stream.
+*/
+static void
+stream_match(cond, st, str)
+struct condition *cond;
+struct stream *st;
+char *str;
+{
+    int r;
+
+    r = regexec(&(cond->val.re), str, 0, NULL, 0);
+    if (r == 0)
+	st->matched = 1;
+    else if (r != REG_NOMATCH)
+      {
+	/* Something bad happened */
+	char buf[1024];
+
+	if (regerror(r, &(cond->val.re), buf, 1024) != 0)
+	    eprint("Fatal error for %s output analysis: regexec() failed with code %s", target_getname(), buf);
 	else
+	    eprint("Fatal error for %s output analysis: regexec() failed with code %d", target_getname(), r);
+	st->matched = -1;
+      }
+}
+
+/*
+** stream_feed
+**	Match the complete lines found in some output (all at once, see
+**	struct stream), the rest is kept for later.  The output is left
+**	unchanged.  Returns -1 if something went wrong.
+*/
+static int
+stream_feed(cond, st, buf, len)
+struct condition *cond;
+struct stream *st;
+char *buf;
+size_t len;
+{
+    char *nl, *end, *last;
+    size_t add;
+
+    end = buf + len;
+    if (st->matched != 0 || len == 0)
+	return (st->matched == -1) ? -1 : 0;
+
+    if (st->len > 0)
+      {
+	/* Complete the line started earlier */
+	nl = memchr(buf, '\n', len);
+	add = (nl == NULL) ? len : nl - buf;
+	if (stream_keep(st, buf, add) == -1)
+	    return -1;
+	if (nl == NULL)
+	    return 0;
+	st->line[st->len] = '\0';
+	stream_match(cond, st, st->line);
+	st->len = 0;
+	buf = nl + 1;
+      }
+
+    /* Then all the complete lines at once */
+    last = NULL;
+    for (nl = end; nl > buf; nl--)
+	if (nl[-1] == '\n')
 	  {
-	    /* Stdout ok, let's check stderr */
-	    e = regexec(&(err->val.re), (char *) errput, 0, NULL, 0);
-	    if (e != 0 && e != REG_NOMATCH)
-	      {
-		/* Something bad happened */
-		char buf[1024];
-		
-		if (regerror(e, &(err->val.re), buf, 1024) != 0)
-		    eprint("Fatal error for %s output analysis: regexec() failed with code %s", target_getname(), buf);
-		else
-		    eprint("Fatal error for %s output analysis: regexec() failed with code %d", target_getname(), o);
-		ok = -1;
-	      }
-	    else if ((e == 0 && err->ok != 0)
-		     || (e == REG_NOMATCH && err->ok == 0))
-		/* Matched but shouldn't have, or the other way around */
-		ok = 1;
-	    /* Summary of results */
-	    dprint("Analysis for %s: out=%d[%d] err=%d[%d] ok=%d (REG_NOMATCH=%d)", target_getname(), o, out->ok, e, err->ok, ok, REG_NOMATCH);
+	    last = nl - 1;
+	    break;
 	  }
+    if (last != NULL && st->matched == 0)
+      {
+	*last = '\0';
+	stream_match(cond, st, buf);
+	*last = '\n';
+	buf = last + 1;
       }
-#if defined(HAVE_PCRE_H)
-    else if (type == ANALYZE_PCRE)
+
+    /* And keep what's left */
+    if (buf < end && st->matched == 0 && stream_keep(st, buf, end - buf) == -1)
+	return -1;
+    return (st->matched == -1) ? -1 : 0;
+}
+
+/*
+** stream_keep
+**	Remember the beginning of an incomplete line.
+*/
+static int
+stream_keep(st, buf, len)
+struct stream *st;
+char *buf;
+size_t len;
+{
+    if (st->len + len + 1 > st->size)
       {
-	/* First check stdout */
-	o = pcre_exec(out->val.pcre, NULL, (char *) output, olen,
-		      0, 0, NULL, 0);
-	if (o < 0 && o != PCRE_ERROR_NOMATCH)
+	st->size = st->len + len + 1024;
+	st->line = (char *) realloc(st->line, st->size);
+	if (st->line == NULL)
 	  {
-	    /* Something bad happened */
-	    eprint("Fatal error for %s output analysis: pcre_exec() failed with code %d", target_getname(), o);
-	    ok = -1;
+	    eprint("realloc failed: %s", strerror(errno));
+	    st->len = st->size = 0;
+	    st->matched = -1;
+	    return -1;
 	  }
-	else if ((o >= 0 && out->ok != 0)
-		 || (o == PCRE_ERROR_NOMATCH && out->ok == 0))
+      }
+    memcpy(st->line + st->len, buf, len);
+    st->len += len;
+    return 0;
+}
+
+/*
+** analyzer_open
+**	Start analyzing the output of a target as it arrives, returns NULL
+**	if the conditions don't allow it (see struct stream), in which case
+**	analyzer_run() should be used once the target is done.  PCRE
+**	expressions can always be used, thanks to partial matching (see
+**	pcre_feed()).
+*/
+void *
+analyzer_open(type)
+u_int type;
+{
+    struct stream *st;
+
+    if ((type != ANALYZE_RE || streams != 1) && type != ANALYZE_PCRE)
+	return NULL;
+#if !defined(HAVE_PCRE2_H)
+    if (type == ANALYZE_PCRE)
+	return NULL;
+#endif
+
+    st = (struct stream *) malloc(2 * sizeof(struct stream));
+    if (st == NULL)
+      {
+	eprint("malloc failed: %s", strerror(errno));
+	return NULL;
+      }
+    memset((void *) st, 0, 2 * sizeof(struct stream));
+    st[0].type = st[1].type = type;
+    return st;
+}
+
+/*
+** analyzer_feed
+**	Analyze some output from a target, returns 1 as soon as the output
+**	is known to indicate an error (or -1 if something went wrong), 0
+**	otherwise.
+*/
+int
+analyzer_feed(state, what, buf, len)
+void *state;
+u_int what;
+char *buf;
+size_t len;
+{
+    struct stream *st;
+    int r;
+
+    assert( what == ANALYZE_STDOUT || what == ANALYZE_STDERR );
+
+    st = state;
+#if defined(HAVE_PCRE2_H)
+    if (st->type == ANALYZE_PCRE)
+	r = pcre_feed((what == ANALYZE_STDOUT) ? out : err, st + what - 1,
+		      buf, len);
+    else
+#endif
+	r = stream_feed((what == ANALYZE_STDOUT) ? out : err, st + what - 1,
+			buf, len);
+    if (r == -1)
+	return -1;
+    /* Matched, but shouldn't have */
+    if ((st[0].matched == 1 && out->ok != 0)
+	|| (st[1].matched == 1 && err->ok != 0))
+	return 1;
+    return 0;
+}
+
+/*
+** analyzer_close
+**	Done with a target's output, returns the same as analyzer_run().
+*/
+int
+analyzer_close(state)
+void *state;
+{
+    struct stream *st;
+    struct condition *cond;
+    int i, ok;
+
+    st = state;
+    ok = 0;
+    for (i = 0; i < 2; i++)
+      {
+	cond = (i == 0) ? out : err;
+#if defined(HAVE_PCRE2_H)
+	if (st[i].matched == 0 && st[i].type == ANALYZE_PCRE)
 	  {
-	    /* Matched but shouldn't have, or the other way around */
-	    ok = 1;
-	    dprint("Analysis for %s: out=%d[%d] err=?[%d] ok=%d (PCRE_ERROR_NOMATCH=%d)", target_getname(), o, out->ok, err->ok, ok, PCRE_ERROR_NOMATCH);
+	    /* The end of the output: no more partial matches */
+	    st[i].matched = pcre_match(&(cond->val.pcre),
+				       (st[i].line == NULL) ? "" : st[i].line,
+				       st[i].len, st[i].off,
+				       (st[i].notbol != 0) ? PCRE2_NOTBOL : 0);
+	    if (st[i].matched < 0)
+		st[i].matched = -1;
 	  }
-	else
+#endif
+	if (st[i].matched == 0 && st[i].type == ANALYZE_RE)
 	  {
-	    /* Stdout ok, let's check stderr */
-	    e = pcre_exec(err->val.pcre, NULL, (char *) errput, elen,
-			  0, 0, NULL, 0);
-	    if (e < 0 && e != PCRE_ERROR_NOMATCH)
+	    /* The last line */
+	    if (st[i].line == NULL)
+		stream_match(cond, st + i, "");
+	    else
 	      {
-		/* Something bad happened */
-		eprint("Fatal error for %s output analysis: pcre_exec() failed with code %d", target_getname(), e);
-		ok = -1;
+		st[i].line[st[i].len] = '\0';
+		stream_match(cond, st + i, st[i].line);
 	      }
-	    else if ((e >= 0 && err->ok != 0)
-		     || (e == PCRE_ERROR_NOMATCH && err->ok == 0))
-		/* Matched but shouldn't have, or the other way around */
-		ok = 1;
-	    /* Summary of results */
-	    dprint("Analysis for %s: out=%d[%d] err=%d[%d] ok=%d (PCRE_ERROR_NOMATCH=%d)", target_getname(), o, out->ok, e, err->ok, ok, PCRE_ERROR_NOMATCH);
 	  }
+	if (st[i].matched == -1)
+	    ok = -1;
+	else if (ok == 0 && ((st[i].matched == 1 && cond->ok != 0)
+			     || (st[i].matched == 0 && cond->ok == 0)))
+	    /* Matched but shouldn't have, or the other way around */
+	    ok = 1;
+	free(st[i].line);
       }
-    else
-	abort();
-#endif
+    dprint("Analysis for %s: out=%d[%d] err=%d[%d] ok=%d",
+	   target_getname(), st[0].matched, out->ok, st[1].matched, err->ok,
+	   ok);
+    free(st);
 
-    unmapfile(2, oname, output, olen);
-    if (ftruncate(ofd, olen-1) != 0)
-        eprint("ftruncate(%s): %s", oname, strerror(errno));
-    unmapfile(2, ename, errput, elen);
-    if (ftruncate(efd, elen-1) != 0)
-        eprint("ftruncate(%s): %s", ename, strerror(errno));
-    
     return ok;
 }
 
 /*
 ** analyzer_lnrun
 **	Analyze a single line of output from a target according to user
-**	specified regular expressions.
+**	specified regular expressions.  The line is NUL terminated, and its
+**	length given (for pcre).
 */
 int
-analyzer_lnrun(type, what, str)
+analyzer_lnrun(type, what, str, len)
 u_int type, what;
 char *str;
+size_t len;
 {
-    struct condition *list;
-    int r;
+    struct condition *list, *cond;
+    struct prefilter *pf;
+    int r, i, n, *cand;
 
     assert( type == ANALYZE_LNRE || type == ANALYZE_LNPCRE );
     assert( what == ANALYZE_STDOUT || what == ANALYZE_STDERR );
@@ -662,6 +1404,7 @@ char *str;
     if (what == ANALYZE_STDOUT)
       {
 	list = out;
+	pf = outpf;
 	/* Special case: no condition defined == any output is good */
 	if (list == NULL)
 	    return 0;
@@ -669,22 +1412,26 @@ char *str;
     else
       {
 	list = err;
+	pf = errpf;
 	/* Special case: no condition defined == there can't be any output */
-	if (list == NULL && str[0] != '\0')
-	    return 1;
+	if (list == NULL)
+	    return (str[0] != '\0') ? 1 : 0;
       }
 
-    while (list->ok != -1)
+    /* Only try the conditions which may match, in order */
+    n = (pf != NULL) ? prefilter_scan(pf, str, len, &cand) : -1;
+    for (i = 0; (n == -1) ? list[i].ok != -1 : i < n; i++)
       {
+	cond = (n == -1) ? &(list[i]) : &(list[cand[i]]);
 	if (type == ANALYZE_LNRE)
 	  {
-	    r = regexec(&(list->val.re), str, 0, NULL, 0);
+	    r = regexec(&(cond->val.re), str, 0, NULL, 0);
 	    if (r != 0 && r != REG_NOMATCH)
 	      {
 		/* Something bad happened */
 		char buf[1024];
 		
-		if (regerror(r, &(list->val.re), buf, 1024) != 0)
+		if (regerror(r, &(cond->val.re), buf, 1024) != 0)
 		    eprint("Fatal error for %s output analysis: regexec() failed with code %s", target_getname(), buf);
 		else
 		    eprint("Fatal error for %s output analysis: regexec() failed with code %d", target_getname(), r);
@@ -692,36 +1439,26 @@ char *str;
 	      }
 	    else
 	      {
-		dprint("Analysis for %s: %d[%d] (REG_NOMATCH=%d)", target_getname(), r, list->ok, REG_NOMATCH);
+		dprint("Analysis for %s: %d[%d] (REG_NOMATCH=%d)", target_getname(), r, cond->ok, REG_NOMATCH);
 		if (r == 0)
 		    /* Matched */
-		    return list->ok;
+		    return cond->ok;
 	      }
 	  }
-#if defined(HAVE_PCRE_H)
+#if defined(HAVE_PCRE2_H)
 	else if (type == ANALYZE_LNPCRE)
 	  {
-	    r = pcre_exec(list->val.pcre, NULL, str, strlen(str),
-			  0, 0, NULL, 0);
-	    if (r < 0 && r != PCRE_ERROR_NOMATCH)
-	      {
-		/* Something bad happened */
-		eprint("Fatal error for %s output analysis: pcre_exec() failed with code %d", target_getname(), r);
+	    r = pcre_match(&(cond->val.pcre), str, len, 0, 0);
+	    if (r < 0)
 		return -1;
-	      }
-	    else
-	      {
-		dprint("Analysis for %s: %d[%d] (PCRE_ERROR_NOMATCH=%d)", target_getname(), r, list->ok, PCRE_ERROR_NOMATCH);
-		if (r >= 0)
-		    /* Matched */
-		    return list->ok;
-	      }
+	    dprint("Analysis for %s: %d[%d]", target_getname(), r, cond->ok);
+	    if (r == 1)
+		/* Matched */
+		return cond->ok;
 	  }
 #endif
 	else
 	    abort();
-
-	list += 1;
       }
 
     dprint("Analysis for %s: OK!", target_getname());
@@ -748,3 +1485,66 @@ analyzer_timeout(void)
 {
     return run_timeout;
 }
+
+/*
+** analyzer_procs
+**	Returns the number of analyzer co-processes
+*/
+int
+analyzer_procs(void)
+{
+    return run_procs;
+}
+
+#if defined(BENCH)
+/*
+** bench_free_conditions
+**	Free a list of conditions of the given type.
+*/
+static void
+bench_free_conditions(type, list)
+u_int type;
+struct condition *list;
+{
+    struct condition *c;
+
+    if (list == NULL)
+	return;
+    for (c = list; c->ok != -1; c++)
+      {
+	if (type == ANALYZE_RE || type == ANALYZE_LNRE)
+	    regfree(&(c->val.re));
+#if defined(HAVE_PCRE2_H)
+	else
+	  {
+	    pcre2_match_data_free(c->val.pcre.data);
+	    pcre2_code_free(c->val.pcre.code);
+	  }
+#endif
+	/* ANALYZE_RE and ANALYZE_PCRE have a single condition */
+	if (type == ANALYZE_RE || type == ANALYZE_PCRE)
+	    break;
+      }
+    free(list);
+}
+
+/*
+** bench_analyzer_reset
+**	Forget about the conditions (of the type analyzer_init() returned),
+**	so bench.c can call analyzer_init() again.
+*/
+void
+bench_analyzer_reset(type)
+u_int type;
+{
+    bench_free_conditions(type, out);
+    bench_free_conditions(type, err);
+    out = err = NULL;
+    if (outpf != NULL)
+	prefilter_free(outpf);
+    if (errpf != NULL)
+	prefilter_free(errpf);
+    outpf = errpf = NULL;
+    streams = 0;
+}
+#endif
@@ -16,14 +16,26 @@
 #define ANALYZE_PCRE   3
 #define ANALYZE_LNPCRE 4
 #define ANALYZE_RUN    5
+#define ANALYZE_PLUGIN 6
+#define ANALYZE_COPROC 7
 
 #define ANALYZE_STDOUT 1
 #define ANALYZE_STDERR 2
 
 int analyzer_init(char *, char *, char *);
 int analyzer_run(u_int, int, char *, int, char *);
-int analyzer_lnrun(u_int, u_int, char *);
+void *analyzer_map(u_int, int, char *, int, char *, int);
+size_t analyzer_size(void *);
+void analyzer_match(void *);
+int analyzer_unmap(void *, char *, size_t);
+void *analyzer_open(u_int);
+int analyzer_feed(void *, u_int, char *, size_t);
+int analyzer_close(void *);
+int analyzer_lnrun(u_int, u_int, char *, size_t);
+int analyzer_plugin(int, char *, int, char *, int, char *, size_t);
+void analyzer_end(void);
 char *analyzer_cmd(void);
 u_int analyzer_timeout(void);
+int analyzer_procs(void);
 
 #endif
@@ -0,0 +1,348 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#if defined(HAVE_PTHREAD_H)
+# include <pthread.h>
+#endif
+
+#include "analyzer.h"
+#include "apool.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Whole output analysis thread pool: rather than stalling the main loop
+** while a large output is matched, loop() maps it (see analyzer_map())
+** and submits it here.  A worker thread gets the verdict (see
+** analyzer_match()), and wakes up the main loop through a pipe.  Verdicts
+** are handed back in the order the outputs were submitted, so loop() also
+** submits verdicts it already has (without an output) while any analysis
+** is pending.
+*/
+
+#if defined(HAVE_PTHREAD_H)
+
+struct job
+{
+    void	*wa;		/* see analyzer_map(), NULL if none */
+    void	*data;		/* for the caller */
+    int		done;		/* verdict available? */
+    struct job	*next;
+};
+
+static pthread_t *threads;
+static int nthreads;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static struct job *head, *tail;	/* submitted jobs, in order */
+static struct job *todo;	/* next job for the workers */
+static int pending;		/* jobs submitted, not handed back */
+static int quit;
+static int wake[2] = { -1, -1 };	/* worker -> main loop */
+
+static void *worker(void *);
+
+/*
+** worker
+**	Worker thread main loop.
+*/
+static void *
+worker(arg)
+void *arg;
+{
+    struct job *job;
+
+    pthread_mutex_lock(&lock);
+    while (1)
+      {
+	while (quit == 0 && todo == NULL)
+	    pthread_cond_wait(&work, &lock);
+	if (quit != 0)
+	    break;
+	job = todo;
+	todo = job->next;
+	pthread_mutex_unlock(&lock);
+
+	if (job->wa != NULL)
+	    analyzer_match(job->wa);
+
+	pthread_mutex_lock(&lock);
+	job->done = 1;
+	/* If the pipe is full, the main loop is about to wake up anyways */
+	write(wake[1], "", 1);
+      }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/*
+** apool_start
+**	Start (up to) the given number of worker threads, but no more than
+**	there are processors.  Returns -1 if there's no thread.
+*/
+int
+apool_start(count)
+int count;
+{
+    sigset_t all, saved;
+    int i;
+
+    assert( count > 0 );
+
+#if defined(_SC_NPROCESSORS_ONLN)
+      {
+	long cpus;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && count > cpus)
+	    count = cpus;
+      }
+#endif
+
+    if (pipe(wake) == -1)
+      {
+	eprint("pipe(): %s", strerror(errno));
+	return -1;
+      }
+    fcntl(wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake[1], F_SETFL, O_NONBLOCK);
+
+    threads = (pthread_t *) malloc(count * sizeof(pthread_t));
+    if (threads == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+
+    /* Signals are for the main loop */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (i = 0; i < count; i++)
+      {
+	int rc;
+
+	rc = pthread_create(&(threads[nthreads]), NULL, worker, NULL);
+	if (rc != 0)
+	  {
+	    eprint("pthread_create(): %s", strerror(rc));
+	    break;
+	  }
+	nthreads += 1;
+      }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (nthreads == 0)
+      {
+	close(wake[0]);
+	close(wake[1]);
+	wake[0] = wake[1] = -1;
+	return -1;
+      }
+    dprint("%d analysis thread(s)", nthreads);
+    return 0;
+}
+
+/*
+** apool_nfds
+**	Number of pollfd structures needed by apool_poll().
+*/
+int
+apool_nfds(void)
+{
+    return (nthreads > 0) ? 1 : 0;
+}
+
+/*
+** apool_pending
+**	Number of submitted analyses not handed back yet.
+*/
+int
+apool_pending(void)
+{
+    return pending;
+}
+
+/*
+** apool_submit
+**	Submit an output for analysis (or NULL to just wait for those
+**	submitted before), data is handed back with the verdict.
+*/
+void
+apool_submit(wa, data)
+void *wa, *data;
+{
+    struct job *job;
+
+    assert( nthreads > 0 );
+
+    job = (struct job *) malloc(sizeof(struct job));
+    if (job == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    job->wa = wa;
+    job->data = data;
+    job->done = 0;
+    job->next = NULL;
+
+    pthread_mutex_lock(&lock);
+    if (tail == NULL)
+	head = job;
+    else
+	tail->next = job;
+    tail = job;
+    if (todo == NULL)
+	todo = job;
+    pending += 1;
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+** apool_poll
+**	Fill the pollfd structure before calling poll().
+*/
+void
+apool_poll(pfd)
+struct pollfd *pfd;
+{
+    if (nthreads == 0)
+	return;
+    pfd->fd = wake[0];
+    pfd->events = POLLIN;
+    pfd->revents = 0;
+}
+
+/*
+** apool_done
+**	Following poll(), return the data of the next analysis along with
+**	the analysis (see analyzer_unmap()), or NULL if its verdict isn't
+**	available yet.
+*/
+void *
+apool_done(pfd, wa)
+struct pollfd *pfd;
+void **wa;
+{
+    struct job *job;
+    void *data;
+
+    if (nthreads == 0)
+	return NULL;
+
+    if ((pfd->revents & POLLIN) != 0)
+      {
+	char buf[64];
+
+	while (read(wake[0], buf, sizeof(buf)) > 0)
+	    ;
+	pfd->revents = 0;
+      }
+
+    pthread_mutex_lock(&lock);
+    job = head;
+    if (job == NULL || job->done == 0)
+      {
+	pthread_mutex_unlock(&lock);
+	return NULL;
+      }
+    head = job->next;
+    if (head == NULL)
+	tail = NULL;
+    pending -= 1;
+    pthread_mutex_unlock(&lock);
+
+    *wa = job->wa;
+    data = job->data;
+    free(job);
+    return data;
+}
+
+/*
+** apool_end
+**	Stop the worker threads, pending analyses are abandoned.
+*/
+void
+apool_end(void)
+{
+    int i;
+
+    if (nthreads == 0)
+	return;
+
+    pthread_mutex_lock(&lock);
+    quit = 1;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&lock);
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+    free(threads);
+    nthreads = 0;
+    close(wake[0]);
+    close(wake[1]);
+    wake[0] = wake[1] = -1;
+}
+
+#else /* HAVE_PTHREAD_H */
+
+/* No threads, outputs are analyzed by the main loop */
+
+int
+apool_start(count)
+int count;
+{
+    return -1;
+}
+
+int
+apool_nfds(void)
+{
+    return 0;
+}
+
+int
+apool_pending(void)
+{
+    return 0;
+}
+
+void
+apool_submit(wa, data)
+void *wa, *data;
+{
+    abort();
+}
+
+void
+apool_poll(pfd)
+struct pollfd *pfd;
+{
+}
+
+void *
+apool_done(pfd, wa)
+struct pollfd *pfd;
+void **wa;
+{
+    return NULL;
+}
+
+void
+apool_end(void)
+{
+}
+
+#endif /* HAVE_PTHREAD_H */
@@ -0,0 +1,23 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_APOOL_H_)
+# define _APOOL_H_
+
+struct pollfd;
+
+int   apool_start(int);
+int   apool_nfds(void);
+int   apool_pending(void);
+void  apool_submit(void *, void *);
+void  apool_poll(struct pollfd *);
+void *apool_done(struct pollfd *, void **);
+void  apool_end(void);
+
+#endif
@@ -0,0 +1,963 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+/*
+** Microbenchmarks for the internal functions sitting on shmux's hot paths.
+**
+** Each benchmark runs a fixed number of iterations (optionally scaled with
+** -s) so that results from different builds are directly comparable, and
+** reports the average time per operation in nanoseconds.
+**
+** When given a shmux binary (-x), simulated fleets of "sh" targets are
+** also run through it to measure throughput, spawn rate and peak memory
+** usage.  Target outputs are derived from a fixed seed, per benchmark.
+*/
+
+#include "os.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "analyzer.h"
+#include "byteset.h"
+#include "status.h"
+#include "target.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+char *myname;
+
+/* Hooks only compiled in with -DBENCH, see analyzer.c, loop.c and target.c */
+void bench_analyzer_reset(u_int);
+void bench_parse_reset(int, int);
+void bench_parse_child(int, int, char *);
+void bench_target_reset(void);
+int  bench_split_argv(const char *, int, char **);
+
+#define SEED	20021120
+
+static double scale = 1.0;
+static char **filters = NULL;
+static char *shmux = NULL;
+static volatile long sink;
+
+static void usage(void);
+static double now(void);
+static int wanted(char *);
+static long iterations(long);
+static void report(char *, long, double);
+static void report_value(char *, char *, long, double, char *);
+static u_int rnd(u_int *);
+static char *tmpfile_make(char *, char *, size_t);
+static char *chunks_make(char *, char *, int, int, int *);
+static void bench_parse(char *, char *, int, int, int, long);
+static void bench_targets(int);
+static void bench_lnrun(void);
+static void bench_run(void);
+static void bench_byteset(void);
+static void bench_argv(void);
+static long maxrss(pid_t);
+static void rmtree(char *);
+static void bench_fleet(char *, int, int, int, int);
+
+static char *errors[] = {
+    "!error", "!ERROR", "!fail(ed|ure)?", "!FATAL", "![Cc]annot ",
+    "![Nn]o such file", "![Pp]ermission denied", "!Segmentation fault",
+    "!Traceback", "!core dumped", "!timed? ?out", "!Connection refused",
+    "!No space left", "!Read-only file system", "!unable to",
+    "!E: ", "!W: ", "!dpkg: ", "!rpm: ", "!panic",
+    "=.", NULL
+};
+
+static char *loglines[] = {
+    "Reading package lists...",
+    "Building dependency tree...",
+    "Reading state information...",
+    "The following packages will be upgraded:",
+    "  libc6 libc-bin openssl libssl3",
+    "4 upgraded, 0 newly installed, 0 to remove and 0 not upgraded.",
+    "Need to get 7,614 kB of archives.",
+    "Get:1 http://deb.example.net/debian stable/main amd64 libc6 [2,756 kB]",
+    "Preparing to unpack .../libc6_2.36-9_amd64.deb ...",
+    "Unpacking libc6:amd64 (2.36-9) over (2.36-8) ...",
+    "Setting up libc6:amd64 (2.36-9) ...",
+    "Processing triggers for man-db (2.11.2-2) ...",
+    NULL
+};
+
+/*
+** usage
+**	Output usage information
+*/
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [ -s <scale> ] [ -x <shmux> ] [ <benchmark> ... ]\n", myname);
+    fprintf(stderr, "  -s <scale>    Multiply iteration counts (Default: 1).\n");
+    fprintf(stderr, "  -x <shmux>    Run simulated fleets through this shmux binary.\n");
+    fprintf(stderr, "  <benchmark>   Only run benchmarks whose name contains this string.\n");
+}
+
+/*
+** now
+**	Current time in nanoseconds
+*/
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec * 1e9 + (double) tv.tv_usec * 1e3;
+}
+
+/*
+** wanted
+**	Should the named benchmark be run?
+*/
+static int
+wanted(name)
+char *name;
+{
+    char **f;
+
+    if (filters == NULL || *filters == NULL)
+	return 1;
+    for (f = filters; *f != NULL; f++)
+	if (strstr(name, *f) != NULL)
+	    return 1;
+    return 0;
+}
+
+/*
+** iterations
+**	Apply the scale factor to an iteration count
+*/
+static long
+iterations(base)
+long base;
+{
+    long n;
+
+    n = (long) (base * scale);
+    return (n > 0) ? n : 1;
+}
+
+/*
+** report
+**	Output the result of a benchmark
+*/
+static void
+report(name, iters, elapsed)
+char *name;
+long iters;
+double elapsed;
+{
+    printf("%-36s %10ld %14.1f ns/op\n", name, iters, elapsed / iters);
+    fflush(stdout);
+}
+
+/*
+** report_value
+**	Output a measurement other than a time per operation
+*/
+static void
+report_value(name, metric, count, value, unit)
+char *name, *metric, *unit;
+long count;
+double value;
+{
+    char full[128];
+
+    snprintf(full, sizeof(full), "%s/%s", name, metric);
+    printf("%-36s %10ld %14.1f %s\n", full, count, value, unit);
+    fflush(stdout);
+}
+
+/*
+** rnd
+**	Deterministic pseudo random numbers, so every run does the same work.
+**	Each benchmark has its own seed, starting from SEED, so that its
+**	work doesn't depend on which other benchmarks ran before it.
+*/
+static u_int
+rnd(seed)
+u_int *seed;
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7fff;
+}
+
+/*
+** tmpfile_make
+**	Create a temporary file with the given content, return its name
+*/
+static char *
+tmpfile_make(tag, data, len)
+char *tag, *data;
+size_t len;
+{
+    static char fname[PATH_MAX];
+    char *tmp;
+    int fd;
+
+    tmp = getenv("TMPDIR");
+    snprintf(fname, sizeof(fname), "%s/%s.%d.%s",
+	     (tmp != NULL) ? tmp : "/tmp", myname, (int) getpid(), tag);
+    fd = open(fname, O_RDWR|O_CREAT|O_TRUNC, 0600);
+    if (fd == -1 || write(fd, data, len) != len)
+      {
+	fprintf(stderr, "%s: %s: %s\n", myname, fname, strerror(errno));
+	exit(RC_ERROR);
+      }
+    close(fd);
+    return fname;
+}
+
+/*
+** chunks_make
+**	Build a synthetic output stream made of lines of the requested
+**	length (eol being appended to each), and cut it in chunks of at
+**	most chunksz bytes, the way read() would.
+*/
+static char *
+chunks_make(line, eol, linesz, chunksz, count)
+char *line, *eol;
+int linesz, chunksz, *count;
+{
+    char *stream, *chunks;
+    int len, pos, i;
+
+    len = 65536;
+    stream = (char *) malloc(len);
+    chunks = (char *) malloc(len + len / chunksz + 1);
+    if (stream == NULL || chunks == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+
+    pos = 0;
+    while (pos + linesz + strlen(eol) < len)
+      {
+	for (i = 0; i < linesz; i++)
+	    stream[pos + i] = line[i % strlen(line)];
+	pos += linesz;
+	memcpy(stream + pos, eol, strlen(eol));
+	pos += strlen(eol);
+      }
+    len = pos;
+
+    /* Chunks are stored NUL separated, one after the other */
+    *count = 0;
+    pos = i = 0;
+    while (pos < len)
+      {
+	int sz;
+
+	sz = (len - pos > chunksz) ? chunksz : len - pos;
+	memcpy(chunks + i, stream + pos, sz);
+	chunks[i + sz] = '\0';
+	i += sz + 1;
+	pos += sz;
+	*count += 1;
+      }
+    free(stream);
+    return chunks;
+}
+
+/*
+** bench_parse
+**	parse_child() on a synthetic stream
+*/
+static void
+bench_parse(name, eol, linesz, chunksz, fd, base)
+char *name, *eol;
+int linesz, chunksz, fd;
+long base;
+{
+    char *chunks, *chunk, buffer[8192];
+    long iters, i;
+    int count, c;
+    double start;
+
+    if (wanted(name) == 0)
+	return;
+
+    assert( chunksz < sizeof(buffer) );
+    chunks = chunks_make("abcdefghijklmnopqrstuvwxyz0123456789 ", eol,
+			 linesz, chunksz, &count);
+    bench_parse_reset(0, fd);
+
+    iters = iterations(base);
+    chunk = chunks;
+    c = 0;
+    start = 0;
+    for (i = -iters / 10; i < iters; i++)
+      {
+	if (i == 0)
+	    start = now();
+	/* parse_child() modifies the buffer, just like loop() would */
+	strlcpy(buffer, chunk, sizeof(buffer));
+	bench_parse_child(ANALYZE_NONE, 1, buffer);
+	chunk += strlen(chunk) + 1;
+	if (++c == count)
+	  {
+	    chunk = chunks;
+	    c = 0;
+	  }
+      }
+    report(name, iters, now() - start);
+
+    bench_parse_reset(0, -1);
+    free(chunks);
+}
+
+/*
+** bench_targets
+**	target_next() and target_setbyhname() with a large number of targets
+*/
+static void
+bench_targets(count)
+int count;
+{
+    char mname[64], hname[64], sname[64], **names;
+    long iters, i;
+    double start;
+    u_int seed;
+    int t;
+
+    snprintf(mname, sizeof(mname), "target_next/miss/%d", count);
+    snprintf(hname, sizeof(hname), "target_next/hit/%d", count);
+    snprintf(sname, sizeof(sname), "target_setbyhname/%d", count);
+    if (wanted(mname) == 0 && wanted(hname) == 0 && wanted(sname) == 0)
+	return;
+
+    names = (char **) malloc(count * sizeof(char *));
+    if (names == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    target_default("ssh");
+    for (t = 0; t < count; t++)
+      {
+	char host[64];
+
+	snprintf(host, sizeof(host), "user@host%07d.dc%d.example.net",
+		 t, t % 4);
+	target_add(host);
+	names[t] = strchr(host, '@') + 1;
+	names[t] = strdup(names[t]);
+      }
+
+    /*
+    ** Typical state in the middle of a run: the first half of the targets
+    ** is done, the second half is waiting for its command to run.
+    */
+    status_init(0, 0, 1);
+    for (t = 0; t < count; t++)
+      {
+	int phase;
+
+	target_setbynum(t);
+	for (phase = 1; phase < ((t < count / 2) ? 5 : 3); phase++)
+	  {
+	    target_start();
+	    target_result(1);
+	  }
+      }
+
+    if (wanted(mname) != 0)
+      {
+	/* Nobody is waiting for the analyzer: full scan */
+	iters = iterations(100000000 / count);
+	for (i = -iters / 10; i < iters; i++)
+	  {
+	    if (i == 0)
+		start = now();
+	    sink += target_next(4);
+	  }
+	report(mname, iters, now() - start);
+      }
+
+    if (wanted(hname) != 0)
+      {
+	/* The next command to run is halfway through the list */
+	iters = iterations(100000000 / count);
+	for (i = -iters / 10; i < iters; i++)
+	  {
+	    if (i == 0)
+		start = now();
+	    sink += target_next(3);
+	  }
+	report(hname, iters, now() - start);
+      }
+
+    if (wanted(sname) != 0)
+      {
+	iters = iterations(50000000 / count);
+	seed = SEED;
+	for (i = -iters / 10; i < iters; i++)
+	  {
+	    if (i == 0)
+		start = now();
+	    sink += target_setbyhname(names[(rnd(&seed) << 15
+						  | rnd(&seed)) % count]);
+	  }
+	report(sname, iters, now() - start);
+      }
+
+    for (t = 0; t < count; t++)
+	free(names[t]);
+    free(names);
+    bench_target_reset();
+}
+
+/*
+** bench_lnrun
+**	analyzer_lnrun() with a realistic list of conditions, for each line
+**	analyzer, including the rate for a large line oriented output
+*/
+static void
+bench_lnrun(void)
+{
+    static char *types[] = { "lnregex", "regex",
+#if defined(HAVE_PCRE2_H)
+			     "lnpcre", "pcre",
+#endif
+			     NULL };
+    char buf[16384], name[64], *fname, *bigname, line[256], *output, *cp, *nl;
+    long iters, i, lines;
+    int len, l, t, osize;
+    u_int type;
+    double start;
+
+    if (wanted("analyzer_lnrun") == 0)
+	return;
+
+    len = 0;
+    for (l = 0; errors[l] != NULL; l++)
+	len += snprintf(buf + len, sizeof(buf) - len, "%s\n", errors[l]);
+    fname = strdup(tmpfile_make("lnre", buf, len));
+    if (fname == NULL)
+      {
+	perror("strdup failed");
+	exit(RC_ERROR);
+      }
+
+    /* A long list, as used to catch all known failures of a fleet */
+    len = 0;
+    for (l = 0; l < 100; l++)
+	len += snprintf(buf + len, sizeof(buf) - len,
+			"!svc%03d(\\[[0-9]+\\])?: [Ee]rror\n!ORA-%05d\n",
+			l, 1000 + l * 7);
+    len += snprintf(buf + len, sizeof(buf) - len, "=.\n");
+    bigname = tmpfile_make("lnre200", buf, len);
+
+    /* A large output, as a command would produce */
+    osize = 4 * 1048576;
+    output = (char *) malloc(osize + 256);
+    if (output == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    len = l = 0;
+    while (len < osize)
+      {
+	len += snprintf(output + len, osize + 256 - len, "%s\n", loglines[l]);
+	if (loglines[++l] == NULL)
+	    l = 0;
+      }
+
+    for (t = 0; types[t] != NULL; t += 2)
+      {
+	type = analyzer_init(types[t], fname, NULL);
+
+	/* Lines that go through the whole list before being accepted */
+	snprintf(name, sizeof(name), "analyzer_lnrun/%s/ok", types[t+1]);
+	iters = iterations(200000);
+	l = 0;
+	for (i = -iters / 10; i < iters; i++)
+	  {
+	    if (i == 0)
+		start = now();
+	    /* analyzer_lnrun() is given a fresh line, like in parse_child() */
+	    strlcpy(line, loglines[l], sizeof(line));
+	    len = strlen(line);
+	    sink += analyzer_lnrun(type, ANALYZE_STDOUT, line, len);
+	    if (loglines[++l] == NULL)
+		l = 0;
+	  }
+	report(name, iters, now() - start);
+
+	/* Lines flagged as errors early */
+	snprintf(name, sizeof(name), "analyzer_lnrun/%s/error", types[t+1]);
+	iters = iterations(200000);
+	for (i = -iters / 10; i < iters; i++)
+	  {
+	    if (i == 0)
+		start = now();
+	    strlcpy(line, "E: Unable to locate package foo", sizeof(line));
+	    len = strlen(line);
+	    sink += analyzer_lnrun(type, ANALYZE_STDOUT, line, len);
+	  }
+	report(name, iters, now() - start);
+
+	/* The whole output, split in lines in place like parse_child() */
+	snprintf(name, sizeof(name), "analyzer_lnrun/%s/4m", types[t+1]);
+	lines = 0;
+	start = now();
+	for (i = 0; i < iterations(4); i++)
+	    for (cp = output; (nl = strchr(cp, '\n')) != NULL; cp = nl + 1)
+	      {
+		*nl = '\0';
+		sink += analyzer_lnrun(type, ANALYZE_STDOUT, cp, nl - cp);
+		*nl = '\n';
+		lines += 1;
+	      }
+	report_value(name, "rate", lines, lines / ((now() - start) / 1e9),
+		     "lines/s");
+
+	/* Same, with 200 conditions */
+	bench_analyzer_reset(type);
+	type = analyzer_init(types[t], bigname, NULL);
+	snprintf(name, sizeof(name), "analyzer_lnrun/%s/4m-200", types[t+1]);
+	lines = 0;
+	start = now();
+	for (i = 0; i < iterations(1); i++)
+	    for (cp = output; (nl = strchr(cp, '\n')) != NULL; cp = nl + 1)
+	      {
+		*nl = '\0';
+		sink += analyzer_lnrun(type, ANALYZE_STDOUT, cp, nl - cp);
+		*nl = '\n';
+		lines += 1;
+	      }
+	report_value(name, "rate", lines, lines / ((now() - start) / 1e9),
+		     "lines/s");
+	bench_analyzer_reset(type);
+      }
+
+    unlink(fname);
+    unlink(bigname);
+    free(fname);
+    free(output);
+}
+
+/*
+** bench_run
+**	analyzer_run() on (mostly) benign outputs of various sizes, and
+**	analyzer_feed() on the same outputs given in read() sized chunks
+*/
+static void
+bench_run(void)
+{
+    static int sizes[] = { 1024, 65536, 1048576, 0 };
+    char name[64], fname[64], *data, *oname, *ename;
+    void *state;
+    long iters, i;
+    int s, len, l, off, ofd, efd;
+    double start;
+
+    if (wanted("analyzer_run") == 0 && wanted("analyzer_feed") == 0)
+	return;
+
+    analyzer_init("regex", "!(error|[Ff]ail(ed|ure)?|Traceback)", NULL);
+    for (s = 0; sizes[s] != 0; s++)
+      {
+	snprintf(name, sizeof(name), "analyzer_run/regex/%d", sizes[s]);
+	snprintf(fname, sizeof(fname), "analyzer_feed/regex/%d", sizes[s]);
+	if (wanted(name) == 0 && wanted(fname) == 0)
+	    continue;
+
+	data = (char *) malloc(sizes[s] + 256);
+	if (data == NULL)
+	  {
+	    perror("malloc failed");
+	    exit(RC_ERROR);
+	  }
+	len = l = 0;
+	while (len < sizes[s])
+	  {
+	    len += snprintf(data + len, sizes[s] + 256 - len, "%s\n",
+			    loglines[l]);
+	    if (loglines[++l] == NULL)
+		l = 0;
+	  }
+	oname = strdup(tmpfile_make("stdout", data, len));
+	ename = strdup(tmpfile_make("stderr", "", 0));
+	ofd = open(oname, O_RDWR, 0);
+	efd = open(ename, O_RDWR, 0);
+	if (ofd == -1 || efd == -1)
+	  {
+	    fprintf(stderr, "%s: open(): %s\n", myname, strerror(errno));
+	    exit(RC_ERROR);
+	  }
+
+	iters = iterations(104857600 / sizes[s]);
+	if (iters > 20000)
+	    iters = iterations(20000);
+	if (wanted(name) != 0)
+	  {
+	    for (i = -iters / 10; i < iters; i++)
+	      {
+		if (i == 0)
+		    start = now();
+		sink += analyzer_run(ANALYZE_RE, ofd, oname, efd, ename);
+	      }
+	    report(name, iters, now() - start);
+	  }
+
+	if (wanted(fname) != 0)
+	  {
+	    for (i = -iters / 10; i < iters; i++)
+	      {
+		if (i == 0)
+		    start = now();
+		state = analyzer_open(ANALYZE_RE);
+		if (state == NULL)
+		    abort();
+		/* Same chunks as the main loop would get */
+		for (off = 0; off < len; off += 8191)
+		    sink += analyzer_feed(state, ANALYZE_STDOUT, data + off,
+					  (len - off < 8191) ? len - off : 8191);
+		sink += analyzer_close(state);
+	      }
+	    report(fname, iters, now() - start);
+	  }
+
+	close(ofd); close(efd);
+	unlink(oname); unlink(ename);
+	free(oname); free(ename);
+	free(data);
+      }
+    bench_analyzer_reset(ANALYZE_RE);
+}
+
+/*
+** bench_byteset
+**	byteset_test() on every possible exit code
+*/
+static void
+bench_byteset(void)
+{
+    long iters, i;
+    double start;
+
+    if (wanted("byteset_test") == 0)
+	return;
+
+    byteset_init(BSET_ERROR, "1-3,5,10-20,255");
+    iters = iterations(50000000);
+    for (i = -iters / 10; i < iters; i++)
+      {
+	if (i == 0)
+	    start = now();
+	sink += byteset_test(BSET_ERROR, i & 0xff);
+      }
+    report("byteset_test", iters, now() - start);
+}
+
+/*
+** bench_argv
+**	split_argv() and target_getcmd()
+*/
+static void
+bench_argv(void)
+{
+    char *opts, *args[32];
+    long iters, i;
+    double start;
+
+    opts = "-x -a -oLogLevel=ERROR -o ConnectTimeout=5 -p 22 \"-oProxyCommand=ssh bastion.example.net -W %h:%p\"";
+
+    if (wanted("split_argv") != 0)
+      {
+	iters = iterations(1000000);
+	for (i = -iters / 10; i < iters; i++)
+	  {
+	    if (i == 0)
+		start = now();
+	    sink += bench_split_argv(opts, 32, args);
+	  }
+	report("split_argv", iters, now() - start);
+      }
+
+    if (wanted("target_getcmd") != 0)
+      {
+	if (setenv("SHMUX_SSH_OPTS", opts, 1) != 0)
+	  {
+	    perror("setenv failed");
+	    exit(RC_ERROR);
+	  }
+	iters = iterations(1000000);
+	for (i = -iters / 10; i < iters; i++)
+	  {
+	    if (i == 0)
+		start = now();
+	    sink += (long) target_getcmd("uptime");
+	  }
+	report("target_getcmd/ssh-opts", iters, now() - start);
+
+	unsetenv("SHMUX_SSH_OPTS");
+	iters = iterations(1000000);
+	for (i = -iters / 10; i < iters; i++)
+	  {
+	    if (i == 0)
+		start = now();
+	    sink += (long) target_getcmd("uptime");
+	  }
+	report("target_getcmd/ssh", iters, now() - start);
+      }
+}
+
+/*
+** maxrss
+**	Peak resident set size (in KB) of a running process, or -1 if
+**	unavailable.  (Only implemented for Linux' /proc.)
+*/
+static long
+maxrss(pid)
+pid_t pid;
+{
+    char fname[64], line[256];
+    FILE *f;
+    long kb;
+
+    snprintf(fname, sizeof(fname), "/proc/%d/status", (int) pid);
+    f = fopen(fname, "r");
+    if (f == NULL)
+	return -1;
+    kb = -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+      {
+	/* Until exec() completes, the child still has our own footprint. */
+	if (strncmp(line, "Name:", 5) == 0
+	    && strstr(line, "shmux") == NULL)
+	    break;
+	if (strncmp(line, "VmHWM:", 6) == 0)
+	    kb = atol(line + 6);
+      }
+    fclose(f);
+    return kb;
+}
+
+/*
+** rmtree
+**	Remove a (flat) directory created by bench_fleet()
+*/
+static void
+rmtree(dir)
+char *dir;
+{
+    char fname[PATH_MAX];
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(dir);
+    if (d == NULL)
+	return;
+    while ((de = readdir(d)) != NULL)
+      {
+	if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+	    continue;
+	snprintf(fname, sizeof(fname), "%s/%s", dir, de->d_name);
+	unlink(fname);
+      }
+    closedir(d);
+    rmdir(dir);
+}
+
+/*
+** bench_fleet
+**	Run shmux against a simulated fleet of "sh" targets, each of which
+**	outputs a (pseudo random) number of lines up to maxlines.
+*/
+static void
+bench_fleet(name, count, max, maxlines, test)
+char *name;
+int count, max, maxlines, test;
+{
+    char dir[PATH_MAX], smax[16], *tmp, *argv[20];
+    int in[2], devnull, argc, t, status;
+    long rss, peak;
+    double start, elapsed;
+    u_int seed;
+    pid_t pid;
+    FILE *f;
+
+    if (shmux == NULL || wanted(name) == 0)
+	return;
+
+    tmp = getenv("TMPDIR");
+    snprintf(dir, sizeof(dir), "%s/%s.%d.fleet.XXXXXX",
+	     (tmp != NULL) ? tmp : "/tmp", myname, (int) getpid());
+    if (mkdtemp(dir) == NULL)
+      {
+	fprintf(stderr, "%s: mkdtemp(%s): %s\n", myname, dir, strerror(errno));
+	exit(RC_ERROR);
+      }
+    snprintf(smax, sizeof(smax), "%d", max);
+
+    argc = 0;
+    argv[argc++] = shmux;
+    argv[argc++] = "-BsQ";
+    argv[argc++] = "-S"; argv[argc++] = "all";
+    argv[argc++] = "-r"; argv[argc++] = "sh";
+    argv[argc++] = "-M"; argv[argc++] = smax;
+    argv[argc++] = "-o"; argv[argc++] = dir;
+    if (test != 0)
+	argv[argc++] = "-t";
+    argv[argc++] = "-c";
+    argv[argc++] = "n=${SHMUX_TARGET##*-}; while [ $n -gt 0 ]; do echo \"$SHMUX_TARGET output line $n\"; n=$((n-1)); done";
+    argv[argc++] = "-";
+    argv[argc] = NULL;
+
+    devnull = open("/dev/null", O_WRONLY, 0);
+    if (devnull == -1 || pipe(in) == -1)
+      {
+	perror("open/pipe failed");
+	exit(RC_ERROR);
+      }
+
+    start = now();
+    pid = fork();
+    if (pid == -1)
+      {
+	perror("fork failed");
+	exit(RC_ERROR);
+      }
+    if (pid == 0)
+      {
+	dup2(in[0], 0);
+	dup2(devnull, 1);
+	dup2(devnull, 2);
+	close(in[0]); close(in[1]); close(devnull);
+	execv(shmux, argv);
+	_exit(127);
+      }
+    close(in[0]);
+    close(devnull);
+
+    /* Targets are named after the number of lines they output. */
+    f = fdopen(in[1], "w");
+    if (f == NULL)
+      {
+	perror("fdopen failed");
+	exit(RC_ERROR);
+      }
+    seed = SEED;
+    for (t = 0; t < count; t++)
+	fprintf(f, "host%06d-%d\n", t, (int) (rnd(&seed) % (maxlines + 1)));
+    fclose(f);
+
+    peak = -1;
+    while (waitpid(pid, &status, WNOHANG) == 0)
+      {
+	rss = maxrss(pid);
+	if (rss > peak)
+	    peak = rss;
+	poll(NULL, 0, 5);
+      }
+    elapsed = now() - start;
+
+    if (WIFEXITED(status) == 0 || WEXITSTATUS(status) != RC_OK)
+      {
+	fprintf(stderr, "%s: %s failed for %s (status %d)\n",
+		myname, shmux, name, status);
+	exit(RC_ERROR);
+      }
+
+    report_value(name, "throughput", count, count / (elapsed / 1e9),
+		 "targets/s");
+    report_value(name, "spawnrate", count * ((test != 0) ? 2 : 1),
+		 count * ((test != 0) ? 2 : 1) / (elapsed / 1e9), "spawns/s");
+    if (peak >= 0)
+	report_value(name, "maxrss", count, (double) peak, "KB");
+
+    rmtree(dir);
+}
+
+int
+main(int argc, char **argv)
+{
+    int c, devnull;
+
+    myname = "bench";
+
+    while ((c = getopt(argc, argv, "hs:x:")) != -1)
+	switch (c)
+	  {
+	  case 's':
+	      scale = atof(optarg);
+	      if (scale <= 0)
+		{
+		  fprintf(stderr, "%s: Invalid -s argument!\n", myname);
+		  exit(RC_ERROR);
+		}
+	      break;
+	  case 'x':
+	      shmux = optarg;
+	      if (access(shmux, X_OK) != 0)
+		{
+		  fprintf(stderr, "%s: %s: %s\n", myname, shmux, strerror(errno));
+		  exit(RC_ERROR);
+		}
+	      break;
+	  case 'h':
+	      usage();
+	      exit(RC_OK);
+	  default:
+	      usage();
+	      exit(RC_ERROR);
+	  }
+    filters = argv + optind;
+
+    /* No status line, not interactive */
+    term_init(5, 1, 0, 0, 0, 0);
+
+    devnull = open("/dev/null", O_WRONLY, 0);
+    if (devnull == -1)
+      {
+	perror("open(/dev/null)");
+	exit(RC_ERROR);
+      }
+
+    bench_parse("parse_child/short", "\n", 20, 8191, -1, 50000);
+    bench_parse("parse_child/long", "\n", 2000, 8191, -1, 50000);
+    bench_parse("parse_child/crlf", "\r\n", 20, 8191, -1, 50000);
+    bench_parse("parse_child/partial", "\n", 80, 100, -1, 500000);
+    bench_parse("parse_child/partial-long", "\n", 3000, 512, -1, 500000);
+    bench_parse("parse_child/short-file", "\n", 20, 8191, devnull, 5000);
+
+    bench_targets(10000);
+    bench_targets(100000);
+    bench_targets(1000000);
+
+    /* The remaining benchmarks work on behalf of a single target */
+    target_default("ssh");
+    target_add("user@host0000001.dc1.example.net");
+    target_setbynum(0);
+
+    bench_lnrun();
+    bench_run();
+    bench_byteset();
+    bench_argv();
+
+    bench_fleet("fleet/quiet", 1000, 100, 0, 0);
+    bench_fleet("fleet/chatty", 500, 50, 200, 0);
+    bench_fleet("fleet/tested", 500, 100, 10, 1);
+
+    close(devnull);
+    exit(RC_OK);
+}
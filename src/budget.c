@@ -0,0 +1,164 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <ctype.h>
+
+#include "budget.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Error budget (-L): rather than stopping at the first failure, failures
+** are tolerated as long as there are no more than:
+**  - <count> failed targets overall, and
+**  - <pct> percent of the last <window> targets to complete (or of all
+**    those which completed, so far), once enough have for a single
+**    failure to be within the budget.
+** Either limit may be omitted.  Results are accounted for as they come,
+** and the counters start from scratch after budget_reset().
+*/
+#define BUDGET_WINDOW	100	/* Default sliding window */
+
+static int count = -1;		/* absolute limit, -1: none */
+static u_int pct, window;	/* percentage over a window, 0: none */
+static u_int sample;		/* minimum results for the percentage */
+static char *ring;		/* last <window> results, 1: failure */
+static u_int rpos, rfailed, failed, total;
+
+/*
+** budget_init
+**	Parse a "<count>", "<pct>%[/<window>]" or "<pct>%[/<window>],<count>"
+**	-L argument.
+*/
+void
+budget_init(spec)
+char *spec;
+{
+    char *cp, *end;
+    u_int val;
+
+    cp = spec;
+    while (*cp != '\0')
+      {
+	if (isdigit((int) *cp) == 0)
+	    break;
+	val = strtoul(cp, &end, 10);
+	if (*end == '%')
+	  {
+	    if (pct != 0 || val == 0 || val > 100)
+		break;
+	    pct = val;
+	    window = BUDGET_WINDOW;
+	    end += 1;
+	    if (*end == '/')
+	      {
+		if (isdigit((int) end[1]) == 0)
+		    break;
+		window = strtoul(end + 1, &end, 10);
+		if (window == 0)
+		    break;
+	      }
+	  }
+	else if (count == -1)
+	    count = val;
+	else
+	    break;
+	if (*end == ',' && end[1] != '\0')
+	    end += 1;
+	else if (*end != '\0')
+	    break;
+	cp = end;
+      }
+    if (*cp != '\0' || cp == spec)
+      {
+	fprintf(stderr, "%s: Invalid error budget: %s\n", myname, spec);
+	exit(RC_ERROR);
+      }
+
+    if (window > 0)
+      {
+	sample = (100 + pct - 1) / pct;
+	if (sample > window)
+	    sample = window;
+	ring = (char *) malloc(window);
+	if (ring == NULL)
+	  {
+	    perror("malloc failed");
+	    exit(RC_ERROR);
+	  }
+      }
+    budget_reset();
+}
+
+/*
+** budget_enabled
+**	Was an error budget given?
+*/
+int
+budget_enabled(void)
+{
+    return (count >= 0 || window > 0);
+}
+
+/*
+** budget_reset
+**	Forget about past results, e.g. when resuming after the budget was
+**	exceeded.
+*/
+void
+budget_reset(void)
+{
+    if (ring != NULL)
+	memset(ring, 0, window);
+    rpos = rfailed = failed = total = 0;
+}
+
+/*
+** budget_result
+**	Account for a target result, returns 1 if the budget is exceeded.
+*/
+int
+budget_result(ok)
+int ok;
+{
+    u_int last;
+
+    if (budget_enabled() == 0)
+	return 0;
+
+    total += 1;
+    if (ok == 0)
+	failed += 1;
+    if (window > 0)
+      {
+	rfailed -= ring[rpos];
+	ring[rpos] = (ok == 0) ? 1 : 0;
+	rfailed += ring[rpos];
+	rpos = (rpos + 1) % window;
+      }
+
+    if (ok != 0)
+	return 0;
+    if (count >= 0 && failed > (u_int) count)
+      {
+	eprint("Error budget exceeded: %u targets failed", failed);
+	return 1;
+      }
+    last = (total < window) ? total : window;
+    if (window > 0 && last >= sample && rfailed * 100 > pct * last)
+      {
+	eprint("Error budget exceeded: %u of the last %u targets failed",
+	       rfailed, last);
+	return 1;
+      }
+    return 0;
+}
@@ -0,0 +1,18 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_BUDGET_H_)
+# define _BUDGET_H_
+
+void budget_init(char *);
+int  budget_enabled(void);
+void budget_reset(void);
+int  budget_result(int);
+
+#endif
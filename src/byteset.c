@@ -15,7 +15,7 @@ static char const rcsid[] = "@(#)$Id$";
 
 extern char *myname;
 
-static char sets[2][256];
+static char sets[3][256];
 
 /*
 ** byteset_init
@@ -29,7 +29,7 @@ char *definition;
     char *str, *tok, *dash;
     int i, j;
 
-    assert( set == 0 || set == 1 );
+    assert( set >= 0 && set <= 2 );
     assert( definition != NULL );
 
     i = 0;
@@ -83,7 +83,7 @@ int
 byteset_test(set, byte)
 int set, byte;
 {
-    assert( set == 0 || set == 1 );
+    assert( set >= 0 && set <= 2 );
     assert( byte >= 0 && byte <= 255 );
 
     return sets[set][byte] == 0;
@@ -12,6 +12,7 @@
 
 #define BSET_ERROR	0
 #define BSET_SHOW	1
+#define BSET_RETRY	2
 
 void byteset_init(int, char *);
 int  byteset_test(int, int);
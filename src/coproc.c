@@ -0,0 +1,521 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "coproc.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Analyzer co-processes (-a coproc): rather than running a program for
+** each target, the program is started once (or a few times), and given
+** one request per target on its standard input:
+**
+**	<target> TAB <output directory> TAB <exit code> NEWLINE
+**
+** It must answer each request, in order, with a line on its standard
+** output starting with 0 if the command was successful, or another
+** number if not, optionally followed by a space and an explanation.
+** Both directions use the same socket, which is never allowed to block.
+*/
+#define COPROC_INMAX	1024	/* Longest verdict line */
+
+#if defined(MSG_NOSIGNAL)
+# define COPROC_SENDFLAGS MSG_NOSIGNAL
+#else
+# define COPROC_SENDFLAGS 0
+#endif
+
+struct coproc
+{
+    pid_t	pid;
+    int		fd;		/* -1 once gone */
+    int		*queue;		/* targets waiting for a verdict */
+    int		qhead, qlen, qsz;
+    char	*out;		/* requests not sent yet */
+    size_t	outlen, outsz, outpos;
+    char	in[COPROC_INMAX];	/* verdicts */
+    int		inlen;
+    int		discard;	/* skipping the end of a long line? */
+};
+
+static char *cmd;
+static struct coproc *procs;
+static int nprocs;
+static int pending;		/* requests waiting for a verdict */
+
+static void gone(struct coproc *, char *);
+static void flush(struct coproc *);
+static int  exit_code(char *, char *, char *, size_t);
+static char *verdict(struct coproc *, int *, int *);
+
+/*
+** coproc_start
+**	Start the analyzer co-processes.
+*/
+void
+coproc_start(name, count)
+char *name;
+int count;
+{
+    struct rlimit fdlimit;
+    int i;
+
+    assert( count > 0 );
+
+    procs = (struct coproc *) malloc(count * sizeof(struct coproc));
+    if (procs == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    memset((void *) procs, 0, count * sizeof(struct coproc));
+    cmd = name;
+    nprocs = count;
+
+    if (getrlimit(RLIMIT_NOFILE, &fdlimit) == -1)
+	fdlimit.rlim_cur = 1024;
+
+    for (i = 0; i < nprocs; i++)
+      {
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	  {
+	    fprintf(stderr, "%s: socketpair(): %s\n", myname, strerror(errno));
+	    exit(RC_ERROR);
+	  }
+
+	procs[i].pid = fork();
+	if (procs[i].pid == -1)
+	  {
+	    fprintf(stderr, "%s: fork(): %s\n", myname, strerror(errno));
+	    exit(RC_ERROR);
+	  }
+
+	if (procs[i].pid == 0)
+	  {
+	    struct sigaction sa;
+	    char *argv[2];
+	    int fd;
+
+	    sigemptyset(&sa.sa_mask);
+	    sa.sa_flags = 0;
+	    sa.sa_handler = SIG_DFL;
+	    sigaction(SIGINT, &sa, NULL);
+	    sigaction(SIGTSTP, &sa, NULL);
+	    sigaction(SIGCONT, &sa, NULL);
+	    sigaction(SIGWINCH, &sa, NULL);
+
+	    /* Keep analyzing while shmux waits for children to abort */
+	    setpgid(0, 0);
+
+	    if (dup2(sv[1], 0) == -1 || dup2(sv[1], 1) == -1)
+		_exit(RC_ERROR);
+	    for (fd = 3; fd <= fdlimit.rlim_cur; fd++)
+		close(fd);
+
+	    argv[0] = cmd;
+	    argv[1] = NULL;
+	    execvp(argv[0], argv);
+	    fprintf(stderr, "%s: execvp(%s): %s\n", myname, cmd,
+		    strerror(errno));
+	    _exit(RC_ERROR);
+	  }
+
+	close(sv[1]);
+	procs[i].fd = sv[0];
+	fcntl(procs[i].fd, F_SETFL, O_NONBLOCK);
+	fcntl(procs[i].fd, F_SETFD, FD_CLOEXEC);
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+	  {
+	    int on = 1;
+	    setsockopt(procs[i].fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+	  }
+#endif
+	dprint("Analyzer co-process %d: pid = %d fd = %d",
+	       i, procs[i].pid, procs[i].fd);
+      }
+}
+
+/*
+** coproc_nfds
+**	Number of pollfd structures needed by coproc_poll()
+*/
+int
+coproc_nfds(void)
+{
+    return nprocs;
+}
+
+/*
+** coproc_pending
+**	Number of targets waiting for a verdict.
+*/
+int
+coproc_pending(void)
+{
+    return pending;
+}
+
+/*
+** coproc_send
+**	Send the request for a target to the least busy co-process.
+**	Returns 0 on success, -1 if the request can't be sent.
+*/
+int
+coproc_send(num, target, odir)
+int num;
+char *target, *odir;
+{
+    struct coproc *cp;
+    char status[16];
+    int i, sz;
+
+    cp = NULL;
+    for (i = 0; i < nprocs; i++)
+	if (procs[i].fd != -1 && (cp == NULL || procs[i].qlen < cp->qlen))
+	    cp = &(procs[i]);
+    if (cp == NULL)
+      {
+	eprint("No analyzer co-process left for %s", target);
+	return -1;
+      }
+
+    if (exit_code(odir, target, status, sizeof(status)) == -1)
+	return -1;
+
+    sz = strlen(target) + strlen(odir) + strlen(status) + 3;
+    if (cp->outlen + sz + 1 > cp->outsz)
+      {
+	char *out;
+	size_t outsz;
+
+	outsz = (cp->outsz == 0) ? 1024 : cp->outsz;
+	while (cp->outlen + sz + 1 > outsz)
+	    outsz *= 2;
+	out = (char *) realloc(cp->out, outsz);
+	if (out == NULL)
+	  {
+	    perror("realloc failed");
+	    exit(RC_FATAL);
+	  }
+	cp->out = out;
+	cp->outsz = outsz;
+      }
+    snprintf(cp->out + cp->outlen, sz + 1, "%s\t%s\t%s\n", target, odir,
+	     status);
+    cp->outlen += sz;
+
+    if (cp->qlen == cp->qsz)
+      {
+	int *queue;
+
+	/* Grow, and unwrap */
+	queue = (int *) malloc(((cp->qsz == 0) ? 16 : cp->qsz * 2)
+			       * sizeof(int));
+	if (queue == NULL)
+	  {
+	    perror("malloc failed");
+	    exit(RC_FATAL);
+	  }
+	for (i = 0; i < cp->qlen; i++)
+	    queue[i] = cp->queue[(cp->qhead + i) % cp->qsz];
+	if (cp->queue != NULL)
+	    free(cp->queue);
+	cp->queue = queue;
+	cp->qhead = 0;
+	cp->qsz = (cp->qsz == 0) ? 16 : cp->qsz * 2;
+      }
+    cp->queue[(cp->qhead + cp->qlen) % cp->qsz] = num;
+    cp->qlen += 1;
+    pending += 1;
+
+    dprint("Analyzer co-process %d: %s queued (%d)",
+	   (int) (cp - procs), target, cp->qlen);
+    flush(cp);
+    return 0;
+}
+
+/*
+** coproc_poll
+**	Fill the pollfd structures before calling poll().
+*/
+void
+coproc_poll(pfd)
+struct pollfd *pfd;
+{
+    int i;
+
+    for (i = 0; i < nprocs; i++)
+      {
+	pfd[i].fd = procs[i].fd;
+	pfd[i].events = POLLIN;
+	if (procs[i].outpos < procs[i].outlen)
+	    pfd[i].events |= POLLOUT;
+	pfd[i].revents = 0;
+      }
+}
+
+/*
+** coproc_input
+**	Process socket events following poll(), returning the next verdict
+**	(if any) as an explanation (possibly empty, NULL if there is no
+**	verdict), the target number and the verdict itself: 0 for a
+**	success, 1 for an error, or -1 if the analysis failed.
+*/
+char *
+coproc_input(pfd, num, ok)
+struct pollfd *pfd;
+int *num, *ok;
+{
+    char *msg;
+    int i;
+
+    for (i = 0; i < nprocs; i++)
+      {
+	struct coproc *cp;
+	int sz;
+
+	cp = &(procs[i]);
+	if (cp->fd == -1 || pfd[i].fd != cp->fd || pfd[i].revents == 0)
+	    continue;
+
+	if ((pfd[i].revents & POLLOUT) != 0)
+	    flush(cp);
+	if ((pfd[i].revents & ~POLLOUT) != 0 && cp->fd != -1
+	    && cp->inlen < COPROC_INMAX - 1)
+	  {
+	    sz = read(cp->fd, cp->in + cp->inlen, COPROC_INMAX - 1 - cp->inlen);
+	    if (sz == 0)
+		gone(cp, NULL);
+	    else if (sz == -1 && errno != EAGAIN && errno != EINTR)
+		gone(cp, strerror(errno));
+	    else if (sz > 0)
+		cp->inlen += sz;
+	  }
+	pfd[i].revents = 0;
+      }
+
+    for (i = 0; i < nprocs; i++)
+	if ((msg = verdict(&(procs[i]), num, ok)) != NULL)
+	    return msg;
+
+    return NULL;
+}
+
+/*
+** coproc_end
+**	Close the co-processes input, and give them a chance to exit.
+*/
+void
+coproc_end(void)
+{
+    time_t start;
+    int i, left, status;
+
+    for (i = 0; i < nprocs; i++)
+	if (procs[i].fd != -1)
+	  {
+	    close(procs[i].fd);
+	    procs[i].fd = -1;
+	  }
+
+    start = time(NULL);
+    do
+      {
+	left = 0;
+	for (i = 0; i < nprocs; i++)
+	  {
+	    if (procs[i].pid <= 0)
+		continue;
+	    if (waitpid(procs[i].pid, &status, WNOHANG) == 0)
+		left += 1;
+	    else
+	      {
+		if (WIFEXITED(status) != 0 && WEXITSTATUS(status) != 0)
+		    eprint("Analyzer co-process exited with status %d",
+			   WEXITSTATUS(status));
+		procs[i].pid = 0;
+	      }
+	  }
+	if (left > 0)
+	    poll(NULL, 0, 100);
+      }
+    while (left > 0 && time(NULL) - start < 5);
+
+    for (i = 0; i < nprocs; i++)
+	if (procs[i].pid > 0)
+	  {
+	    dprint("Killing analyzer co-process %d", procs[i].pid);
+	    kill(-procs[i].pid, SIGKILL);
+	    waitpid(procs[i].pid, &status, 0);
+	    procs[i].pid = 0;
+	  }
+}
+
+/*
+** gone
+**	A co-process can't be talked to anymore, the targets it still had
+**	get an error (see verdict()).
+*/
+static void
+gone(cp, why)
+struct coproc *cp;
+char *why;
+{
+    if (cp->qlen > 0 || why != NULL)
+	eprint("Analyzer co-process is gone%s%s",
+	       (why != NULL) ? ": " : "", (why != NULL) ? why : "");
+    close(cp->fd);
+    cp->fd = -1;
+    cp->outlen = cp->outpos = 0;
+}
+
+/*
+** flush
+**	Send as much of the pending requests as possible.
+*/
+static void
+flush(cp)
+struct coproc *cp;
+{
+    int sz;
+
+    while (cp->outpos < cp->outlen)
+      {
+	sz = send(cp->fd, cp->out + cp->outpos, cp->outlen - cp->outpos,
+		  COPROC_SENDFLAGS);
+	if (sz == -1)
+	  {
+	    if (errno == EINTR)
+		continue;
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		gone(cp, strerror(errno));
+	    return;
+	  }
+	cp->outpos += sz;
+      }
+    cp->outlen = cp->outpos = 0;
+}
+
+/*
+** exit_code
+**	Get the exit code of the command from the output directory.
+*/
+static int
+exit_code(odir, target, buf, len)
+char *odir, *target, *buf;
+size_t len;
+{
+    char fname[PATH_MAX];
+    int fd, sz;
+
+    snprintf(fname, sizeof(fname), "%s/%s.exit", odir, target);
+    fd = open(fname, O_RDONLY, 0);
+    if (fd == -1)
+      {
+	eprint("open(%s): %s", fname, strerror(errno));
+	return -1;
+      }
+    sz = read(fd, buf, len - 1);
+    close(fd);
+    if (sz <= 0)
+      {
+	eprint("read(%s): %s", fname, (sz == 0) ? "empty" : strerror(errno));
+	return -1;
+      }
+    buf[sz] = '\0';
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return 0;
+}
+
+/*
+** verdict
+**	Get the next verdict from a co-process, if any.
+*/
+static char *
+verdict(cp, num, ok)
+struct coproc *cp;
+int *num, *ok;
+{
+    static char msg[COPROC_INMAX];
+    char *nl, *end;
+    long rc;
+    int len;
+
+    while (cp->inlen > 0)
+      {
+	cp->in[cp->inlen] = '\0';
+	nl = memchr(cp->in, '\n', cp->inlen);
+	if (nl == NULL && cp->inlen < COPROC_INMAX - 1 && cp->fd != -1)
+	    return NULL;
+	len = (nl != NULL) ? nl - cp->in + 1 : cp->inlen;
+	*(cp->in + len - ((nl != NULL) ? 1 : 0)) = '\0';
+	strlcpy(msg, cp->in, sizeof(msg));
+	memmove(cp->in, cp->in + len, cp->inlen - len);
+	cp->inlen -= len;
+
+	if (cp->discard == 1)
+	  {
+	    /* End of a line which was too long */
+	    cp->discard = (nl == NULL);
+	    continue;
+	  }
+	cp->discard = (nl == NULL);
+
+	if (cp->qlen == 0)
+	  {
+	    eprint("Unexpected output from analyzer co-process: %s", msg);
+	    continue;
+	  }
+	*num = cp->queue[cp->qhead];
+	cp->qhead = (cp->qhead + 1) % cp->qsz;
+	cp->qlen -= 1;
+	pending -= 1;
+
+	msg[strcspn(msg, "\r")] = '\0';
+	rc = strtol(msg, &end, 10);
+	if (end == msg || (*end != '\0' && *end != ' ' && *end != '\t'))
+	  {
+	    eprint("Invalid verdict from analyzer co-process: %s", msg);
+	    *ok = -1;
+	    msg[0] = '\0';
+	    return msg;
+	  }
+	*ok = (rc == 0) ? 0 : 1;
+	while (*end == ' ' || *end == '\t')
+	    end += 1;
+	return end;
+      }
+
+    if (cp->fd == -1 && cp->qlen > 0)
+      {
+	/* Gone without answering */
+	*num = cp->queue[cp->qhead];
+	cp->qhead = (cp->qhead + 1) % cp->qsz;
+	cp->qlen -= 1;
+	pending -= 1;
+	*ok = -1;
+	msg[0] = '\0';
+	return msg;
+      }
+
+    return NULL;
+}
@@ -0,0 +1,23 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_COPROC_H_)
+# define _COPROC_H_
+
+struct pollfd;
+
+void  coproc_start(char *, int);
+int   coproc_nfds(void);
+int   coproc_pending(void);
+int   coproc_send(int, char *, char *);
+void  coproc_poll(struct pollfd *);
+char *coproc_input(struct pollfd *, int *, int *);
+void  coproc_end(void);
+
+#endif
@@ -0,0 +1,590 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ctl.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+#define CTL_CLIENTS 8		/* Maximum number of simultaneous clients */
+#define CTL_INMAX   2048	/* Maximum request size */
+#define CTL_TIMEOUT 10		/* Seconds a client may take to be served */
+
+#if defined(MSG_NOSIGNAL)
+# define CTL_SENDFLAGS MSG_NOSIGNAL
+#else
+# define CTL_SENDFLAGS 0
+#endif
+
+#define CTL_FREE  0
+#define CTL_READ  1
+#define CTL_BUSY  2
+#define CTL_WRITE 3
+
+struct client
+{
+    int		fd;
+    int		state;		/* CTL_FREE, CTL_READ, CTL_BUSY, CTL_WRITE */
+    time_t	when;		/* time of last state change */
+    int		http;		/* HTTP request? */
+    int		failed;		/* request failed? */
+    char	*type;		/* HTTP Content-Type */
+    char	in[CTL_INMAX];	/* request */
+    int		inlen;
+    char	*out;		/* reply */
+    size_t	outlen, outsz, outpos;
+};
+
+static char *path;
+static int lfd = -1;
+static struct client clients[CTL_CLIENTS];
+static struct client *current;
+
+static void drop(struct client *);
+static char *request(struct client *, int);
+static void finish(struct client *);
+static void flush(struct client *);
+
+/*
+** ctl_init
+**	Create the control socket, if any.
+*/
+void
+ctl_init(name)
+char *name;
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t old;
+    int i;
+
+    for (i = 0; i < CTL_CLIENTS; i++)
+	clients[i].fd = -1;
+
+    if (name == NULL)
+	return;
+
+    if (strlen(name) >= sizeof(addr.sun_path))
+      {
+	fprintf(stderr, "%s: \"%s\": name is too long\n", myname, name);
+	exit(RC_ERROR);
+      }
+    memset((void *) &addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path, name, sizeof(addr.sun_path));
+
+    /* Remove a stale socket left behind, but not one still in use. */
+    if (lstat(name, &st) == 0 && S_ISSOCK(st.st_mode))
+      {
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd != -1
+	    && connect(lfd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+	  {
+	    fprintf(stderr, "%s: %s: socket already in use\n", myname, name);
+	    exit(RC_ERROR);
+	  }
+	if (lfd != -1)
+	    close(lfd);
+	unlink(name);
+      }
+
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd == -1)
+      {
+	fprintf(stderr, "%s: socket(): %s\n", myname, strerror(errno));
+	exit(RC_ERROR);
+      }
+
+    /* The socket lets anyone connecting kill targets, keep it private. */
+    old = umask(077);
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+      {
+	fprintf(stderr, "%s: bind(%s): %s\n", myname, name, strerror(errno));
+	exit(RC_ERROR);
+      }
+    umask(old);
+
+    if (listen(lfd, CTL_CLIENTS) == -1)
+      {
+	fprintf(stderr, "%s: listen(%s): %s\n", myname, name, strerror(errno));
+	unlink(name);
+	exit(RC_ERROR);
+      }
+    fcntl(lfd, F_SETFL, O_NONBLOCK);
+    fcntl(lfd, F_SETFD, FD_CLOEXEC);
+    path = name;
+}
+
+/*
+** ctl_nfds
+**	Number of pollfd structures needed by ctl_poll()
+*/
+int
+ctl_nfds(void)
+{
+    return (lfd == -1) ? 0 : CTL_CLIENTS + 1;
+}
+
+/*
+** ctl_poll
+**	Fill the pollfd structures before calling poll(), and expire clients
+**	which are taking too long.
+*/
+void
+ctl_poll(pfd)
+struct pollfd *pfd;
+{
+    time_t now;
+    int i, avail;
+
+    if (lfd == -1)
+	return;
+
+    now = time(NULL);
+    avail = 0;
+    for (i = 0; i < CTL_CLIENTS; i++)
+      {
+	if (clients[i].state != CTL_FREE && now - clients[i].when > CTL_TIMEOUT)
+	  {
+	    dprint("Control client %d timed out", clients[i].fd);
+	    drop(&(clients[i]));
+	  }
+	pfd[i+1].fd = clients[i].fd;
+	pfd[i+1].revents = 0;
+	if (clients[i].state == CTL_READ)
+	    pfd[i+1].events = POLLIN;
+	else if (clients[i].state == CTL_WRITE)
+	    pfd[i+1].events = POLLOUT;
+	else
+	  {
+	    pfd[i+1].events = 0;
+	    if (clients[i].state == CTL_FREE)
+		avail += 1;
+	  }
+      }
+
+    pfd[0].fd = lfd;
+    pfd[0].events = (avail > 0) ? POLLIN : 0;
+    pfd[0].revents = 0;
+}
+
+/*
+** ctl_input
+**	Process socket events following poll(), returning the next complete
+**	request (or NULL).  Replies to a request are accumulated with
+**	ctl_reply() and sent when ctl_input() is called again.
+*/
+char *
+ctl_input(pfd)
+struct pollfd *pfd;
+{
+    int i;
+
+    if (current != NULL)
+      {
+	finish(current);
+	current = NULL;
+      }
+
+    if (lfd == -1)
+	return NULL;
+
+    if ((pfd[0].revents & POLLIN) != 0)
+      {
+	pfd[0].revents = 0;
+	for (i = 0; i < CTL_CLIENTS; i++)
+	  {
+	    int fd;
+
+	    if (clients[i].state != CTL_FREE)
+		continue;
+	    fd = accept(lfd, NULL, NULL);
+	    if (fd == -1)
+	      {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		    eprint("accept(%s): %s", path, strerror(errno));
+		break;
+	      }
+	    fcntl(fd, F_SETFL, O_NONBLOCK);
+	    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+	      {
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+	      }
+#endif
+	    clients[i].fd = fd;
+	    clients[i].state = CTL_READ;
+	    clients[i].when = time(NULL);
+	    clients[i].http = clients[i].failed = 0;
+	    clients[i].inlen = 0;
+	    clients[i].outlen = clients[i].outpos = 0;
+	    dprint("Control client %d connected", fd);
+	  }
+      }
+
+    for (i = 0; i < CTL_CLIENTS; i++)
+      {
+	struct client *cl;
+	char *cmd;
+	int sz, eof;
+
+	cl = &(clients[i]);
+	if (cl->state == CTL_FREE || pfd[i+1].fd != cl->fd
+	    || pfd[i+1].revents == 0)
+	    continue;
+	pfd[i+1].revents = 0;
+
+	if (cl->state == CTL_WRITE)
+	  {
+	    flush(cl);
+	    continue;
+	  }
+	if (cl->state != CTL_READ)
+	    continue;
+
+	eof = 0;
+	sz = read(cl->fd, cl->in + cl->inlen, CTL_INMAX - 1 - cl->inlen);
+	if (sz == -1 && (errno == EAGAIN || errno == EINTR))
+	    continue;
+	if (sz <= 0)
+	  {
+	    if (sz == -1 || cl->inlen == 0)
+	      {
+		drop(cl);
+		continue;
+	      }
+	    /* Take whatever was received as the request */
+	    eof = 1;
+	  }
+	else
+	    cl->inlen += sz;
+	cl->in[cl->inlen] = '\0';
+
+	cmd = request(cl, eof);
+	if (cmd == NULL)
+	    continue;
+
+	dprint("Control client %d request: %s", cl->fd, cmd);
+	cl->state = CTL_BUSY;
+	current = cl;
+	return cmd;
+      }
+
+    return NULL;
+}
+
+/*
+** ctl_reply
+**	Append to the reply for the request being processed.
+*/
+void
+ctl_reply(char *format, ...)
+{
+    va_list va;
+    int sz;
+
+    assert( current != NULL );
+
+    va_start(va, format);
+    sz = vsnprintf(NULL, 0, format, va);
+    va_end(va);
+    if (sz < 0)
+	return;
+
+    if (current->outlen + sz + 1 > current->outsz)
+      {
+	char *out;
+	size_t outsz;
+
+	outsz = (current->outsz == 0) ? 1024 : current->outsz;
+	while (current->outlen + sz + 1 > outsz)
+	    outsz *= 2;
+	out = (char *) realloc(current->out, outsz);
+	if (out == NULL)
+	  {
+	    perror("realloc failed");
+	    exit(RC_FATAL);
+	  }
+	current->out = out;
+	current->outsz = outsz;
+      }
+
+    va_start(va, format);
+    vsnprintf(current->out + current->outlen, sz + 1, format, va);
+    va_end(va);
+    current->outlen += sz;
+}
+
+/*
+** ctl_fail
+**	Flag the request being processed as failed.
+*/
+void
+ctl_fail(void)
+{
+    assert( current != NULL );
+    current->failed = 1;
+}
+
+/*
+** ctl_quote
+**	Escape a string for use within double quotes (JSON strings and
+**	Prometheus label values).  Returns a static buffer.
+*/
+char *
+ctl_quote(str)
+char *str;
+{
+    static char buffer[1024];
+    int i;
+
+    i = 0;
+    while (*str != '\0' && i < sizeof(buffer) - 7)
+      {
+	if (*str == '"' || *str == '\\')
+	  {
+	    buffer[i++] = '\\';
+	    buffer[i++] = *str;
+	  }
+	else if (*str == '\n')
+	  {
+	    buffer[i++] = '\\';
+	    buffer[i++] = 'n';
+	  }
+	else if ((unsigned char) *str < 0x20)
+	    i += snprintf(buffer + i, 7, "\\u%04x", (unsigned char) *str);
+	else
+	    buffer[i++] = *str;
+	str += 1;
+      }
+    buffer[i] = '\0';
+    return buffer;
+}
+
+/*
+** ctl_end
+**	Send any pending reply, then close and remove the control socket.
+*/
+void
+ctl_end(void)
+{
+    time_t start;
+    int i, pending;
+
+    if (lfd == -1)
+	return;
+
+    if (current != NULL)
+      {
+	finish(current);
+	current = NULL;
+      }
+
+    /* Give clients a (short) chance to get their replies. */
+    start = time(NULL);
+    do
+      {
+	struct pollfd pfd[CTL_CLIENTS];
+
+	pending = 0;
+	for (i = 0; i < CTL_CLIENTS; i++)
+	  {
+	    pfd[i].fd = -1;
+	    pfd[i].events = POLLOUT;
+	    if (clients[i].state == CTL_WRITE)
+	      {
+		pfd[i].fd = clients[i].fd;
+		pending += 1;
+	      }
+	  }
+	if (pending == 0 || poll(pfd, CTL_CLIENTS, 250) <= 0)
+	    continue;
+	for (i = 0; i < CTL_CLIENTS; i++)
+	    if (pfd[i].fd != -1 && pfd[i].revents != 0)
+		flush(&(clients[i]));
+      }
+    while (pending > 0 && time(NULL) - start < 2);
+
+    for (i = 0; i < CTL_CLIENTS; i++)
+	if (clients[i].state != CTL_FREE)
+	    drop(&(clients[i]));
+    close(lfd);
+    lfd = -1;
+    if (unlink(path) == -1)
+	eprint("unlink(%s): %s", path, strerror(errno));
+}
+
+/*
+** drop
+**	Close a client connection.
+*/
+static void
+drop(cl)
+struct client *cl;
+{
+    dprint("Control client %d closed", cl->fd);
+    close(cl->fd);
+    cl->fd = -1;
+    cl->state = CTL_FREE;
+    if (cl->out != NULL)
+	free(cl->out);
+    cl->out = NULL;
+    cl->outsz = cl->outlen = cl->outpos = 0;
+    if (current == cl)
+	current = NULL;
+}
+
+/*
+** request
+**	Check whether a client's request is complete, and if so extract the
+**	command from it.  Requests are either a single line, or an HTTP
+**	request where the path is the command (with '/' instead of spaces).
+*/
+static char *
+request(cl, eof)
+struct client *cl;
+int eof;
+{
+    char *cmd, *src, *dst;
+
+    cl->http = (strncmp(cl->in, "GET /", 5) == 0
+		|| strncmp(cl->in, "POST /", 6) == 0);
+    if (eof == 0 && cl->inlen < CTL_INMAX - 1)
+      {
+	/* Wait for the complete line, or for the end of HTTP headers */
+	if (cl->http == 0 && strchr(cl->in, '\n') == NULL)
+	    return NULL;
+	if (cl->http == 1 && strstr(cl->in, "\n\r\n") == NULL
+	    && strstr(cl->in, "\n\n") == NULL)
+	    return NULL;
+      }
+
+    cmd = cl->in;
+    if (cl->http == 1)
+      {
+	cmd = strchr(cl->in, '/') + 1;
+	cmd[strcspn(cmd, " ?\r\n")] = '\0';
+	/* Decode path: '/' separates words, and %XX escapes */
+	src = dst = cmd;
+	while (*src != '\0')
+	  {
+	    if (*src == '/')
+		*dst++ = ' ';
+	    else if (*src == '%' && isxdigit((int) src[1])
+		     && isxdigit((int) src[2]))
+	      {
+		char hex[3];
+
+		hex[0] = src[1]; hex[1] = src[2]; hex[2] = '\0';
+		*dst++ = (char) strtol(hex, NULL, 16);
+		src += 2;
+	      }
+	    else
+		*dst++ = *src;
+	    src += 1;
+	  }
+	*dst = '\0';
+      }
+    else
+	cmd[strcspn(cmd, "\r\n")] = '\0';
+
+    while (*cmd == ' ' || *cmd == '\t')
+	cmd += 1;
+    dst = cmd + strlen(cmd);
+    while (dst > cmd && (*(dst-1) == ' ' || *(dst-1) == '\t'))
+	*--dst = '\0';
+    if (*cmd == '\0')
+	cmd = "help";
+
+    if (strcmp(cmd, "metrics") == 0)
+	cl->type = "text/plain; version=0.0.4";
+    else if (strcmp(cmd, "json") == 0)
+	cl->type = "application/json";
+    else
+	cl->type = "text/plain";
+
+    return cmd;
+}
+
+/*
+** finish
+**	A request has been processed, send the reply.
+*/
+static void
+finish(cl)
+struct client *cl;
+{
+    if (cl->http == 1)
+      {
+	char header[256], *out;
+	int sz;
+
+	sz = snprintf(header, sizeof(header),
+		      "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+		      "Content-Length: %lu\r\nConnection: close\r\n\r\n",
+		      (cl->failed == 0) ? "200 OK" : "400 Bad Request",
+		      cl->type, (u_long) cl->outlen);
+	out = (char *) malloc(sz + cl->outlen + 1);
+	if (out == NULL)
+	  {
+	    perror("malloc failed");
+	    exit(RC_FATAL);
+	  }
+	memcpy(out, header, sz);
+	if (cl->outlen > 0)
+	    memcpy(out + sz, cl->out, cl->outlen);
+	if (cl->out != NULL)
+	    free(cl->out);
+	cl->out = out;
+	cl->outlen += sz;
+	cl->outsz = cl->outlen + 1;
+      }
+
+    cl->state = CTL_WRITE;
+    cl->when = time(NULL);
+    flush(cl);
+}
+
+/*
+** flush
+**	Send (what we can of) a reply, and close the connection when done.
+*/
+static void
+flush(cl)
+struct client *cl;
+{
+    while (cl->outpos < cl->outlen)
+      {
+	ssize_t sz;
+
+	sz = send(cl->fd, cl->out + cl->outpos, cl->outlen - cl->outpos,
+		  CTL_SENDFLAGS);
+	if (sz == -1)
+	  {
+	    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return;
+	    dprint("Control client %d: send(): %s", cl->fd, strerror(errno));
+	    break;
+	  }
+	cl->outpos += sz;
+      }
+    drop(cl);
+}
@@ -0,0 +1,28 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_CTL_H_)
+# define _CTL_H_
+
+struct pollfd;
+
+void  ctl_init(char *);
+int   ctl_nfds(void);
+void  ctl_poll(struct pollfd *);
+char *ctl_input(struct pollfd *);
+void  ctl_reply(char *, ...)
+# if ( __GNUC__ == 2 && __GNUC_MINOR__ >= 5 ) || __GNUC__ >= 3
+        __attribute__((__format__(__printf__, 1, 2)))
+# endif
+	;
+void  ctl_fail(void);
+char *ctl_quote(char *);
+void  ctl_end(void);
+
+#endif
@@ -137,6 +137,7 @@ char *target, **argv;
 	sigaction(SIGTSTP, &sa, NULL);
 	sigaction(SIGCONT, &sa, NULL);
 	sigaction(SIGWINCH, &sa, NULL);
+	sigaction(SIGPIPE, &sa, NULL);	/* ignored by loop() */
 
         /* Start a new process group to allow mass-signaling by the parent */
         if (setpgid(0, 0) < 0)
@@ -0,0 +1,297 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(HAVE_ZLIB_H)
+# include <zlib.h>
+#endif
+
+#include "gather.h"
+#include "term.h"
+#include "units.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Gather mode (-g <dir>): the standard output of each command is saved,
+** as is, to <dir>/<target>, rather than being split in lines and shown.
+** Only the number of bytes read matters, so any output is fine, binary
+** or not.  With -z, the output is compressed (gzip or zlib format) and
+** inflated on the fly.
+*/
+static char *dir;		/* NULL: disabled */
+static int inflating;		/* -z */
+static u_long files, bytes;	/* for gather_report() */
+
+struct gather
+{
+    char	*name;		/* file name */
+    int		fd;		/* -1 after a failure */
+    u_long	in, out;	/* bytes read, written */
+#if defined(HAVE_ZLIB_H)
+    z_stream	zs;
+    int		zend;		/* end of the compressed stream seen? */
+#endif
+};
+
+static void save(struct gather *, char *, size_t);
+static void failed(struct gather *, char *, char *);
+
+/*
+** gather_init
+**	Enable gather mode, saving outputs under the given directory,
+**	optionally inflating them.
+*/
+void
+gather_init(path, z)
+char *path;
+int z;
+{
+#if !defined(HAVE_ZLIB_H)
+    if (z != 0)
+      {
+	fprintf(stderr, "%s: -z isn't supported (zlib missing)!\n", myname);
+	exit(RC_ERROR);
+      }
+#endif
+
+    if (mkdir(path, 0777) == -1 && errno != EEXIST)
+      {
+	fprintf(stderr, "%s: mkdir(%s): %s\n", myname, path, strerror(errno));
+	exit(RC_ERROR);
+      }
+    dir = path;
+    inflating = z;
+}
+
+/*
+** gather_enabled
+**	Is the output of commands gathered?
+*/
+int
+gather_enabled(void)
+{
+    return (dir != NULL) ? 1 : 0;
+}
+
+/*
+** gather_open
+**	Create (or truncate) the file for a target.  Returns NULL on error.
+*/
+void *
+gather_open(target)
+char *target;
+{
+    struct gather *g;
+    size_t sz;
+
+    assert( dir != NULL );
+
+    g = (struct gather *) malloc(sizeof(struct gather));
+    if (g == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    sz = strlen(dir) + strlen(target) + 2;
+    g->name = (char *) malloc(sz);
+    if (g->name == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    snprintf(g->name, sz, "%s/%s", dir, target);
+    g->in = g->out = 0;
+
+    g->fd = open(g->name, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (g->fd == -1)
+      {
+	eprint("open(%s): %s", g->name, strerror(errno));
+	free(g->name);
+	free(g);
+	return NULL;
+      }
+
+#if defined(HAVE_ZLIB_H)
+    g->zend = 0;
+    if (inflating != 0)
+      {
+	memset((void *) &(g->zs), 0, sizeof(g->zs));
+	/* 32: gzip or zlib header, automatically detected */
+	if (inflateInit2(&(g->zs), 15 + 32) != Z_OK)
+	  {
+	    eprint("inflateInit2() failed for %s", target);
+	    close(g->fd);
+	    free(g->name);
+	    free(g);
+	    return NULL;
+	  }
+      }
+#endif
+
+    return (void *) g;
+}
+
+/*
+** failed
+**	Give up on a file, the rest of the output is discarded.
+*/
+static void
+failed(g, what, why)
+struct gather *g;
+char *what, *why;
+{
+    eprint("%s(%s): %s", what, g->name, why);
+    close(g->fd);
+    g->fd = -1;
+}
+
+/*
+** save
+**	Write (inflated) output to a file.
+*/
+static void
+save(g, buf, len)
+struct gather *g;
+char *buf;
+size_t len;
+{
+    ssize_t sz;
+
+    while (len > 0 && g->fd != -1)
+      {
+	sz = write(g->fd, buf, len);
+	if (sz == -1)
+	  {
+	    if (errno != EINTR)
+		failed(g, "write", strerror(errno));
+	    continue;
+	  }
+	g->out += sz;
+	buf += sz;
+	len -= sz;
+      }
+}
+
+/*
+** gather_write
+**	Save output read from a command.
+*/
+void
+gather_write(handle, buf, len)
+void *handle;
+char *buf;
+size_t len;
+{
+    struct gather *g;
+
+    g = (struct gather *) handle;
+    g->in += len;
+    if (g->fd == -1)
+	return;
+    if (inflating == 0)
+      {
+	save(g, buf, len);
+	return;
+      }
+
+#if defined(HAVE_ZLIB_H)
+      {
+	char out[16384];
+	int rc;
+
+	g->zs.next_in = (Bytef *) buf;
+	g->zs.avail_in = len;
+	do
+	  {
+	    if (g->zend != 0 && g->zs.avail_in > 0)
+	      {
+		/* Concatenated streams, as gzip(1) allows */
+		inflateReset(&(g->zs));
+		g->zend = 0;
+	      }
+	    g->zs.next_out = (Bytef *) out;
+	    g->zs.avail_out = sizeof(out);
+	    rc = inflate(&(g->zs), Z_NO_FLUSH);
+	    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+	      {
+		failed(g, "inflate", (g->zs.msg != NULL) ? g->zs.msg
+		       : "invalid compressed data");
+		return;
+	      }
+	    save(g, out, sizeof(out) - g->zs.avail_out);
+	    if (rc == Z_STREAM_END)
+		g->zend = 1;
+	  }
+	while ((g->zs.avail_in > 0 || (g->zs.avail_out == 0 && g->zend == 0))
+	       && g->fd != -1);
+      }
+#endif
+}
+
+/*
+** gather_close
+**	Close a file once the command closed its standard output.  Returns
+**	-1 if the file is incomplete.
+*/
+int
+gather_close(handle)
+void *handle;
+{
+    struct gather *g;
+    int rc;
+
+    g = (struct gather *) handle;
+#if defined(HAVE_ZLIB_H)
+    if (inflating != 0)
+      {
+	if (g->fd != -1 && g->zend == 0)
+	    failed(g, "inflate", "truncated compressed data");
+	inflateEnd(&(g->zs));
+      }
+#endif
+
+    rc = -1;
+    if (g->fd != -1)
+      {
+	if (close(g->fd) == -1)
+	    eprint("close(%s): %s", g->name, strerror(errno));
+	else
+	  {
+	    rc = 0;
+	    files += 1;
+	    bytes += g->out;
+	    if (inflating != 0)
+		dprint("%s: %lu bytes (%lu compressed)", g->name, g->out,
+		       g->in);
+	    else
+		dprint("%s: %lu bytes", g->name, g->out);
+	  }
+      }
+    free(g->name);
+    free(g);
+    return rc;
+}
+
+/*
+** gather_report
+**	Show how much was gathered, for the final summary.
+*/
+void
+gather_report(void)
+{
+    if (dir == NULL)
+	return;
+
+    nprint("Gathered : %s in %lu file%s under %s", unit_rsize(bytes),
+	   files, (files != 1) ? "s" : "", dir);
+}
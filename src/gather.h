@@ -0,0 +1,20 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_GATHER_H_)
+# define _GATHER_H_
+
+void  gather_init(char *, int);
+int   gather_enabled(void);
+void *gather_open(char *);
+void  gather_write(void *, char *, size_t);
+int   gather_close(void *);
+void  gather_report(void);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include "history.h"
+#include "target.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Runtime history (-H): how long the command took on each target is
+** remembered from one run to the next, keyed by target name and a hash
+** of the command.  This is used to dispatch the (expected) longest jobs
+** first, which shortens the tail of a run, and to estimate the time left.
+**
+** The file has one line per target and command:
+**	<hash> <runs> <seconds> <target>
+** where <seconds> is a moving average over the runs.
+*/
+#define HIST_ALPHA	0.3	/* Weight of the latest runtime */
+
+struct entry
+{
+    char	*name;		/* target name */
+    u_int	hash;		/* command hash */
+    u_int	runs;		/* number of runs */
+    double	seconds;	/* average runtime */
+};
+
+static char *file = NULL;
+static double weight = 1.0;
+static u_int cmdhash;
+static struct entry *entries;
+static int nentries, sentries;
+static int *bytarget;		/* entry for each target, -1: none */
+static double *expected;	/* expected runtime for each target */
+static char *started;		/* target was accounted for? */
+static double pending;		/* expected runtime of targets not started */
+static int known;
+static double *keys;		/* dispatch order keys, see by_key() */
+
+static int  add_entry(char *, u_int, u_int, double);
+static int  by_entry(const void *, const void *);
+static int  by_key(const void *, const void *);
+
+/*
+** history_init
+**	Set the history file.
+*/
+void
+history_init(path)
+char *path;
+{
+    file = path;
+}
+
+/*
+** history_weight
+**	Parse the -W argument: 0 to dispatch in the order given, up to 1 to
+**	dispatch the longest jobs first.
+*/
+void
+history_weight(arg)
+char *arg;
+{
+    char *end;
+
+    weight = strtod(arg, &end);
+    if (end == arg || *end != '\0' || weight < 0 || weight > 1)
+      {
+	fprintf(stderr, "%s: Invalid weight: %s (Must be between 0 and 1)\n",
+		myname, arg);
+	exit(RC_ERROR);
+      }
+}
+
+/*
+** history_enabled
+**	Was a history file given?
+*/
+int
+history_enabled(void)
+{
+    return (file != NULL);
+}
+
+/*
+** history_hash
+**	FNV-1a hash of the command.
+*/
+u_int
+history_hash(str)
+char *str;
+{
+    u_int h;
+
+    h = 2166136261U;
+    while (*str != '\0')
+      {
+	h ^= (u_char) *str++;
+	h *= 16777619U;
+      }
+    return h & 0xffffffffU;
+}
+
+/*
+** add_entry
+**	Add an entry to the history, returns its index.
+*/
+static int
+add_entry(name, h, runs, seconds)
+char *name;
+u_int h, runs;
+double seconds;
+{
+    if (nentries == sentries)
+      {
+	sentries = (sentries == 0) ? 64 : sentries * 2;
+	entries = (struct entry *) realloc(entries,
+					   sentries * sizeof(struct entry));
+	if (entries == NULL)
+	  {
+	    perror("realloc failed");
+	    exit(RC_ERROR);
+	  }
+      }
+    entries[nentries].name = strdup(name);
+    if (entries[nentries].name == NULL)
+      {
+	perror("strdup failed");
+	exit(RC_ERROR);
+      }
+    entries[nentries].hash = h;
+    entries[nentries].runs = runs;
+    entries[nentries].seconds = seconds;
+    return nentries++;
+}
+
+/*
+** by_entry
+**	qsort()/bsearch() helper: entries by command hash, then target name.
+*/
+static int
+by_entry(a, b)
+const void *a, *b;
+{
+    const struct entry *ea = a, *eb = b;
+
+    if (ea->hash != eb->hash)
+	return (ea->hash < eb->hash) ? -1 : 1;
+    return strcmp(ea->name, eb->name);
+}
+
+/*
+** by_key
+**	qsort() helper: highest key first, then in the order given.
+*/
+static int
+by_key(a, b)
+const void *a, *b;
+{
+    int ia = *((const int *) a), ib = *((const int *) b);
+
+    if (keys[ia] > keys[ib])
+	return -1;
+    if (keys[ia] < keys[ib])
+	return 1;
+    return ia - ib;
+}
+
+/*
+** history_load
+**	Read the history file, and set the dispatch order for the targets.
+*/
+void
+history_load(cmd)
+char *cmd;
+{
+    FILE *f;
+    char line[1024];
+    u_int h, runs;
+    double seconds, longest, average;
+    int i, count, *order;
+
+    if (file == NULL)
+	return;
+
+    f = fopen(file, "r");
+    if (f == NULL && errno != ENOENT)
+      {
+	fprintf(stderr, "%s: Unable to read %s: %s\n",
+		myname, file, strerror(errno));
+	exit(RC_ERROR);
+      }
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+      {
+	int pos;
+	char *nl;
+
+	if (line[0] == '#')
+	    continue;
+	nl = strchr(line, '\n');
+	if (nl != NULL)
+	    *nl = '\0';
+	if (sscanf(line, "%x %u %lf %n", &h, &runs, &seconds, &pos) != 3
+	    || line[pos] == '\0' || seconds < 0)
+	  {
+	    eprint("Ignoring invalid history line: %s", line);
+	    continue;
+	  }
+	add_entry(line + pos, h, runs, seconds);
+      }
+    if (f != NULL)
+	fclose(f);
+    if (nentries > 0)
+	qsort(entries, nentries, sizeof(struct entry), by_entry);
+
+    count = target_getmax();
+    bytarget = (int *) malloc(count * sizeof(int));
+    expected = (double *) malloc(count * sizeof(double));
+    keys = (double *) malloc(count * sizeof(double));
+    order = (int *) malloc(count * sizeof(int));
+    started = (char *) malloc(count);
+    if (bytarget == NULL || expected == NULL || keys == NULL
+	|| order == NULL || started == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+
+    /* Find what we know about the targets */
+    cmdhash = history_hash(cmd);
+    known = 0;
+    longest = average = 0;
+    for (i = 0; i < count; i++)
+      {
+	struct entry key, *e;
+
+	bytarget[i] = -1;
+	started[i] = 0;
+	target_setbynum(i);
+	key.hash = cmdhash;
+	key.name = target_getname();
+	e = (nentries > 0) ? bsearch(&key, entries, nentries,
+				     sizeof(struct entry), by_entry) : NULL;
+	if (e != NULL)
+	  {
+	    bytarget[i] = e - entries;
+	    expected[i] = e->seconds;
+	    average += expected[i];
+	    if (expected[i] > longest)
+		longest = expected[i];
+	    known += 1;
+	  }
+      }
+    if (known > 0)
+	average /= known;
+    dprint("History has %d of %d targets (average %.1f seconds)",
+	   known, count, average);
+
+    /*
+    ** Unknown targets are expected to take an average time, and the
+    ** dispatch order is a weighted mix of the expected runtime (longest
+    ** first) and the order given.
+    */
+    pending = 0;
+    for (i = 0; i < count; i++)
+      {
+	if (bytarget[i] == -1)
+	    expected[i] = average;
+	pending += expected[i];
+	keys[i] = (1 - weight) * (1 - (double) i / count);
+	if (longest > 0)
+	    keys[i] += weight * expected[i] / longest;
+	order[i] = i;
+      }
+    if (known > 0)
+      {
+	qsort(order, count, sizeof(int), by_key);
+	target_order(order);
+      }
+    free(order);
+}
+
+/*
+** history_expected
+**	Expected runtime for a target, or -1 if unknown.
+*/
+double
+history_expected(num)
+int num;
+{
+    if (file == NULL || known == 0)
+	return -1;
+    return expected[num];
+}
+
+/*
+** history_pending
+**	Expected runtime of all targets which haven't started, or -1 if
+**	unknown.
+*/
+double
+history_pending(void)
+{
+    if (file == NULL || known == 0)
+	return -1;
+    return (pending > 0) ? pending : 0;
+}
+
+/*
+** history_start
+**	The command was started on a target (or never will be).
+*/
+void
+history_start(num)
+int num;
+{
+    if (file == NULL || started[num] != 0)
+	return;
+    started[num] = 1;
+    pending -= expected[num];
+}
+
+/*
+** history_update
+**	Record how long the command took on a target.
+*/
+void
+history_update(num, seconds)
+int num;
+double seconds;
+{
+    struct entry *e;
+
+    if (file == NULL)
+	return;
+
+    if (bytarget[num] == -1)
+      {
+	target_setbynum(num);
+	bytarget[num] = add_entry(target_getname(), cmdhash, 0, seconds);
+      }
+    e = &(entries[bytarget[num]]);
+    if (e->runs == 0)
+	e->seconds = seconds;
+    else
+	e->seconds = HIST_ALPHA * seconds + (1 - HIST_ALPHA) * e->seconds;
+    e->runs += 1;
+}
+
+/*
+** history_end
+**	Save the history file.
+*/
+void
+history_end(void)
+{
+    FILE *f;
+    char *tmp;
+    int i, len;
+
+    if (file == NULL || bytarget == NULL)
+	return;
+
+    len = strlen(file) + 5;
+    tmp = (char *) malloc(len);
+    if (tmp == NULL)
+      {
+	perror("malloc failed");
+	return;
+      }
+    snprintf(tmp, len, "%s.new", file);
+    f = fopen(tmp, "w");
+    if (f == NULL)
+      {
+	eprint("Unable to save history to %s: %s", tmp, strerror(errno));
+	free(tmp);
+	return;
+      }
+    fprintf(f, "# shmux runtime history: <hash> <runs> <seconds> <target>\n");
+    for (i = 0; i < nentries; i++)
+	if (entries[i].runs > 0)
+	    fprintf(f, "%08x %u %.3f %s\n", entries[i].hash, entries[i].runs,
+		    entries[i].seconds, entries[i].name);
+    if (fclose(f) != 0 || rename(tmp, file) != 0)
+      {
+	eprint("Unable to save history to %s: %s", file, strerror(errno));
+	unlink(tmp);
+      }
+    free(tmp);
+}
@@ -0,0 +1,24 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_HISTORY_H_)
+# define _HISTORY_H_
+
+void   history_init(char *);
+void   history_weight(char *);
+int    history_enabled(void);
+u_int  history_hash(char *);
+void   history_load(char *);
+double history_expected(int);
+double history_pending(void);
+void   history_start(int);
+void   history_update(int, double);
+void   history_end(void);
+
+#endif
@@ -0,0 +1,343 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <time.h>
+
+#include "history.h"
+#include "journal.h"
+#include "target.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Results journal (-j): one line is appended to <odir>/journal whenever
+** the command is started on a target, and whenever a target reaches its
+** final state:
+**	C <time> <hash>			(run started, with the command hash)
+**	S <time> <target>		(command started)
+**	R <time> <phase> <result> <target>
+** Records are synced to disk in batches (group commit), so an interrupted
+** run may lose the last few records, in which case the targets are simply
+** run again.  When resuming (-J), targets with a final result are skipped,
+** and the others (including the ones which were in flight) are processed.
+*/
+#define JOURNAL_FILE	"journal"
+#define JOURNAL_BATCH	64	/* Records between syncs */
+#define JOURNAL_DELAY	1	/* Seconds between syncs */
+
+struct jtarget
+{
+    char	*name;		/* target name */
+    int		num;		/* target number */
+};
+
+static FILE *journal = NULL;
+static u_int unsynced;		/* records not yet synced */
+static time_t synced;		/* last sync */
+static char *rphase, *rresult;	/* results from the journal, phase 0: none */
+static char *inflight;		/* started, but no result in the journal */
+
+static int  by_name(const void *, const void *);
+static void journal_read(char *, u_int);
+static void journal_rename(char *, char *);
+
+/*
+** by_name
+**	qsort()/bsearch() helper: targets by name.
+*/
+static int
+by_name(a, b)
+const void *a, *b;
+{
+    return strcmp(((const struct jtarget *) a)->name,
+		  ((const struct jtarget *) b)->name);
+}
+
+/*
+** journal_read
+**	Read the journal left by previous runs.
+*/
+static void
+journal_read(path, cmdhash)
+char *path;
+u_int cmdhash;
+{
+    FILE *f;
+    struct jtarget *index, key, *t;
+    char line[1024];
+    int i, count, nl;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+      {
+	fprintf(stderr, "%s: Unable to resume from %s: %s\n",
+		myname, path, strerror(errno));
+	exit(RC_ERROR);
+      }
+
+    count = target_getmax();
+    index = (struct jtarget *) malloc(count * sizeof(struct jtarget));
+    rphase = (char *) malloc(count);
+    rresult = (char *) malloc(count);
+    inflight = (char *) malloc(count);
+    if (index == NULL || rphase == NULL || rresult == NULL || inflight == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    for (i = 0; i < count; i++)
+      {
+	target_setbynum(i);
+	index[i].name = target_getname();
+	index[i].num = i;
+	rphase[i] = inflight[i] = 0;
+      }
+    qsort(index, count, sizeof(struct jtarget), by_name);
+
+    nl = 1;
+    while (fgets(line, sizeof(line), f) != NULL)
+      {
+	char *cp;
+	long when;
+	int pos, phase, result;
+	u_int h;
+
+	cp = strchr(line, '\n');
+	nl = (cp != NULL);
+	if (cp == NULL)
+	    /* Interrupted while writing the record */
+	    continue;
+	*cp = '\0';
+
+	pos = 0;
+	if (sscanf(line, "C %ld %x", &when, &h) == 2)
+	  {
+	    if (h != cmdhash)
+	      {
+		fprintf(stderr, "%s: %s was written for a different command!\n",
+			myname, path);
+		exit(RC_ERROR);
+	      }
+	    continue;
+	  }
+	if (sscanf(line, "S %ld %n", &when, &pos) == 1 && line[pos] != '\0')
+	  {
+	    phase = 0;
+	    result = 0;
+	  }
+	else if (sscanf(line, "R %ld %d %d %n", &when, &phase, &result,
+			&pos) == 3 && line[pos] != '\0'
+		 && phase > 0 && phase <= 4 && result >= -3 && result <= 2)
+	    ;
+	else
+	  {
+	    fprintf(stderr, "%s: Ignoring invalid journal line: %s\n",
+		    myname, line);
+	    continue;
+	  }
+
+	key.name = line + pos;
+	t = bsearch(&key, index, count, sizeof(struct jtarget), by_name);
+	if (t == NULL)
+	    /* Target not given this time */
+	    continue;
+	if (phase == 0)
+	    inflight[t->num] = 1;
+	else
+	  {
+	    rphase[t->num] = phase;
+	    rresult[t->num] = result;
+	    inflight[t->num] = 0;
+	  }
+      }
+    fclose(f);
+    free(index);
+
+    /* Make sure new records don't end up on a partial line */
+    if (nl == 0)
+      {
+	f = fopen(path, "a");
+	if (f != NULL)
+	  {
+	    fputc('\n', f);
+	    fclose(f);
+	  }
+      }
+}
+
+/*
+** journal_rename
+**	Move the output of an interrupted attempt out of the way.
+*/
+static void
+journal_rename(odir, name)
+char *odir, *name;
+{
+    static char *extensions[] = { "stdout", "stderr", "exit",
+				  "analyzer.stdout", "analyzer.stderr", NULL };
+    char from[PATH_MAX], to[PATH_MAX];
+    int i;
+
+    for (i = 0; extensions[i] != NULL; i++)
+      {
+	snprintf(from, sizeof(from), "%s/%s.%s", odir, name, extensions[i]);
+	if (snprintf(to, sizeof(to), "%s.interrupted", from) >= sizeof(to))
+	    continue;
+	if (rename(from, to) == -1 && errno != ENOENT)
+	    fprintf(stderr, "%s: rename(%s): %s\n",
+		    myname, from, strerror(errno));
+      }
+}
+
+/*
+** journal_init
+**	Open the journal in the output directory, after reading it first
+**	when resuming.
+*/
+void
+journal_init(odir, cmd, resume)
+char *odir, *cmd;
+int resume;
+{
+    char path[PATH_MAX];
+    u_int cmdhash;
+    int i;
+
+    if (snprintf(path, sizeof(path), "%s/%s", odir, JOURNAL_FILE)
+	>= sizeof(path))
+      {
+	fprintf(stderr, "%s: \"%s\": name is too long\n", myname, odir);
+	exit(RC_ERROR);
+      }
+
+    cmdhash = history_hash(cmd);
+    if (resume != 0)
+      {
+	journal_read(path, cmdhash);
+	/*
+	** The last records may have been lost, so any target which doesn't
+	** have a final result may have left some output behind.
+	*/
+	for (i = 0; i < target_getmax(); i++)
+	    if (rphase[i] == 0)
+	      {
+		target_setbynum(i);
+		journal_rename(odir, target_getname());
+	      }
+      }
+
+    journal = fopen(path, (resume != 0) ? "a" : "w");
+    if (journal == NULL)
+      {
+	fprintf(stderr, "%s: Unable to open %s: %s\n",
+		myname, path, strerror(errno));
+	exit(RC_ERROR);
+      }
+    fprintf(journal, "C %ld %08x\n", (long) time(NULL), cmdhash);
+    unsynced = 1;
+    synced = 0;
+}
+
+/*
+** journal_restore
+**	Set the results of targets found in the journal.
+*/
+void
+journal_restore(void)
+{
+    int i, done, requeued;
+
+    if (rphase == NULL)
+	return;
+
+    done = requeued = 0;
+    for (i = 0; i < target_getmax(); i++)
+      {
+	if (rphase[i] != 0)
+	  {
+	    target_setbynum(i);
+	    target_restore(rphase[i], rresult[i]);
+	    done += 1;
+	  }
+	else if (inflight[i] != 0)
+	    requeued += 1;
+      }
+    iprint("Resuming: %d target%s already done, %d were in flight",
+	   done, (done != 1) ? "s" : "", requeued);
+}
+
+/*
+** journal_start
+**	Record that the command was started on the current target.
+*/
+void
+journal_start(void)
+{
+    if (journal == NULL)
+	return;
+    fprintf(journal, "S %ld %s\n", (long) time(NULL), target_getname());
+    unsynced += 1;
+    journal_sync(0);
+}
+
+/*
+** journal_result
+**	Record the final state of the current target.
+*/
+void
+journal_result(phase, result)
+int phase, result;
+{
+    if (journal == NULL)
+	return;
+    fprintf(journal, "R %ld %d %d %s\n", (long) time(NULL), phase, result,
+	    target_getname());
+    unsynced += 1;
+    journal_sync(0);
+}
+
+/*
+** journal_sync
+**	Sync the journal to disk, if there are enough pending records or
+**	enough time has passed (or if forced).
+*/
+void
+journal_sync(force)
+int force;
+{
+    time_t now;
+
+    if (journal == NULL || unsynced == 0)
+	return;
+    now = time(NULL);
+    if (force == 0 && unsynced < JOURNAL_BATCH && now - synced < JOURNAL_DELAY)
+	return;
+
+    if (fflush(journal) != 0 || fsync(fileno(journal)) == -1)
+	eprint("Unable to write journal: %s", strerror(errno));
+    unsynced = 0;
+    synced = now;
+}
+
+/*
+** journal_end
+**	Sync and close the journal.
+*/
+void
+journal_end(void)
+{
+    if (journal == NULL)
+	return;
+    journal_sync(1);
+    fclose(journal);
+    journal = NULL;
+}
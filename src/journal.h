@@ -0,0 +1,20 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_JOURNAL_H_)
+# define _JOURNAL_H_
+
+void journal_init(char *, char *, int);
+void journal_restore(void);
+void journal_start(void);
+void journal_result(int, int);
+void journal_sync(int);
+void journal_end(void);
+
+#endif
@@ -11,6 +11,8 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>		/* FreeBSD wants this for the next one.. */
 #include <sys/resource.h>
@@ -21,14 +23,24 @@
 # define WCOREDUMP(x) 0
 #endif
 
+#include "adapt.h"
 #include "analyzer.h"
+#include "apool.h"
+#include "budget.h"
 #include "byteset.h"
+#include "coproc.h"
+#include "ctl.h"
 #include "exec.h"
+#include "gather.h"
+#include "history.h"
+#include "journal.h"
 #include "loop.h"
+#include "memo.h"
 #include "siglist.h"
 #include "status.h"
 #include "target.h"
 #include "term.h"
+#include "units.h"
 
 static char const rcsid[] = "@(#)$Id$";
 
@@ -44,13 +56,37 @@ struct child
     int		execstate;	/* exec() status: 0=ok, 1=failed? 2=failed */
     time_t	timeout;	/* timeout expiration time */
     int		timedout;	/* 0=no, 1=SIGTERM sent, 2=SIGKILL sent */
+    time_t	idle;		/* inactivity expiration time */
+    int		killed;		/* why shmux killed it, see KILL_* */
+    u_long	oread, eread;	/* stdout/stderr bytes kept, see output_cap() */
+    u_long	odropped, edropped; /* stdout/stderr bytes discarded */
+    char	*otail, *etail;	/* last stdout/stderr bytes discarded */
+    void	*analysis;	/* output analysis in progress, see analyzer.c */
     char	*obuf, *ebuf;	/* stdout/stderr truncated buffer */
     char	*ofname, *efname; /* stdout/stderr file names */
     int		ofile, efile;	/* stdout/stderr file fd */
     int		status;		/* waitpid(status) */
     time_t	orphan;		/* orphan debug message rate limit */
+    struct timeval start;	/* spawn time */
+    u_int	seq;		/* spawn sequence number, see adapt.c */
+    int		gotdata;	/* output received? */
+    size_t	ioff;		/* input bytes written, see input_write() */
+    void	*gather;	/* raw stdout destination (-g), see gather.c */
+    int		iwait;		/* may still request its input? */
 };
 
+/* A child's whole output verdict, handed back by the analysis threads */
+struct handback
+{
+    struct child kid;
+    int		bad;		/* verdict, unless there's an analysis */
+    char	msg[256];
+};
+
+#define KILL_IDLE   1	/* no output for too long (-I) */
+#define KILL_OUTPUT 2	/* too much output (-O/-G with -k) */
+#define KILL_ERROR  3	/* error found in the output (-K) */
+
 static int got_sigint;
 #define SPAWN_FATAL 0
 #define SPAWN_ABORT 1
@@ -60,18 +96,100 @@ static int got_sigint;
 #define SPAWN_NONE  5
 #define SPAWN_ONE   6
 #define SPAWN_MORE  7
+#define SPAWN_WAVE  8
 static int spawn_mode;
 static int failure_mode = SPAWN_MORE; /* Historical default */
+static int resume_mode;		/* spawn mode to restore after a pause */
+static int maxactive;		/* maximum number of running children */
+
+/*
+** Concurrency pools (-M <max>,<tests>,<analyzers>): by default, all
+** children share the same maximum, otherwise tests and analyzers have
+** their own so that they neither starve nor get starved by commands.
+*/
+#define POOL_TEST	0
+#define POOL_CMD	1
+#define POOL_ANALYZER	2
+static int pool_max[3];		/* POOL_CMD is maxactive, 0: shared pool
+				** -1: same as maxactive (until loop()) */
+static int running[3];		/* children running in each pool */
+
+/* Wave strategy, see wave_spawn() */
+static u_int wave_num;		/* current wave number */
+static u_int wave_size;		/* targets in the current wave */
+static u_int wave_started, wave_done, wave_failed;
+static u_int wave_budget;	/* failures allowed in a wave */
+static int wave_pct;		/* wave_budget is a percentage? */
+
+static int budget_hit;		/* error budget exceeded? */
+
+/* Retries of transport failures, see retry() */
+#define RETRY_MAXDELAY	300	/* Maximum delay between attempts */
+static int retry_max;		/* attempts allowed after the first one */
+static u_int retry_delay = 1;	/* delay before the first retry */
+
+static u_int idle_timeout;	/* command inactivity timeout, 0: none */
+
+/*
+** Whole output analysis (see analyzer_map()): smaller outputs are matched
+** right away, larger ones by the analysis threads (see apool.c) so as not
+** to stall the loop, the verdict being reported once available.
+*/
+#define ANALYSIS_ASYNC	65536	/* bytes */
+#define ANALYSIS_THREADS 4	/* (one for plugins, never called
+				** concurrently) */
+
+static int error_kill;		/* signal sent when the output has an error */
+
+/*
+** Standard input for the commands (-i): read once, all of them are then
+** fed from the same buffer, each at its own pace, see input_write().
+*/
+static char *input;		/* NULL: commands get /dev/null */
+static size_t input_len;
+static char *input_request;	/* NULL: always fed, see loop_ondemand() */
+static u_long input_fed;	/* commands fed all of it */
+static double input_sent;	/* bytes written */
+static double input_slowest;	/* lowest rate a command was fed at */
+static struct timeval input_first, input_last; /* spawn, fed */
+
+/* Output caps, see output_cap() */
+static u_long cap_target;	/* bytes kept per target and stream, 0: all */
+static u_long cap_tail;		/* bytes kept from the end when capped */
+static u_long cap_global;	/* bytes kept overall, 0: all */
+static u_long cap_total;	/* bytes kept so far */
+static int cap_kill;		/* kill commands when capped? */
 
 static void shmux_sigint(int);
-static void setup_fdlimit(int, int);
+static int  setup_fdlimit(int, int);
+static int  grow(struct child **, struct pollfd **, int, int);
 static void init_child(struct child *);
+static int  child_healthy(struct child *, int);
 static void parse_child(char *, int, int, int, struct child *, int, char *);
+static void analysis_verdict(char *, struct child *, int, char *);
+static void exit_shown(char *, int);
 static void parse_fping(char *);
 static void parse_user(int, struct child *, int);
+static int  kill_target(char *, struct child *, int, void (*)(char *, ...));
+static void parse_ctl(char *, struct child *, int);
+static char *mode_name(int);
+static char *child_phase(struct child *, int);
+static void show_metrics(struct child *, int, int);
+static long estimate_eta(struct child *, int);
 static int  output_file(char **, char *, char *, char *);
 static void output_show(char *, int, char *, int);
+static int  output_cap(char *, struct child *, int, char *, int);
+static char *output_tail(struct child *, int);
+static void output_error(char *, struct child *, int);
 static void set_cmdstatus(int);
+static int  pool_full(int);
+static int  pool_slots(void);
+static int  wave_spawn(void);
+static void wave_result(int, int);
+static void final_result(int, int);
+static char *transport_failure(struct child *, int);
+static int  retry(char *, int);
+static void retry_files(struct child *, int);
 
 /*
 ** shmux_sigint
@@ -89,13 +207,15 @@ int sig;
 **	Since there's a limit on the number of open file descriptors a
 **	process may have, we do some math and try to avoid running into
 **	it which could be unpleasant depending on what we're trying to
-**	achieve when we run out.
+**	achieve when we run out.  Returns the (possibly reduced) maximum
+**	number of children.
 */
-void
+static int
 setup_fdlimit(fdfactor, max)
 int fdfactor, max;
 {
     struct rlimit fdlimit;
+    int extra;
 
     /*
     ** The assumptions are:
@@ -103,16 +223,19 @@ int fdfactor, max;
     ** + 3 for stdin, stdout and stderr for fping
     ** + 3 for pipe creation in exec.c/exec()
     ** + (3 or 5 * max) for children stdin, stdout and stderr
+    ** + the control socket and its clients
+    ** + the analyzer co-processes
     ** And we add another 10 as safety margin (2 /dev/tty, and "unknowns")
     */
+    extra = ctl_nfds() + coproc_nfds() + 10;
     if (getrlimit(RLIMIT_NOFILE, &fdlimit) == -1)
       {
 	eprint("getrlimit(RLIMIT_NOFILE): %s", strerror(errno));
 	exit(RC_ERROR);
       }
-    if (fdlimit.rlim_cur < (max + 3) * fdfactor + 10)
+    if (fdlimit.rlim_cur < (max + 3) * fdfactor + extra)
       {
-	fdlimit.rlim_cur = (max + 3) * fdfactor + 10;
+	fdlimit.rlim_cur = (max + 3) * fdfactor + extra;
 	if (fdlimit.rlim_cur > fdlimit.rlim_max)
 	    fdlimit.rlim_cur = fdlimit.rlim_max;
 
@@ -125,12 +248,12 @@ int fdfactor, max;
 	    eprint("getrlimit(RLIMIT_NOFILE): %s", strerror(errno));
 	    eprint("Unable to validate parallelism factor.");
 	  }
-	else if (fdlimit.rlim_cur < (max + 3) * fdfactor + 10)
+	else if (fdlimit.rlim_cur < (max + 3) * fdfactor + extra)
 	  {
 	    int old;
 
 	    old = max;
-	    max = ((fdlimit.rlim_cur - 10) / fdfactor) - 3;
+	    max = ((fdlimit.rlim_cur - extra) / fdfactor) - 3;
 	    eprint("Reducing parallelism factor to %d (from %d) because of system limitation.", max, old);
 	  }
       }
@@ -156,6 +279,54 @@ int fdfactor, max;
       free(fds);
     }
 #endif
+
+    return max;
+}
+
+/*
+** grow
+**	Reallocate the control structures to accomodate more children.
+*/
+static int
+grow(children, pfd, max, newmax)
+struct child **children;
+struct pollfd **pfd;
+int max, newmax;
+{
+    struct child *nc;
+    struct pollfd *np;
+    int idx, sz;
+
+    assert( newmax > max );
+
+    sz = (newmax+2)*3 + ctl_nfds() + coproc_nfds() + apool_nfds();
+    np = (struct pollfd *) realloc(*pfd, sz * sizeof(struct pollfd));
+    if (np == NULL)
+      {
+	eprint("realloc failed: %s", strerror(errno));
+	return -1;
+      }
+    *pfd = np;
+    /* The spare, control socket, co-process and thread pool entries are
+    ** reset too */
+    for (idx = (max+1)*3; idx < sz; idx++)
+      {
+	np[idx].fd = -1;
+	np[idx].events = np[idx].revents = 0;
+      }
+
+    nc = (struct child *) realloc(*children,
+				  (newmax+1) * sizeof(struct child));
+    if (nc == NULL)
+      {
+	eprint("realloc failed: %s", strerror(errno));
+	return -1;
+      }
+    memset((void *) (nc + max + 1), 0, (newmax - max) * sizeof(struct child));
+    *children = nc;
+
+    dprint("Room for %d children (was %d)", newmax, max);
+    return 0;
 }
 
 /*
@@ -173,15 +344,53 @@ struct child *kid;
     kid->execstate = 0;
     kid->timeout = 0;
     kid->timedout = 0;
+    kid->idle = 0;
+    kid->killed = 0;
+    kid->oread = kid->eread = 0;
+    kid->odropped = kid->edropped = 0;
+    kid->otail = kid->etail = NULL;
+    kid->analysis = NULL;
     kid->obuf = kid->ebuf = NULL;
     kid->ofname = kid->efname = NULL;
     kid->ofile = kid->efile = -1;
     kid->status = -1;
     kid->orphan = 0;
+    gettimeofday(&kid->start, NULL);
+    kid->seq = adapt_spawned();
+    kid->gotdata = 0;
+    kid->ioff = 0;
+    kid->gather = NULL;
+    kid->iwait = 0;
 
     status_spawned(1);
 }
 
+/*
+** child_healthy
+**	Used to tell whether a child (which just terminated) succeeded in
+**	reaching its target, for the adaptive concurrency.
+*/
+static int
+child_healthy(kid, status)
+struct child *kid;
+int status;
+{
+    if (kid->killed == KILL_ERROR)
+	/* It was reached, and its output tells it all */
+	return 1;
+    if (kid->execstate != 0 || kid->timedout > 0)
+	return 0;
+    if (kid->test == 1 && kid->passed != 1)
+	return 0;
+    if (WIFSIGNALED(status) != 0 && WTERMSIG(status) == SIGALRM)
+	return 0;
+    /* rsh/ssh use 255 to report connection failures */
+    if (WIFEXITED(status) != 0 && WEXITSTATUS(status) == 255
+	&& target_isremote() != 0)
+	return 0;
+    return 1;
+}
+
 /*
 ** parse_child
 **	Parse output from children
@@ -192,7 +401,7 @@ char *name, *buffer;
 int isfping, verbose_tests, analyzer, std;
 struct child *kid;
 {
-    char *start, *nl;
+    char *start, *nl, *eol;
 
     assert( std == 1 || std == 2 );
 
@@ -210,9 +419,10 @@ struct child *kid;
 
 	/* Got an end of line, trim \r\n  */
 	if (*(nl-1) == '\r') /* XXX */
-	    *(nl-1) = '\0';
+	    eol = nl - 1;
 	else
-	    *nl = '\0';
+	    eol = nl;
+	*eol = '\0';
 
 	left = NULL;
 	/* Check which state the child is in. */
@@ -271,34 +481,24 @@ struct child *kid;
 			{
 			  /* Line based analyzer is used, get to work */
 			  char *str;
+			  size_t len, leftlen;
 
+			  len = eol - start;
 			  if (*left == NULL)
 			      str = start;
 			  else
 			    {
-			      str = (char *) malloc(strlen(*left)
-						    + strlen(start) + 1);
-			      snprintf(str, strlen(*left) + strlen(start) + 1,
-					"%s%s", *left, start);
+			      leftlen = strlen(*left);
+			      str = (char *) malloc(leftlen + len + 1);
+			      memcpy(str, *left, leftlen);
+			      memcpy(str + leftlen, start, len + 1);
+			      len += leftlen;
 			    }
 
 			  if (analyzer_lnrun(analyzer,
 					     (std == 1) ? ANALYZE_STDOUT
-					     : ANALYZE_STDERR, str) != 0)
-			    {
-			      if ((kid->output & OUT_IFERR) != 0
-				  && (kid->output & OUT_MIXED) != 0)
-				  {
-				    assert( (kid->output & OUT_COPY) != 0 );
-				    output_show(name, kid->ofile, kid->ofname,
-						std);
-				    output_show(name, kid->efile, kid->efname,
-						std);
-				  }
-			      kid->output &= ~OUT_IFERR;
-			      kid->output |= OUT_ERR;
-			      eprint("Analysis of %s output indicates an error", name);
-			    }
+					     : ANALYZE_STDERR, str, len) != 0)
+			      output_error(name, kid, std);
 			  if (*left != NULL)
 			      free(str);
 			}
@@ -407,8 +607,7 @@ struct child *kid;
 		    *left = (char *) malloc(strlen(start) + leftlen + 1);
 		    strlcpy(*left, old, strlen(start) + leftlen + 1);
 		    free(old);
-		    strlcpy((*left) + leftlen, start,
-			sizeof((*left) + leftlen));
+		    strlcpy((*left) + leftlen, start, strlen(start) + 1);
 		  }
 	      }
 	  }
@@ -486,6 +685,7 @@ struct child *children;
 	  uprint("      1 - Spawn one command, and pause if unsuccessful");
 	  uprint("<enter> - Keep spawning commands until one fails");
 	  uprint("      + - Always spawn more commands, even if some fail");
+	  uprint("      w - Spawn commands in waves, pause if one fails");
 	  uprint("      F - Toggle failure mode to \"%s\"",
                  (failure_mode == SPAWN_PAUSE) ? "quit" : "pause");
 	  uprint("      S - Show current spawn strategy");
@@ -508,7 +708,10 @@ struct child *children;
 	  break;
       case ' ':
 	  if (spawn_mode != SPAWN_PAUSE)
+	    {
 	      uprint("Pausing...");
+	      resume_mode = spawn_mode;
+	    }
 	  spawn_mode = SPAWN_PAUSE;
 	  break;
       case '1':
@@ -536,6 +739,16 @@ struct child *children;
 	      uprint("Will keep spawning commands... (Even if some fail)");
 	      spawn_mode = SPAWN_MORE;
 	  break;
+      case 'w':
+	  if (spawn_mode != SPAWN_WAVE)
+	    {
+	      if (failure_mode == SPAWN_PAUSE)
+		  uprint("Spawning commands in waves... (Will pause on error)");
+	      else
+		  uprint("Spawning commands in waves... (Will quit on error)");
+	    }
+	  spawn_mode = SPAWN_WAVE;
+	  break;
       case 'F':
           if (failure_mode == SPAWN_PAUSE)
             {
@@ -562,6 +775,10 @@ struct child *children;
 	      uprint("Will spawn only one target until it succeeds...");
 	  else if (spawn_mode == SPAWN_MORE)
 	      uprint("Spawning as fast as possible...");
+	  else if (spawn_mode == SPAWN_WAVE)
+	      uprint("Spawning wave %u of %u target%s (%u done, %u failed)...",
+		     wave_num, wave_size, (wave_size > 1) ? "s" : "",
+		     wave_done, wave_failed);
 	  else
 	      uprint("Uh-oh, i don't seem to know what i'm doing! [%d]",
 		     spawn_mode);
@@ -587,72 +804,7 @@ struct child *children;
       case 'k':
 	  cmd = uprompt("kill");
 	  if (cmd != NULL && cmd[0] != '\0')
-	    {
-	      int sig, i;
-	      char *target;
-
-	      dprint("User said to kill \"%s\"", cmd);
-	      if (cmd[0] == '-')
-		{
-		  target = strchr(cmd, ' ');
-		  if (target == NULL || target[1] == '\0')
-		    {
-		      uprint("No target specified.");
-		      break;
-		    }
-		  *target = '\0';
-		  target += 1;
-		  if (isdigit((int) cmd[1]))
-		      sig = atoi(cmd+1);
-		  else
-		      sig = getsignumbyname(cmd+1);
-		  if (sig < 0)
-		    {
-		      uprint("Invalid signal name: %s", cmd);
-		      break;
-		    }
-		}
-	      else
-		{
-		  sig = SIGTERM;
-		  target = cmd;
-		}
-
-	      if (isdigit((int) target[0]))
-		{
-		  if (target_setbynum(atoi(target)) != 0)
-		    {
-		      uprint("Invalid target number: %d", atoi(target));
-		      break;
-		    }
-		}
-	      else
-		{
-		  if (target_setbyname(target) != 0)
-		    {
-		      uprint("Invalid target: %s", target);
-		      break;
-		    }
-		}
-
-	      /* Find the associated child, if any! */
-	      i = 0;
-	      while (i <= max
-		     && (children[i].pid <= 0
-			 || children[i].num != target_getnum()))
-		  i += 1;
-
-	      if (i > max)
-		  uprint("Target %s has no active process.", target_getname());
-	      else
-		{
-		  if (kill(-children[i].pid, sig) != 0)
-		      uprint("kill(%s, %d): %s", target_getname(), sig,
-			     strerror(errno));
-		  else
-		      uprint("Sent signal %d to %s...", sig, target_getname());
-		}
-	    }
+	      kill_target(cmd, children, max, uprint);
 	  break;
       case 'v':
           c = term_togglemsg();
@@ -669,6 +821,441 @@ struct child *children;
       }
 }
 
+/*
+** kill_target
+**	Send a signal to the process of a target.  The command is of the
+**	form "[-<signal>] <target>", messages are given using say().
+*/
+static int
+kill_target(cmd, children, max, say)
+char *cmd;
+struct child *children;
+int max;
+void (*say)(char *, ...);
+{
+    int sig, i;
+    char *target;
+
+    dprint("User said to kill \"%s\"", cmd);
+    if (cmd[0] == '-')
+      {
+	target = strchr(cmd, ' ');
+	if (target == NULL || target[1] == '\0')
+	  {
+	    say("No target specified.");
+	    return -1;
+	  }
+	*target = '\0';
+	target += 1;
+	if (isdigit((int) cmd[1]))
+	    sig = atoi(cmd+1);
+	else
+	    sig = getsignumbyname(cmd+1);
+	if (sig < 0)
+	  {
+	    say("Invalid signal name: %s", cmd);
+	    return -1;
+	  }
+      }
+    else
+      {
+	sig = SIGTERM;
+	target = cmd;
+      }
+
+    if (isdigit((int) target[0]))
+      {
+	if (target_setbynum(atoi(target)) != 0)
+	  {
+	    say("Invalid target number: %d", atoi(target));
+	    return -1;
+	  }
+      }
+    else
+      {
+	if (target_setbyname(target) != 0)
+	  {
+	    say("Invalid target: %s", target);
+	    return -1;
+	  }
+      }
+
+    /* Find the associated child, if any! */
+    i = 0;
+    while (i <= max
+	   && (children[i].pid <= 0
+	       || children[i].num != target_getnum()))
+	i += 1;
+
+    if (i > max)
+      {
+	say("Target %s has no active process.", target_getname());
+	return -1;
+      }
+    if (kill(-children[i].pid, sig) != 0)
+      {
+	say("kill(%s, %d): %s", target_getname(), sig, strerror(errno));
+	return -1;
+      }
+    say("Sent signal %d to %s...", sig, target_getname());
+    return 0;
+}
+
+/*
+** parse_ctl
+**	Handle a request received on the control socket.  The verbs mirror
+**	the interactive commands from parse_user().
+*/
+static void
+parse_ctl(cmd, children, max)
+char *cmd;
+struct child *children;
+int max;
+{
+    char *arg;
+
+    arg = strchr(cmd, ' ');
+    if (arg != NULL)
+      {
+	*arg = '\0';
+	arg += 1;
+	while (*arg == ' ')
+	    arg += 1;
+      }
+
+    if (strcmp(cmd, "help") == 0)
+      {
+	ctl_reply("Available commands:\n");
+	ctl_reply("  metrics                 Show counters (Prometheus format)\n");
+	ctl_reply("  json                    Show counters and processes (JSON)\n");
+	ctl_reply("  pause                   Do not spawn any more children\n");
+	ctl_reply("  resume                  Resume spawning children\n");
+	ctl_reply("  one | check | all | wave\n");
+	ctl_reply("                          Change the spawn strategy\n");
+	ctl_reply("  failmode [pause|quit]   Toggle or set the failure mode\n");
+	ctl_reply("  max <max>               Change the maximum number of processes\n");
+	ctl_reply("  kill [-<sig>] <target>  Send a signal to a target\n");
+	ctl_reply("  quit                    Quit gracefully\n");
+	ctl_reply("  abort                   Quit immediately\n");
+	ctl_reply("(Over HTTP, the path is the command: /kill/-9/target)\n");
+      }
+    else if (strcmp(cmd, "metrics") == 0)
+	show_metrics(children, max, 0);
+    else if (strcmp(cmd, "json") == 0)
+	show_metrics(children, max, 1);
+    else if (strcmp(cmd, "pause") == 0)
+      {
+	if (spawn_mode != SPAWN_PAUSE)
+	  {
+	    iprint("Pausing (control socket)...");
+	    resume_mode = spawn_mode;
+	  }
+	spawn_mode = SPAWN_PAUSE;
+	ctl_reply("Paused\n");
+      }
+    else if (strcmp(cmd, "resume") == 0)
+      {
+	if (spawn_mode == SPAWN_PAUSE)
+	  {
+	    if (resume_mode == SPAWN_MORE || resume_mode == SPAWN_CHECK
+		|| resume_mode == SPAWN_WAVE)
+		spawn_mode = resume_mode;
+	    else
+		spawn_mode = SPAWN_CHECK;
+	    iprint("Resuming (control socket)...");
+	  }
+	ctl_reply("Spawn mode: %s\n", mode_name(spawn_mode));
+      }
+    else if (strcmp(cmd, "one") == 0 || strcmp(cmd, "check") == 0
+	     || strcmp(cmd, "all") == 0 || strcmp(cmd, "wave") == 0)
+      {
+	if (spawn_mode == SPAWN_QUIT || spawn_mode == SPAWN_ABORT)
+	  {
+	    ctl_reply("Quitting, spawn mode unchanged\n");
+	    ctl_fail();
+	  }
+	else
+	  {
+	    if (cmd[0] == 'o')
+	      {
+		if (spawn_mode != SPAWN_NONE)
+		    spawn_mode = SPAWN_ONE;
+	      }
+	    else if (cmd[0] == 'c')
+		spawn_mode = SPAWN_CHECK;
+	    else if (cmd[0] == 'w')
+		spawn_mode = SPAWN_WAVE;
+	    else
+		spawn_mode = SPAWN_MORE;
+	    ctl_reply("Spawn mode: %s\n", mode_name(spawn_mode));
+	  }
+      }
+    else if (strcmp(cmd, "failmode") == 0)
+      {
+	if (arg == NULL || *arg == '\0')
+	    failure_mode = (failure_mode == SPAWN_PAUSE) ? SPAWN_QUIT
+		: SPAWN_PAUSE;
+	else if (strcmp(arg, "pause") == 0)
+	    failure_mode = SPAWN_PAUSE;
+	else if (strcmp(arg, "quit") == 0)
+	    failure_mode = SPAWN_QUIT;
+	else
+	  {
+	    ctl_reply("Invalid failure mode: %s\n", arg);
+	    ctl_fail();
+	    return;
+	  }
+	ctl_reply("Failure mode: %s\n", mode_name(failure_mode));
+      }
+    else if (strcmp(cmd, "max") == 0)
+      {
+	if (arg == NULL || atoi(arg) <= 0)
+	  {
+	    ctl_reply("Invalid maximum\n");
+	    ctl_fail();
+	    return;
+	  }
+	adapt_disable();
+	maxactive = atoi(arg);
+	iprint("Maximum number of processes set to %d (control socket)",
+	       maxactive);
+	ctl_reply("Maximum: %d\n", maxactive);
+      }
+    else if (strcmp(cmd, "kill") == 0)
+      {
+	if (arg == NULL || *arg == '\0')
+	  {
+	    ctl_reply("No target specified.\n");
+	    ctl_fail();
+	  }
+	else if (kill_target(arg, children, max, ctl_reply) != 0)
+	    ctl_fail();
+	ctl_reply("\n");
+      }
+    else if (strcmp(cmd, "quit") == 0)
+      {
+	if (spawn_mode != SPAWN_ABORT)
+	    spawn_mode = SPAWN_QUIT;
+	iprint("Waiting for existing children to terminate (control socket)..");
+	ctl_reply("Quitting\n");
+      }
+    else if (strcmp(cmd, "abort") == 0)
+      {
+	spawn_mode = SPAWN_ABORT;
+	ctl_reply("Aborting\n");
+      }
+    else
+      {
+	ctl_reply("Invalid command: %s\n", cmd);
+	ctl_fail();
+      }
+}
+
+/*
+** mode_name
+**	Name of a spawn mode, as used by -S and the control socket.
+*/
+static char *
+mode_name(mode)
+int mode;
+{
+    switch (mode)
+      {
+      case SPAWN_FATAL: return "fatal";
+      case SPAWN_ABORT: return "abort";
+      case SPAWN_QUIT:  return "quit";
+      case SPAWN_PAUSE: return "pause";
+      case SPAWN_CHECK: return "check";
+      case SPAWN_NONE:
+      case SPAWN_ONE:   return "one";
+      case SPAWN_WAVE:  return "wave";
+      default:          return "all";
+      }
+}
+
+/*
+** child_phase
+**	Describe what a child is doing (and set the current target).
+*/
+static char *
+child_phase(children, idx)
+struct child *children;
+int idx;
+{
+    if (idx == 0)
+	return "ping";
+    if (target_setbynum(children[idx].num) != 0)
+	abort();
+    if (children[idx].test == 1)
+	return "test";
+    if (children[idx].analyzer == 1)
+	return "analyzer";
+    return "command";
+}
+
+/*
+** show_metrics
+**	Reply to a control socket request with counters and running
+**	processes, either in the Prometheus text format or in JSON.
+*/
+static void
+show_metrics(children, max, json)
+struct child *children;
+int max, json;
+{
+    struct status_info si;
+    time_t now;
+    int idx, count;
+
+    status_get(&si);
+    now = time(NULL);
+
+    if (json == 0)
+      {
+	ctl_reply("# HELP shmux_targets Number of targets in each state.\n");
+	ctl_reply("# TYPE shmux_targets gauge\n");
+	ctl_reply("shmux_targets{state=\"pending\"} %d\n", si.pending);
+	ctl_reply("shmux_targets{state=\"failed\"} %d\n", si.failed);
+	if (si.alive >= 0)
+	    ctl_reply("shmux_targets{state=\"alive\"} %d\n", si.alive);
+	if (si.ok >= 0)
+	    ctl_reply("shmux_targets{state=\"ok\"} %d\n", si.ok);
+	if (si.run >= 0)
+	    ctl_reply("shmux_targets{state=\"run\"} %d\n", si.run);
+	ctl_reply("shmux_targets{state=\"done\"} %d\n", si.done);
+	ctl_reply("# HELP shmux_active Number of running processes.\n");
+	ctl_reply("# TYPE shmux_active gauge\n");
+	ctl_reply("shmux_active %d\n", si.active);
+	ctl_reply("# HELP shmux_max_active Maximum number of running processes.\n");
+	ctl_reply("# TYPE shmux_max_active gauge\n");
+	ctl_reply("shmux_max_active %d\n", maxactive);
+	ctl_reply("# HELP shmux_paused Whether spawning is paused.\n");
+	ctl_reply("# TYPE shmux_paused gauge\n");
+	ctl_reply("shmux_paused %d\n", (spawn_mode == SPAWN_PAUSE) ? 1 : 0);
+	if (wave_num > 0)
+	  {
+	    ctl_reply("# HELP shmux_wave Current wave number.\n");
+	    ctl_reply("# TYPE shmux_wave gauge\n");
+	    ctl_reply("shmux_wave %u\n", wave_num);
+	    ctl_reply("# HELP shmux_wave_targets Targets in the current wave.\n");
+	    ctl_reply("# TYPE shmux_wave_targets gauge\n");
+	    ctl_reply("shmux_wave_targets{state=\"total\"} %u\n", wave_size);
+	    ctl_reply("shmux_wave_targets{state=\"started\"} %u\n",
+		      wave_started);
+	    ctl_reply("shmux_wave_targets{state=\"done\"} %u\n", wave_done);
+	    ctl_reply("shmux_wave_targets{state=\"failed\"} %u\n",
+		      wave_failed);
+	  }
+	ctl_reply("# HELP shmux_spawns_total Number of processes spawned.\n");
+	ctl_reply("# TYPE shmux_spawns_total counter\n");
+	ctl_reply("shmux_spawns_total %lu\n", si.spawns);
+	ctl_reply("# HELP shmux_spawn_rate Processes spawned per second (recent average).\n");
+	ctl_reply("# TYPE shmux_spawn_rate gauge\n");
+	ctl_reply("shmux_spawn_rate %.2f\n", si.rate);
+	ctl_reply("# HELP shmux_read_bytes_total Bytes read from processes.\n");
+	ctl_reply("# TYPE shmux_read_bytes_total counter\n");
+	ctl_reply("shmux_read_bytes_total %lu\n", si.bytes);
+	ctl_reply("# HELP shmux_uptime_seconds Time since shmux started spawning processes.\n");
+	ctl_reply("# TYPE shmux_uptime_seconds gauge\n");
+	ctl_reply("shmux_uptime_seconds %ld\n", (long) si.uptime);
+	ctl_reply("# HELP shmux_process_runtime_seconds Runtime of running processes.\n");
+	ctl_reply("# TYPE shmux_process_runtime_seconds gauge\n");
+	for (idx = 0; idx <= max; idx++)
+	  {
+	    char *phase;
+
+	    if (children[idx].pid <= 0)
+		continue;
+	    phase = child_phase(children, idx);
+	    ctl_reply("shmux_process_runtime_seconds{target=\"%s\",phase=\"%s\",pid=\"%d\"} %ld\n",
+		      ctl_quote((idx == 0) ? "fping" : target_getname()),
+		      phase, (int) children[idx].pid,
+		      (long) (now - children[idx].start.tv_sec));
+	  }
+	return;
+      }
+
+    ctl_reply("{\n  \"uptime\": %ld,\n", (long) si.uptime);
+    ctl_reply("  \"spawn_mode\": \"%s\",\n", mode_name(spawn_mode));
+    ctl_reply("  \"failure_mode\": \"%s\",\n", mode_name(failure_mode));
+    ctl_reply("  \"max_active\": %d,\n", maxactive);
+    ctl_reply("  \"adaptive\": %s,\n", (adapt_limit() > 0) ? "true" : "false");
+    ctl_reply("  \"active\": %d,\n", si.active);
+    if (si.eta >= 0)
+	ctl_reply("  \"eta\": %ld,\n", si.eta);
+    if (wave_num > 0)
+	ctl_reply("  \"wave\": { \"number\": %u, \"size\": %u, \"started\": %u, \"done\": %u, \"failed\": %u },\n",
+		  wave_num, wave_size, wave_started, wave_done, wave_failed);
+    ctl_reply("  \"spawns\": %lu,\n", si.spawns);
+    ctl_reply("  \"spawn_rate\": %.2f,\n", si.rate);
+    ctl_reply("  \"read_bytes\": %lu,\n", si.bytes);
+    ctl_reply("  \"targets\": { \"total\": %d, \"pending\": %d, \"failed\": %d",
+	      target_getmax(), si.pending, si.failed);
+    if (si.alive >= 0)
+	ctl_reply(", \"alive\": %d", si.alive);
+    if (si.ok >= 0)
+	ctl_reply(", \"ok\": %d", si.ok);
+    if (si.run >= 0)
+	ctl_reply(", \"run\": %d", si.run);
+    ctl_reply(", \"done\": %d },\n", si.done);
+    ctl_reply("  \"processes\": [");
+    count = 0;
+    for (idx = 0; idx <= max; idx++)
+      {
+	char *phase;
+
+	if (children[idx].pid <= 0)
+	    continue;
+	phase = child_phase(children, idx);
+	ctl_reply("%s\n    { \"target\": \"%s\", \"phase\": \"%s\", \"pid\": %d, \"runtime\": %ld }",
+		  (count++ > 0) ? "," : "",
+		  ctl_quote((idx == 0) ? "fping" : target_getname()),
+		  phase, (int) children[idx].pid,
+		  (long) (now - children[idx].start.tv_sec));
+      }
+    ctl_reply("%s]\n}\n", (count > 0) ? "\n  " : "");
+}
+
+/*
+** estimate_eta
+**	Estimate the time left (in seconds) from the runtime history, or -1
+**	if unknown.
+*/
+static long
+estimate_eta(children, max)
+struct child *children;
+int max;
+{
+    struct timeval now;
+    double left, longest, expected;
+    int idx;
+
+    left = history_pending();
+    if (left < 0)
+	return -1;
+
+    /* Add what's left for the commands running */
+    gettimeofday(&now, NULL);
+    longest = 0;
+    for (idx = 1; idx <= max; idx++)
+      {
+	if (children[idx].pid <= 0 || children[idx].test == 1
+	    || children[idx].analyzer == 1)
+	    continue;
+	expected = history_expected(children[idx].num)
+	    - (now.tv_sec - children[idx].start.tv_sec)
+	    - (now.tv_usec - children[idx].start.tv_usec) / 1000000.0;
+	if (expected <= 0)
+	    continue;
+	left += expected;
+	if (expected > longest)
+	    longest = expected;
+      }
+
+    left /= (maxactive > 0) ? maxactive : 1;
+    return (long) ((left > longest) ? left : longest);
+}
+
 /*
 ** output_file
 **	Create an output file.
@@ -705,84 +1292,805 @@ char **fname, *dir, *name, *extension;
 	free(*fname); *fname = NULL;
 	return -1;
       }
-
-    return fd;
+
+    return fd;
+}
+
+/*
+** output_show
+**	Show an output file.
+*/
+void
+output_show(name, fd, fname, type)
+char *name, *fname;
+int fd, type;
+{
+    FILE *f;
+    int fd2, cont;
+    char buffer[8192], *nl;
+
+    fd2 = dup(fd);
+    if (fd2 < 0)
+      {
+	eprint("dup(%s): %s", fname, strerror(errno));
+	return;
+      }
+
+    if (lseek(fd2, 0, SEEK_SET) != 0)
+      {
+	eprint("lseek(%s, SEEK_SET): %s", fname, strerror(errno));
+	return;
+      }
+
+    f = fdopen(fd2, "r");
+    if (f == NULL)
+	eprint("fdopen(%s): %s", fname, strerror(errno));
+    
+    cont = 0;
+    while (fgets(buffer, 8192, f) != NULL)
+      {
+	nl = strchr(buffer, '\n');
+	if (nl != NULL)
+	    *nl = '\0';
+
+	if (cont == 0)
+	    tprint(name, (type == 1) ? MSG_STDOUT : MSG_STDERR, "%s", buffer);
+	else
+	    tprint(name, (type == 1) ? MSG_STDOUTTRUNC : MSG_STDERRTRUNC,
+		   "%s", buffer);
+
+	cont = (nl == NULL) ? 1 : 0;
+      }
+
+    if (feof(f) == 0)
+	eprint("fgets(%s): %s", fname, strerror(errno));
+
+    if (fclose(f) != 0)
+	eprint("fclose(%s): %s", fname, strerror(errno));
+}
+
+/*
+** output_cap
+**	Enforce the output caps on what was just read from a command,
+**	returns how many bytes should be kept.  What's discarded is still
+**	read (for the command not to block), but only the last bytes are
+**	remembered, see output_tail().
+*/
+static int
+output_cap(name, kid, std, buffer, sz)
+char *name, *buffer;
+struct child *kid;
+int std, sz;
+{
+    u_long *kept, *dropped, keep;
+    char **tail;
+    int i;
+
+    if (std == 1)
+      {
+	kept = &(kid->oread); dropped = &(kid->odropped); tail = &(kid->otail);
+      }
+    else
+      {
+	kept = &(kid->eread); dropped = &(kid->edropped); tail = &(kid->etail);
+      }
+
+    keep = sz;
+    if (cap_target > 0 && *kept + keep > cap_target)
+	keep = cap_target - *kept;
+    if (cap_global > 0 && cap_total + keep > cap_global)
+	keep = cap_global - cap_total;
+    *kept += keep;
+    cap_total += keep;
+    if (keep == sz)
+	return sz;
+
+    if (kid->odropped + kid->edropped == 0)
+      {
+	eprint("Output from %s is over the %s cap, discarding it", name,
+	       (cap_global > 0 && cap_total >= cap_global) ? "global"
+	       : "per target");
+	if (cap_kill != 0 && kid->timedout == 0)
+	  {
+	    iprint("Too much output from %s (Sending SIGTERM)..", name);
+	    kill(-kid->pid, SIGTERM);
+	    kid->timeout = time(NULL) + 5;
+	    kid->timedout = 1;
+	    kid->killed = KILL_OUTPUT;
+	  }
+      }
+
+    if (cap_tail > 0 && *tail == NULL)
+      {
+	*tail = (char *) malloc(cap_tail);
+	if (*tail == NULL)
+	    eprint("malloc failed: %s", strerror(errno));
+      }
+    if (*tail != NULL)
+	for (i = keep; i < sz; i++)
+	    (*tail)[(*dropped + i - keep) % cap_tail] = buffer[i];
+    *dropped += sz - keep;
+    target_dropped(sz - keep);
+
+    buffer[keep] = '\0';
+    return keep;
+}
+
+/*
+** output_tail
+**	Once a command closed stdout (or stderr), get a note of how much
+**	output was discarded (ending the line cut short, if any) followed by
+**	the whole lines among the last bytes of it, if any.  The result
+**	should be freed by the caller.
+*/
+static char *
+output_tail(kid, std)
+struct child *kid;
+int std;
+{
+    u_long dropped, len, start, skip;
+    char **tail, *buf, *nl;
+    int sz;
+
+    dropped = (std == 1) ? kid->odropped : kid->edropped;
+    tail = (std == 1) ? &(kid->otail) : &(kid->etail);
+    if (dropped == 0)
+	return NULL;
+
+    len = start = 0;
+    if (*tail != NULL)
+      {
+	len = (dropped < cap_tail) ? dropped : cap_tail;
+	start = (dropped < cap_tail) ? 0 : dropped % cap_tail;
+      }
+    buf = (char *) malloc(len + 64);
+    if (buf == NULL)
+      {
+	eprint("malloc failed: %s", strerror(errno));
+	return NULL;
+      }
+    skip = 0;
+    if (len > 0)
+      {
+	/* In order, after room for the note */
+	memcpy(buf + 64, *tail + start, len - start);
+	memcpy(buf + 64 + len - start, *tail, start);
+	if (len < dropped)
+	  {
+	    /* It starts in the middle of a line, which isn't worth showing */
+	    nl = memchr(buf + 64, '\n', len);
+	    skip = (nl == NULL) ? len : nl - (buf + 64) + 1;
+	  }
+      }
+    /* parse_child() doesn't like a buffer starting with \n */
+    sz = snprintf(buf, 64, "[%lu bytes discarded]\n", dropped - len + skip);
+    memmove(buf + sz, buf + 64 + skip, len - skip);
+    buf[sz + len - skip] = '\0';
+
+    free(*tail);
+    *tail = NULL;
+    return buf;
+}
+
+/*
+** output_error
+**	The output analysis found an error before the command completed:
+**	report it right away rather than waiting for the command to exit,
+**	and kill the command if so configured (-K).
+*/
+static void
+output_error(name, kid, std)
+char *name;
+struct child *kid;
+int std;
+{
+    if ((kid->output & OUT_IFERR) != 0 && (kid->output & OUT_MIXED) != 0)
+      {
+	assert( (kid->output & OUT_COPY) != 0 );
+	output_show(name, kid->ofile, kid->ofname, std);
+	output_show(name, kid->efile, kid->efname, std);
+      }
+    kid->output &= ~OUT_IFERR;
+    kid->output |= OUT_ERR;
+    eprint("Analysis of %s output indicates an error", name);
+
+    if (error_kill == 0 || kid->timedout != 0)
+	return;
+    /* No need to wait for the command to complete */
+    iprint("Error found for %s (Sending signal %d)..", name, error_kill);
+    kill(-kid->pid, error_kill);
+    kid->timeout = time(NULL) + 5;
+    kid->timedout = 1;
+    kid->killed = KILL_ERROR;
+    /* The result is known, see set_cmdstatus() */
+    if (spawn_mode == SPAWN_NONE
+	|| (spawn_mode == SPAWN_CHECK && budget_enabled() == 0))
+	spawn_mode = failure_mode;
+}
+
+/*
+** set_cmdstatus
+**	Use to define whether a command was successful or not.
+*/
+static void
+set_cmdstatus(result)
+int result;
+{
+    assert( spawn_mode != SPAWN_ONE );
+
+    if (result == CMD_SUCCESS)
+      {
+	if (spawn_mode == SPAWN_NONE)
+	    spawn_mode = SPAWN_CHECK;
+      }
+    else
+      {
+	/* With an error budget, final_result() decides */
+	if (spawn_mode == SPAWN_NONE
+	    || (spawn_mode == SPAWN_CHECK && budget_enabled() == 0))
+	    spawn_mode = failure_mode;
+      }
+    target_cmdstatus(result);
+}
+
+/*
+** analysis_verdict
+**	Report the verdict of a whole output analysis, and set the command
+**	status accordingly.  kid is NULL for verdicts on outputs which are
+**	already gone, from an external analyzer or from the memo.
+*/
+static void
+analysis_verdict(what, kid, bad, msg)
+char *what, *msg;
+struct child *kid;
+int bad;
+{
+    if (bad == 0)
+      {
+	iprint("Analysis of %s output indicates a success%s%s", what,
+	       (msg[0] != '\0') ? ": " : "", msg);
+	set_cmdstatus(CMD_SUCCESS);
+	return;
+      }
+
+    if (kid == NULL || (kid->output & OUT_ERR) == 0)
+	eprint("Analysis of %s output indicates an error%s%s", what,
+	       (msg[0] != '\0') ? ": " : "", msg);
+    if (kid != NULL && (kid->output & OUT_IFERR) != 0)
+      {
+	output_show(what, kid->ofile, kid->ofname, 1);
+	output_show(what, kid->efile, kid->ofname, 2);
+      }
+    set_cmdstatus(CMD_ERROR);
+}
+
+/*
+** exit_shown
+**	Show the exit status of a command, if so configured (-E).
+*/
+static void
+exit_shown(what, status)
+char *what;
+int status;
+{
+    if (byteset_test(BSET_SHOW, status) == 0)
+	tprint(myname, MSG_STDOUT, "Child for %s exited with status %d",
+	       what, status);
+    else
+	iprint("Child for %s exited (with status %d)", what, status);
+}
+
+/*
+** pool_full
+**	Can another child be started in the given pool?
+*/
+static int
+pool_full(pool)
+int pool;
+{
+    if (pool_max[POOL_TEST] == 0)
+	return (running[POOL_TEST] + running[POOL_CMD]
+		+ running[POOL_ANALYZER] >= maxactive);
+    if (pool == POOL_CMD)
+	return (running[POOL_CMD] >= maxactive);
+    return (running[pool] >= pool_max[pool]);
+}
+
+/*
+** pool_slots
+**	Number of child slots needed for all pools.
+*/
+static int
+pool_slots(void)
+{
+    return maxactive + pool_max[POOL_TEST] + pool_max[POOL_ANALYZER];
+}
+
+/*
+** wave_spawn
+**	With the "wave" spawn strategy, targets are started in waves: first
+**	a single canary, then twice as many targets each time up to the
+**	maximum number of processes.  A wave is only started once all
+**	targets from the previous one are done.  Returns 0 if a target
+**	may not be started yet, 1 otherwise (and accounts for it).
+*/
+static int
+wave_spawn(void)
+{
+    if (wave_num == 0 || wave_started >= wave_size)
+      {
+	if (wave_done < wave_started)
+	    return 0;
+
+	if (wave_num > 0)
+	  {
+	    iprint("Wave %u complete: %u of %u target%s failed",
+		   wave_num, wave_failed, wave_done,
+		   (wave_done > 1) ? "s" : "");
+	    wave_size *= 2;
+	  }
+	else
+	    wave_size = 1;
+	if (wave_size > maxactive)
+	    wave_size = maxactive;
+	wave_num += 1;
+	wave_started = wave_done = wave_failed = 0;
+	iprint("Starting wave %u (%u target%s)", wave_num, wave_size,
+	       (wave_size > 1) ? "s" : "");
+      }
+
+    wave_started += 1;
+    return 1;
+}
+
+/*
+** wave_result
+**	Account for a target which reached its final state, applies the
+**	failure mode once a wave has more failures than allowed.
+*/
+static void
+wave_result(phase, result)
+int phase, result;
+{
+    u_int allowed;
+
+    /* Only targets which got to run the command are part of a wave */
+    if (phase < 3 || wave_done >= wave_started)
+	return;
+
+    wave_done += 1;
+    if (result == CMD_SUCCESS)
+	return;
+
+    wave_failed += 1;
+    allowed = (wave_pct) ? wave_size * wave_budget / 100 : wave_budget;
+    if (wave_failed > allowed && spawn_mode == SPAWN_WAVE)
+      {
+	eprint("Wave %u has too many failures (%u of %u target%s)",
+	       wave_num, wave_failed, wave_size, (wave_size > 1) ? "s" : "");
+	resume_mode = SPAWN_WAVE;
+	spawn_mode = failure_mode;
+      }
+}
+
+/*
+** loop_retry
+**	Parse a "<attempts>[:<delay>]" -R argument.
+*/
+void
+loop_retry(spec)
+char *spec;
+{
+    char *colon;
+
+    if (isdigit((int) spec[0]) == 0)
+      {
+	fprintf(stderr, "%s: Invalid -R argument: %s\n", myname, spec);
+	exit(RC_ERROR);
+      }
+    retry_max = atoi(spec);
+    colon = strchr(spec, ':');
+    if (colon != NULL)
+      {
+	retry_delay = unit_time(colon + 1);
+	if (retry_delay == 0)
+	    retry_delay = 1;
+      }
+    srandom((u_int) (getpid() ^ time(NULL)));
+}
+
+/*
+** loop_pools
+**	Parse the "<tests>[,<analyzers>]" part of a -M argument, omitted
+**	(or empty) values being the same as the maximum for commands.
+*/
+void
+loop_pools(spec)
+char *spec;
+{
+    char *str;
+    int pool;
+
+    pool_max[POOL_TEST] = pool_max[POOL_ANALYZER] = 0;
+    if (spec == NULL)
+	return;
+
+    pool_max[POOL_TEST] = pool_max[POOL_ANALYZER] = -1;
+    str = spec;
+    for (pool = POOL_TEST; pool <= POOL_ANALYZER; pool += 2)
+      {
+	if (isdigit((int) *str) != 0)
+	  {
+	    pool_max[pool] = strtol(str, &str, 10);
+	    if (pool_max[pool] <= 0)
+		break;
+	  }
+	if (*str == '\0')
+	    return;
+	if (*str != ',' || pool == POOL_ANALYZER)
+	    break;
+	str += 1;
+      }
+    fprintf(stderr, "%s: Invalid -M pools: %s\n", myname, spec);
+    exit(RC_ERROR);
+}
+
+/*
+** loop_idle
+**	Set the inactivity timeout for commands (-I).
+*/
+void
+loop_idle(seconds)
+u_int seconds;
+{
+    idle_timeout = seconds;
+}
+
+/*
+** loop_caps
+**	Set the output caps for commands (-O, -G and -k).
+*/
+void
+loop_caps(target, tail, global, kill)
+u_long target, tail, global;
+int kill;
+{
+    cap_target = target;
+    cap_tail = tail;
+    cap_global = global;
+    cap_kill = kill;
+}
+
+/*
+** loop_input
+**	Read the standard input for commands (-i), from the given file or
+**	from our own standard input ("-"), and return it.
+*/
+char *
+loop_input(file, len)
+char *file;
+size_t *len;
+{
+    struct stat st;
+    size_t sz;
+    ssize_t rc;
+    int fd;
+
+    if (strcmp(file, "-") == 0)
+	fd = 0;
+    else if ((fd = open(file, O_RDONLY, 0)) == -1)
+      {
+	fprintf(stderr, "%s: open(%s): %s\n", myname, file, strerror(errno));
+	exit(RC_ERROR);
+      }
+
+    target_input(1);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+      {
+	input = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (input != (char *) MAP_FAILED)
+	  {
+	    input_len = st.st_size;
+	    if (fd != 0)
+		close(fd);
+	    *len = input_len;
+	    return input;
+	  }
+	input = NULL;
+      }
+
+    /* Not a regular file, read it all */
+    sz = 0;
+    do
+      {
+	if (input_len == sz)
+	  {
+	    sz = (sz == 0) ? 65536 : sz * 2;
+	    input = (char *) realloc(input, sz);
+	    if (input == NULL)
+	      {
+		perror("malloc failed");
+		exit(RC_ERROR);
+	      }
+	  }
+	rc = read(fd, input + input_len, sz - input_len);
+	if (rc > 0)
+	    input_len += rc;
+      }
+    while (rc > 0 || (rc == -1 && errno == EINTR));
+    if (rc == -1)
+      {
+	fprintf(stderr, "%s: read(%s): %s\n", myname, file, strerror(errno));
+	exit(RC_ERROR);
+      }
+    if (fd != 0)
+	close(fd);
+    *len = input_len;
+    return input;
+}
+
+/*
+** loop_ondemand
+**	Commands are only fed their input if they ask for it, by starting
+**	their standard output with the given string (which must arrive all
+**	at once).
+*/
+void
+loop_ondemand(request)
+char *request;
+{
+    input_request = request;
+}
+
+/*
+** loop_report
+**	Show how fast commands were fed their input, for the final summary.
+*/
+void
+loop_report(void)
+{
+    double elapsed;
+    char total[32];
+
+    if (input == NULL || input_fed == 0)
+	return;
+
+    elapsed = (input_last.tv_sec - input_first.tv_sec)
+	+ (input_last.tv_usec - input_first.tv_usec) / 1000000.0;
+    if (elapsed < 0.001)
+	elapsed = 0.001;
+    strlcpy(total, unit_rsize((u_long) input_sent), sizeof(total));
+    printf("Input    : %s sent, %lu target%s fed in %.2fs, %s/s", total,
+	   input_fed, (input_fed > 1) ? "s" : "", elapsed,
+	   unit_rsize((u_long) (input_sent / elapsed)));
+    nprint(" (slowest: %s/s)", unit_rsize((u_long) input_slowest));
+}
+
+/*
+** input_write
+**	Feed a command (more of) its standard input (-i).  Returns -1 when
+**	done with it, be it all written or not.
+*/
+static int
+input_write(name, kid, fd)
+char *name;
+struct child *kid;
+int fd;
+{
+    ssize_t sz;
+
+    sz = write(fd, input + kid->ioff, input_len - kid->ioff);
+    if (sz == -1)
+      {
+	if (errno == EAGAIN || errno == EINTR)
+	    return 0;
+	if (errno == EPIPE)
+	    /* Not an error, it is up to the command to read it all */
+	    dprint("%s closed its standard input after %lu bytes", name,
+		   (u_long) kid->ioff);
+	else
+	    eprint("Unexpected write(STDIN) error for %s: %s", name,
+		   strerror(errno));
+	return -1;
+      }
+    kid->ioff += sz;
+    input_sent += sz;
+    if (kid->ioff < input_len)
+	return 0;
+
+    /* All of it, how long did it take? */
+      {
+	double elapsed, rate;
+
+	gettimeofday(&input_last, NULL);
+	elapsed = (input_last.tv_sec - kid->start.tv_sec)
+	    + (input_last.tv_usec - kid->start.tv_usec) / 1000000.0;
+	if (elapsed < 0.001)
+	    elapsed = 0.001;
+	rate = input_len / elapsed;
+	if (input_fed == 0 || rate < input_slowest)
+	    input_slowest = rate;
+	input_fed += 1;
+	iprint("Input sent to %s in %.2fs (%s/s)", name, elapsed,
+	       unit_rsize((u_long) rate));
+	adapt_sample(ADAPT_INPUT, kid->seq, elapsed);
+      }
+    return -1;
+}
+
+/*
+** loop_errkill
+**	Set the signal sent to commands as soon as their output indicates
+**	an error (-K), given by name or number.
+*/
+void
+loop_errkill(sig)
+char *sig;
+{
+    if (isdigit((int) sig[0]))
+	error_kill = atoi(sig);
+    else
+	error_kill = getsignumbyname(sig);
+    if (error_kill <= 0 || error_kill >= NSIG)
+      {
+	fprintf(stderr, "%s: Invalid signal: %s\n", myname, sig);
+	exit(RC_ERROR);
+      }
 }
 
 /*
-** output_show
-**	Show an output file.
+** transport_failure
+**	Tell whether a child (which just terminated) failed for reasons
+**	which are worth retrying, and why.
 */
-void
-output_show(name, fd, fname, type)
-char *name, *fname;
-int fd, type;
+static char *
+transport_failure(kid, status)
+struct child *kid;
+int status;
 {
-    FILE *f;
-    int fd2, cont;
-    char buffer[8192], *nl;
+    static char why[32];
 
-    fd2 = dup(fd);
-    if (fd2 < 0)
+    if (kid->execstate != 0)
+	return "exec failed";
+    if (kid->test == 1)
       {
-	eprint("dup(%s): %s", fname, strerror(errno));
-	return;
+	if (kid->passed == 1)
+	    return NULL;
+	return (kid->passed == -2) ? "test timed out" : "test failed";
       }
-
-    if (lseek(fd2, 0, SEEK_SET) != 0)
+    if (WIFEXITED(status) == 0 || kid->timedout > 0)
+	return NULL;
+    /* rsh/ssh use 255 to report connection failures */
+    if ((WEXITSTATUS(status) == 255 && target_isremote() != 0)
+	|| byteset_test(BSET_RETRY, WEXITSTATUS(status)) == 0)
       {
-	eprint("lseek(%s, SEEK_SET): %s", fname, strerror(errno));
-	return;
+	snprintf(why, sizeof(why), "exit %d", WEXITSTATUS(status));
+	return why;
       }
+    return NULL;
+}
 
-    f = fdopen(fd2, "r");
-    if (f == NULL)
-	eprint("fdopen(%s): %s", fname, strerror(errno));
-    
-    cont = 0;
-    while (fgets(buffer, 8192, f) != NULL)
-      {
-	nl = strchr(buffer, '\n');
-	if (nl != NULL)
-	    *nl = '\0';
+/*
+** retry
+**	Schedule another attempt for the current target after a transport
+**	failure (of the test, or command), with exponential backoff and
+**	jitter.  Returns 0 if the target will be retried, -1 otherwise.
+*/
+static int
+retry(why, command)
+char *why;
+int command;
+{
+    int attempt;
+    u_int delay;
 
-	if (cont == 0)
-	    tprint(name, (type == 1) ? MSG_STDOUT : MSG_STDERR, "%s", buffer);
-	else
-	    tprint(name, (type == 1) ? MSG_STDOUTTRUNC : MSG_STDERRTRUNC,
-		   "%s", buffer);
+    attempt = target_attempts();
+    if (attempt >= retry_max || spawn_mode == SPAWN_QUIT
+	|| spawn_mode == SPAWN_ABORT)
+	return -1;
 
-	cont = (nl == NULL) ? 1 : 0;
+    delay = retry_delay;
+    while (attempt-- > 0 && delay < RETRY_MAXDELAY)
+	delay *= 2;
+    if (delay > RETRY_MAXDELAY)
+	delay = RETRY_MAXDELAY;
+    /* Between half and all of the delay */
+    delay = delay / 2 + random() % (delay - delay / 2 + 1);
+
+    eprint("%s failed (%s), retrying in %s (attempt %d of %d)",
+	   target_getname(), why, unit_rtime(delay),
+	   target_attempts() + 2, retry_max + 1);
+    target_retry(time(NULL) + delay, why);
+
+    if (command != 0)
+      {
+	/* The command will be started again */
+	if (spawn_mode == SPAWN_NONE)
+	    spawn_mode = SPAWN_ONE;
+	if (wave_started > wave_done)
+	    wave_started -= 1;
       }
+    return 0;
+}
 
-    if (feof(f) == 0)
-	eprint("fgets(%s): %s", fname, strerror(errno));
+/*
+** retry_files
+**	Get output files out of the way for the next attempt: with -o, they
+**	are kept with the attempt number as suffix.
+*/
+static void
+retry_files(kid, copy)
+struct child *kid;
+int copy;
+{
+    char *fname[2];
+    int fd[2], i, len;
 
-    if (fclose(f) != 0)
-	eprint("fclose(%s): %s", fname, strerror(errno));
+    fd[0] = kid->ofile; fname[0] = kid->ofname;
+    fd[1] = kid->efile; fname[1] = kid->efname;
+    for (i = 0; i < 2; i++)
+      {
+	if (fd[i] == -1)
+	    continue;
+	close(fd[i]);
+	if (copy != 0)
+	  {
+	    char *old;
+
+	    len = strlen(fname[i]) + 12;
+	    old = (char *) malloc(len);
+	    if (old != NULL)
+	      {
+		snprintf(old, len, "%s.%d", fname[i], target_attempts());
+		if (rename(fname[i], old) == -1)
+		    eprint("rename(%s, %s): %s", fname[i], old,
+			   strerror(errno));
+		free(old);
+	      }
+	  }
+	else if (unlink(fname[i]) == -1 && errno != ENOENT)
+	    eprint("unlink(%s): %s", fname[i], strerror(errno));
+	free(fname[i]);
+      }
+    kid->ofile = kid->efile = -1;
+    kid->ofname = kid->efname = NULL;
 }
 
 /*
-** set_cmdstatus
-**	Use to define whether a command was successful or not.
+** final_result
+**	Called by target.c when a target reaches its final state, records it
+**	in the journal, and accounts for it in the current wave and the error
+**	budget.
 */
 static void
-set_cmdstatus(result)
-int result;
+final_result(phase, result)
+int phase, result;
 {
-    assert( spawn_mode != SPAWN_ONE );
+    journal_result(phase, result);
+    wave_result(phase, result);
+    if (phase < 3)
+	/* The command won't run on this target */
+	history_start(target_getnum());
 
-    if (result == CMD_SUCCESS)
+    if (budget_hit == 1)
       {
-	if (spawn_mode == SPAWN_NONE)
-	    spawn_mode = SPAWN_CHECK;
+	if (spawn_mode == SPAWN_PAUSE || spawn_mode == SPAWN_QUIT
+	    || spawn_mode == SPAWN_ABORT)
+	    return;
+	/* Resumed after exceeding the budget, start over. */
+	budget_reset();
+	budget_hit = 0;
       }
-    else
+    if (budget_result(result == CMD_SUCCESS) != 0)
       {
-	if (spawn_mode == SPAWN_NONE || spawn_mode == SPAWN_CHECK)
+	budget_hit = 1;
+	if (spawn_mode != SPAWN_PAUSE && spawn_mode != SPAWN_QUIT
+	    && spawn_mode != SPAWN_ABORT)
+	  {
+	    resume_mode = spawn_mode;
 	    spawn_mode = failure_mode;
+	  }
       }
-    target_cmdstatus(result);
 }
 
 
@@ -799,8 +2107,8 @@ u_int ctimeout, utest;
 {
     struct child *children;
     struct pollfd *pfd;
-    struct sigaction sa, saved_sa;
-    int idx;
+    struct sigaction sa, saved_sa, saved_pipe;
+    int idx, nctl, ncop, napool;
     char *cargv[10];
 
     /* check spawn */
@@ -810,6 +2118,31 @@ u_int ctimeout, utest;
 	spawn_mode = SPAWN_CHECK;
     else if (strcmp(spawn, "one") == 0)
 	spawn_mode = SPAWN_ONE;
+    else if (strncmp(spawn, "wave", 4) == 0
+	     && (spawn[4] == '\0'
+		 || (spawn[4] == ':' && isdigit((int) spawn[5]))))
+      {
+	char *end;
+
+	spawn_mode = SPAWN_WAVE;
+	wave_budget = 0;
+	wave_pct = 0;
+	if (spawn[4] == ':')
+	  {
+	    wave_budget = strtoul(spawn + 5, &end, 10);
+	    if (*end == '%')
+	      {
+		wave_pct = 1;
+		end += 1;
+	      }
+	    if (*end != '\0' || (wave_pct == 1 && wave_budget > 100))
+	      {
+		fprintf(stderr, "%s: Invalid spawn strategy \"%s\"\n",
+			myname, spawn);
+		return RC_ERROR;
+	      }
+	  }
+      }
     else
       {
 	fprintf(stderr, "%s: Invalid spawn strategy \"%s\"\n", myname, spawn);
@@ -822,20 +2155,56 @@ u_int ctimeout, utest;
         failure_mode = SPAWN_PAUSE;
     else
         failure_mode = SPAWN_QUIT;
+    /* Nobody to resume from a failed wave or an exceeded budget? */
+    if ((spawn_mode == SPAWN_WAVE || budget_enabled() != 0)
+	&& tty_fd() < 0 && ctl_nfds() == 0)
+        failure_mode = SPAWN_QUIT;
+    target_notify(final_result);
+
+    /* The analyzer co-processes are started once, and kept until the end */
+    if (utest == ANALYZE_COPROC)
+	coproc_start(analyzer_cmd(), analyzer_procs());
+    /* Threads for the whole output analysis of large outputs */
+    if (utest == ANALYZE_RE || utest == ANALYZE_PCRE
+	|| utest == ANALYZE_PLUGIN)
+	apool_start((utest == ANALYZE_PLUGIN) ? 1 : ANALYSIS_THREADS);
+
+    /* review process fd limit, the slots being shared by all pools */
+    if (pool_max[POOL_TEST] == -1)
+	pool_max[POOL_TEST] = max;
+    if (pool_max[POOL_ANALYZER] == -1)
+	pool_max[POOL_ANALYZER] = max;
+    maxactive = max;
+    max = setup_fdlimit((odir == NULL) ? 3 : 5, pool_slots());
+    if (max - pool_max[POOL_TEST] - pool_max[POOL_ANALYZER] < 1)
+      {
+	eprint("Using a single pool of %d processes because of system limitation.", max);
+	pool_max[POOL_TEST] = pool_max[POOL_ANALYZER] = 0;
+      }
+    max -= pool_max[POOL_TEST] + pool_max[POOL_ANALYZER];
+    adapt_ceiling(max);
+    maxactive = (adapt_limit() > 0) ? adapt_limit() : max;
+    max = pool_slots();
+    running[POOL_TEST] = running[POOL_CMD] = running[POOL_ANALYZER] = 0;
 
-    /* review process fd limit */
-    setup_fdlimit((odir == NULL) ? 3 : 5, max);
-
-    /* Allocate and initialize the control structures */
-    pfd = (struct pollfd *) malloc((max+2)*3 * sizeof(struct pollfd));
+    /*
+    ** Allocate and initialize the control structures, the control socket,
+    ** the analyzer co-processes and the analysis threads (if any) use the
+    ** last pollfd entries.
+    */
+    nctl = ctl_nfds();
+    ncop = coproc_nfds();
+    napool = apool_nfds();
+    pfd = (struct pollfd *) malloc(((max+2)*3 + nctl + ncop + napool)
+				   * sizeof(struct pollfd));
     if (pfd == NULL)
       {
 	perror("malloc failed");
 	return RC_ERROR;
       }
-    memset((void *) pfd, 0, (max+2)*3 * sizeof(struct pollfd));
+    memset((void *) pfd, 0, ((max+2)*3 + nctl + ncop + napool) * sizeof(struct pollfd));
     idx = 0;
-    while (idx < (max+2)*3)
+    while (idx < (max+2)*3 + nctl + ncop + napool)
 	pfd[idx++].fd = -1;
 
     children = (struct child *) malloc((max+1) * sizeof(struct child));
@@ -853,10 +2222,16 @@ u_int ctimeout, utest;
     sa.sa_handler = shmux_sigint;
     sigaction(SIGINT, &sa, &saved_sa);
     got_sigint = 0;
+    /* Commands closing their standard input early get EPIPE instead */
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, &saved_pipe);
 
     /* Initialize the status module. */
     status_init(ping != NULL, test != 0, utest != ANALYZE_NONE);
 
+    /* Skip targets already done when resuming */
+    journal_restore();
+
     /* Run fping if requested */
     if (ping != NULL)
       {
@@ -911,7 +2286,11 @@ u_int ctimeout, utest;
 	int pollrc, done;
 	char *what;
 
-	/* Update the status line before (possibly) pausing in poll() */
+	/* Sync the journal and update the status line before (possibly)
+	** pausing in poll() */
+	journal_sync(0);
+	if (history_enabled() != 0)
+	    status_eta(estimate_eta(children, max));
 	status_update();
 
 	/* Check (or not) for input */
@@ -925,12 +2304,16 @@ u_int ctimeout, utest;
 	else
 	  {
 	    pfd[0].events = 0;
-            if (spawn_mode == SPAWN_PAUSE)
+	    /* Nobody to resume from a pause, unless using the socket */
+            if (spawn_mode == SPAWN_PAUSE && nctl == 0)
                 spawn_mode = failure_mode;
 	  }
+	ctl_poll(pfd + (max+2)*3);
+	coproc_poll(pfd + (max+2)*3 + nctl);
+	apool_poll(pfd + (max+2)*3 + nctl + ncop);
 
 	/* Check for data to read/write */
-	pollrc = poll(pfd, (max+2)*3, 250);
+	pollrc = poll(pfd, (max+2)*3 + nctl + ncop + napool, 250);
 	if (pollrc == -1 && errno != EINTR)
 	  {
 	    perror("poll");
@@ -973,7 +2356,7 @@ u_int ctimeout, utest;
 	/* read and process children output if any */
 	if (pollrc > 0)
 	  {
-	    dprint("poll(%d) = %d", (max+2)*3, pollrc);
+	    dprint("poll(%d) = %d", (max+2)*3 + nctl + ncop + napool, pollrc);
 	    idx = 0;
 	    while (idx < (max+2)*3)
 	      {
@@ -1010,7 +2393,7 @@ u_int ctimeout, utest;
 		    ** or input to be read from the user.
 		    */
 		    char buffer[8192];
-		    int sz;
+		    int sz, bad, raw;
         int err = 0;
 
 		    sz = read(pfd[idx].fd, buffer, (idx == 0) ? 1 : 8191);
@@ -1024,8 +2407,88 @@ u_int ctimeout, utest;
 			if (idx == 0)
 			    parse_user(buffer[0], children, max);
 			else
-			    parse_child(what, idx<=2, test<0, utest,
-					children+(idx/3), idx%3, buffer);
+			  {
+			    status_read(sz);
+			    if (idx%3 == 1 && idx > 2
+				&& children[idx/3].iwait != 0)
+			      {
+				char *req;
+
+				/*
+				** Does it want its input?  Only now.  The
+				** request may come after (or along with)
+				** other output, from the remote shell's
+				** startup files for instance.
+				*/
+				req = strstr(buffer, input_request);
+				if (req != NULL)
+				  {
+				    dprint("%s requested its input", what);
+				    children[idx/3].iwait = 0;
+				    memmove(req, req + strlen(input_request),
+					    buffer + sz + 1
+					    - (req + strlen(input_request)));
+				    sz -= strlen(input_request);
+				    if (pfd[idx-1].fd != -1)
+					pfd[idx-1].events = POLLOUT;
+				    if (input_first.tv_sec == 0)
+					input_first = children[idx/3].start;
+				  }
+			      }
+			    /* Gathered output isn't parsed at all (-g) */
+			    raw = (idx%3 == 1 && idx > 2
+				   && children[idx/3].gather != NULL);
+			    if (raw != 0 && sz > 0)
+			      {
+				gather_write(children[idx/3].gather,
+					     buffer, sz);
+				sz = 0;
+			      }
+			    if (idx > 2 && children[idx/3].test == 0
+				&& children[idx/3].analyzer == 0 && sz > 0)
+				memo_feed(children[idx/3].num, idx%3,
+					  buffer, sz);
+			    /* All of the output is analyzed, even if capped */
+			    bad = 0;
+			    if (idx > 2 && children[idx/3].analysis != NULL
+				&& (children[idx/3].output & OUT_ERR) == 0
+				&& sz > 0)
+				bad = analyzer_feed(children[idx/3].analysis,
+						    (idx%3 == 1)
+						    ? ANALYZE_STDOUT
+						    : ANALYZE_STDERR,
+						    buffer, sz);
+			    if (idx > 2 && children[idx/3].test == 0
+				&& children[idx/3].analyzer == 0
+				&& (cap_target > 0 || cap_global > 0))
+				sz = output_cap(what, children+(idx/3),
+						idx%3, buffer, sz);
+			    if (children[idx/3].idle != 0)
+				children[idx/3].idle = time(NULL)
+				    + idle_timeout;
+			    if (idx > 2 && children[idx/3].gotdata == 0)
+			      {
+				struct timeval now;
+
+				/* Time to first byte */
+				children[idx/3].gotdata = 1;
+				gettimeofday(&now, NULL);
+				if (children[idx/3].analyzer == 0)
+				    adapt_sample((children[idx/3].test == 1)
+						 ? ADAPT_TEST : ADAPT_CMD,
+						 children[idx/3].seq,
+						 (now.tv_sec
+						  - children[idx/3].start.tv_sec)
+						 + (now.tv_usec
+						    - children[idx/3].start.tv_usec)
+						 / 1000000.0);
+			      }
+			    if (sz > 0)
+				parse_child(what, idx<=2, test<0, utest,
+					    children+(idx/3), idx%3, buffer);
+			    if (bad != 0)
+				output_error(what, children+(idx/3), idx%3);
+			  }
 		      }
 		    else
 		      {
@@ -1062,6 +2525,27 @@ u_int ctimeout, utest;
 				       (idx%3 == 1) ? "OUT" : "ERR", what,
 				       strerror(errno));
 			    close(pfd[idx].fd); pfd[idx].fd = -1;
+			    if (idx%3 == 1 && idx > 2
+				&& children[idx/3].gather != NULL)
+			      {
+				/* An incomplete file is an error */
+				if (gather_close(children[idx/3].gather) != 0)
+				    children[idx/3].output |= OUT_ERR;
+				children[idx/3].gather = NULL;
+			      }
+			    if (idx > 2)
+			      {
+				char *tail;
+
+				/* Output was capped, show the end of it */
+				tail = output_tail(children+(idx/3), idx%3);
+				if (tail != NULL)
+				  {
+				    parse_child(what, 0, test<0, utest,
+						children+(idx/3), idx%3, tail);
+				    free(tail);
+				  }
+			      }
 			    if (idx%3 == 1)
 				left = &(children[idx/3].obuf);
 			    else
@@ -1079,13 +2563,108 @@ u_int ctimeout, utest;
 		  }
 		else
 		  {
-		    /* Stdin ready to be written to */
-		    abort(); /* we don't use this yet, so how did we get here? */
+		    /* Stdin ready to be written to (-i) */
+		    assert( input != NULL );
+		    if (input_write(what, children+(idx/3), pfd[idx].fd) != 0)
+		      {
+			close(pfd[idx].fd);
+			pfd[idx].fd = -1;
+		      }
 		  }
 
 		idx += 1;
 	      }
+
+	    /* Requests from the control socket */
+	    if (nctl > 0)
+	      {
+		char *req;
+
+		while ((req = ctl_input(pfd + (max+2)*3)) != NULL)
+		    parse_ctl(req, children, max);
+	      }
+	  }
+
+	/* Verdicts from the analyzer co-processes (or their demise) */
+	if (ncop > 0)
+	  {
+	    char *msg;
+	    int num, bad;
+
+	    while ((msg = coproc_input(pfd + (max+2)*3 + nctl, &num, &bad))
+		   != NULL)
+	      {
+		if (target_setbynum(num) != 0)
+		    abort();
+		if (bad == -1)
+		  {
+		    eprint("Fatal error for %s output analysis",
+			   target_getname());
+		    target_result(-1);
+		    continue;
+		  }
+		memo_put(num, bad, msg);
+		analysis_verdict(target_getname(), NULL, bad, msg);
+		target_result(1);
+	      }
+	  }
+
+	/* Verdicts from the analysis threads */
+	if (napool > 0)
+	  {
+	    struct handback *hb;
+	    void *wa;
+
+	    while ((hb = apool_done(pfd + (max+2)*3 + nctl + ncop, &wa))
+		   != NULL)
+	      {
+		struct child *kid;
+
+		kid = &(hb->kid);
+		if (target_setbynum(kid->num) != 0)
+		    abort();
+		if (wa != NULL)
+		  {
+		    hb->bad = analyzer_unmap(wa, hb->msg, sizeof(hb->msg));
+		    if (hb->bad != -1)
+			memo_put(kid->num, hb->bad, hb->msg);
+		  }
+		analysis_verdict(target_getname(), kid, hb->bad, hb->msg);
+		exit_shown(target_getname(), WEXITSTATUS(kid->status));
+		if (kid->ofile != -1)
+		  {
+		    close(kid->ofile);
+		    free(kid->ofname);
+		  }
+		if (kid->efile != -1)
+		  {
+		    close(kid->efile);
+		    free(kid->efname);
+		  }
+		free(hb);
+		target_result(1);
+	      }
+	  }
+
+	/* Room for more children? (maxactive changed at runtime) */
+	if (pool_slots() > max)
+	  {
+	    int slots;
+
+	    slots = setup_fdlimit((odir == NULL) ? 3 : 5, pool_slots());
+	    if (slots > max && grow(&children, &pfd, max, slots) == 0)
+		max = slots;
+	    maxactive = max - (pool_max[POOL_TEST] + pool_max[POOL_ANALYZER]);
+	  }
+
+	/* Follow the adaptive concurrency */
+	if (adapt_limit() > 0)
+	  {
+	    maxactive = adapt_limit();
+	    status_max(maxactive);
 	  }
+	else
+	    status_max(-1);
 
 	/* Shall we abort? */
 	if ( spawn_mode == SPAWN_ABORT )
@@ -1095,7 +2674,7 @@ u_int ctimeout, utest;
 	idx = 0; done = 1;
 	while (idx < max+1)
 	  {
-	    int status, wprc;
+	    int status, wprc, retried, deferred;
 
 	    /* Spawn as many processes as allowed */
 	    if (children[idx].pid <= 0)
@@ -1109,9 +2688,36 @@ u_int ctimeout, utest;
 		    continue;
 		  }
 
-		/* Spawn phase 4 ready first */
-		if (idx > 0 && target_next(4) == 0)
+		/* Spawn phase 4 ready first (unless no slot is needed) */
+		if (idx > 0
+		    && (utest != ANALYZE_RUN || pool_full(POOL_ANALYZER) == 0)
+		    && target_next(4) == 0)
 		  {
+		    char msg[256];
+		    int bad;
+
+		    if ((utest == ANALYZE_RUN || utest == ANALYZE_COPROC)
+			&& memo_get(target_getnum(), &bad, msg, sizeof(msg))
+			== 1)
+		      {
+			/* Same output as an earlier target */
+			target_start();
+			analysis_verdict(target_getname(), NULL, bad, msg);
+			target_result(1);
+			continue;
+		      }
+		    if (utest == ANALYZE_COPROC)
+		      {
+			/* No need for a slot, just a request */
+			target_start();
+			if (coproc_send(target_getnum(), target_getname(),
+					odir) == -1)
+			  {
+			    eprint("Fatal error for %s", target_getname());
+			    target_result(-1);
+			  }
+			continue;
+		      }
 		    if (utest != ANALYZE_RUN)
 		      {
 			dprint("%s skipped external analyzer",
@@ -1171,6 +2777,7 @@ u_int ctimeout, utest;
 		    pfd[idx*3+1].events = POLLIN;
 		    pfd[idx*3+2].events = POLLIN;
 
+		    running[POOL_ANALYZER] += 1;
 		    dprint("%s, phase 4: pid = %d (idx=%d) %d/%d/%d",
 			   target_getname(), children[idx].pid, idx,
 			   pfd[idx*3].fd, pfd[idx*3+1].fd, pfd[idx*3+2].fd);
@@ -1179,7 +2786,8 @@ u_int ctimeout, utest;
 		  }
 
 		/* Spawn phase 3 ready */
-		if (idx > 0 && spawn_mode != SPAWN_NONE && target_next(3) == 0)
+		if (idx > 0 && spawn_mode != SPAWN_NONE
+		    && pool_full(POOL_CMD) == 0 && target_next(3) == 0)
 		  {
 		    done = 0;
 
@@ -1190,7 +2798,17 @@ u_int ctimeout, utest;
 			continue;
 		      }
 
+		    if (spawn_mode == SPAWN_WAVE && wave_spawn() == 0)
+		      {
+			/* Wait for the current wave to complete */
+			idx += 1;
+			continue;
+		      }
+
 		    target_start();
+		    history_start(target_getnum());
+		    journal_start();
+		    memo_start(target_getnum());
 
 		    init_child(&(children[idx]));
 
@@ -1223,8 +2841,20 @@ u_int ctimeout, utest;
 			    continue;
 			  }
 		      }
+		    if (gather_enabled() != 0)
+		      {
+			children[idx].gather = gather_open(target_getname());
+			if (children[idx].gather == NULL)
+			  {
+			    retry_files(&(children[idx]), 0);
+			    eprint("Fatal error for %s", target_getname());
+			    target_result(-1);
+			    continue;
+			  }
+		      }
 		    pfd[idx*3].fd = -1;
-		    children[idx].pid = exec(NULL, &(pfd[idx*3+1].fd),
+		    children[idx].pid = exec((input != NULL) ? &(pfd[idx*3].fd)
+					     : NULL, &(pfd[idx*3+1].fd),
 					     &(pfd[idx*3+2].fd),
 					     target_getname(),
                                              target_getcmd(cmd),
@@ -1232,6 +2862,16 @@ u_int ctimeout, utest;
 		    if (children[idx].pid == -1)
 			  {
 			    /* Error message was given by exec() */
+			    if (children[idx].gather != NULL)
+			      {
+				gather_close(children[idx].gather);
+				children[idx].gather = NULL;
+			      }
+			    if (retry("spawn failed", 1) == 0)
+			      {
+				retry_files(&(children[idx]), 0);
+				continue;
+			      }
 			    eprint("Fatal error for %s", target_getname());
 			    target_result(-1);
 			    continue;
@@ -1239,10 +2879,35 @@ u_int ctimeout, utest;
 
 		    if (ctimeout > 0)
 			children[idx].timeout = time(NULL) + ctimeout + 5;
+		    if (idle_timeout > 0)
+			children[idx].idle = time(NULL) + idle_timeout;
+		    if (utest == ANALYZE_RE || utest == ANALYZE_PCRE)
+			children[idx].analysis = analyzer_open(utest);
 
+		    if (pfd[idx*3].fd != -1 && input_len == 0)
+		      {
+			close(pfd[idx*3].fd);
+			pfd[idx*3].fd = -1;
+		      }
+		    else if (pfd[idx*3].fd != -1)
+		      {
+			fcntl(pfd[idx*3].fd, F_SETFL, O_NONBLOCK);
+			if (input_request != NULL)
+			  {
+			    pfd[idx*3].events = 0;
+			    children[idx].iwait = 1;
+			  }
+			else
+			  {
+			    pfd[idx*3].events = POLLOUT;
+			    if (input_first.tv_sec == 0)
+				input_first = children[idx].start;
+			  }
+		      }
 		    pfd[idx*3+1].events = POLLIN;
 		    pfd[idx*3+2].events = POLLIN;
 
+		    running[POOL_CMD] += 1;
 		    dprint("%s, phase 3: pid = %d (idx=%d) %d/%d/%d",
 			   target_getname(), children[idx].pid, idx,
 			   pfd[idx*3].fd, pfd[idx*3+1].fd, pfd[idx*3+2].fd);
@@ -1251,7 +2916,9 @@ u_int ctimeout, utest;
 		  }
 
 		/* Spawn phase 2 ready last */
-		if (idx > 0 && children[idx].pid <= 0 && target_next(2) == 0)
+		if (idx > 0 && children[idx].pid <= 0
+		    && (test == 0 || pool_full(POOL_TEST) == 0)
+		    && target_next(2) == 0)
 		  {
 		    if (test == 0)
 		      {
@@ -1282,6 +2949,8 @@ u_int ctimeout, utest;
 		    if (children[idx].pid == -1)
 		      {
 			/* Error message was given by exec() */
+			if (retry("spawn failed", 0) == 0)
+			    continue;
 			eprint("Fatal error for %s", target_getname());
 			target_result(-1);
 			continue;
@@ -1292,6 +2961,7 @@ u_int ctimeout, utest;
 
 		    init_child(&(children[idx]));
 		    children[idx].test = 1;
+		    running[POOL_TEST] += 1;
 		    dprint("%s, phase 2: pid = %d (idx=%d) %d/%d/%d",
 			   target_getname(), children[idx].pid, idx,
 			   pfd[idx*3].fd, pfd[idx*3+1].fd,pfd[idx*3+2].fd);
@@ -1350,6 +3020,17 @@ u_int ctimeout, utest;
                 ** or dead but with open fds (probably alive grandchildren),
                 ** timeout exceeded?
                 */
+		if (children[idx].idle != 0 && children[idx].timedout == 0
+		    && time(NULL) > children[idx].idle)
+		  {
+		    /* No output for too long, escalate from here */
+		    iprint("No output from %s for %s (Sending SIGTERM)..", what,
+			   unit_rtime(idle_timeout));
+		    kill(-children[idx].pid, SIGTERM);
+		    children[idx].timeout = time(NULL) + 5;
+		    children[idx].timedout = 1;
+		    children[idx].killed = KILL_IDLE;
+		  }
 		if (children[idx].timeout != 0
 		    && time(NULL) > children[idx].timeout)
 		  {
@@ -1435,7 +3116,7 @@ u_int ctimeout, utest;
 	    */
 	    if (pfd[idx*3].fd != -1)
 	      {
-		/* Time to close stdin (which we don't use for now anyways) */
+		/* Time to close stdin, the command didn't read it all */
 		if (idx != 0)
 		  {
 		    close(pfd[idx*3].fd);
@@ -1496,8 +3177,24 @@ u_int ctimeout, utest;
 		if (target_setbynum(children[idx].num) != 0)
 		    abort();
 
+	    /* Transport failure to be retried? */
+	    retried = deferred = 0;
+	    if (idx > 0 && children[idx].analyzer == 0 && retry_max > 0)
+	      {
+		char *why;
+
+		why = transport_failure(&(children[idx]), status);
+		if (why != NULL && retry(why, children[idx].test == 0) == 0)
+		  {
+		    retried = 1;
+		    retry_files(&(children[idx]), outmode & OUT_COPY);
+		  }
+	      }
+
 	    /* Check and optionally report the exit status */
-	    if (WIFEXITED(status) != 0)
+	    if (retried == 1)
+		; /* Not the final attempt, nothing to report */
+	    else if (WIFEXITED(status) != 0)
 	      {
 		if (children[idx].test == 1)
 		    dprint("Test for %s exited with status %d",
@@ -1506,6 +3203,7 @@ u_int ctimeout, utest;
 		  {
 		    dprint("Analyzer for %s exited with status %d",
 			   what, WEXITSTATUS(status));
+		    memo_put(children[idx].num, WEXITSTATUS(status) != 0, NULL);
 		    if (WEXITSTATUS(status) == 0)
 		      {
 			iprint("Analysis of %s output indicates a success", what);
@@ -1527,6 +3225,8 @@ u_int ctimeout, utest;
 		  } 
 		else if (children[idx].execstate == 0)
 		  {
+		    memo_done(children[idx].num, WEXITSTATUS(status));
+
 		    /* save exit status */
 		    if ((outmode & OUT_COPY) != 0)
 		      {
@@ -1561,7 +3261,15 @@ u_int ctimeout, utest;
 		      }
 		    else
 		      {
-			if (utest == ANALYZE_NONE || utest == ANALYZE_RUN)
+			if (utest == ANALYZE_NONE
+			    && (children[idx].output & OUT_ERR) != 0)
+			  {
+			    /* See gather_close() */
+			    eprint("Output of %s is incomplete", what);
+			    set_cmdstatus(CMD_ERROR);
+			  }
+			else if (utest == ANALYZE_NONE || utest == ANALYZE_RUN
+			    || utest == ANALYZE_COPROC)
 			    set_cmdstatus(CMD_SUCCESS);
 			else if (utest == ANALYZE_LNRE
 				 || utest == ANALYZE_LNPCRE)
@@ -1573,39 +3281,79 @@ u_int ctimeout, utest;
 			  }
 			else
 			  {
+			    char msg[256];
+			    void *wa;
+			    int bad;
+
 			    /*
 			    ** Analyze the output to tell success from failure
-			    ** based on user supplied criteria.
+			    ** based on user supplied criteria (unless it was
+			    ** done as the output came, or for the same output
+			    ** earlier).
 			    */
-			    if (analyzer_run(utest,
-					     children[idx].ofile,
-					     children[idx].ofname,
-					     children[idx].efile,
-					     children[idx].efname) == 0)
+			    msg[0] = '\0';
+			    bad = -1;
+			    wa = NULL;
+			    if (children[idx].analysis != NULL)
 			      {
-				iprint("Analysis of %s output indicates a success", what);
-				set_cmdstatus(CMD_SUCCESS);
+				bad = analyzer_close(children[idx].analysis);
+				children[idx].analysis = NULL;
 			      }
+			    else if (memo_get(children[idx].num, &bad,
+					      msg, sizeof(msg)) == 1)
+				;
 			    else
+				wa = analyzer_map(utest,
+						  children[idx].ofile,
+						  children[idx].ofname,
+						  children[idx].efile,
+						  children[idx].efname,
+						  WEXITSTATUS(status));
+
+			    /*
+			    ** Large outputs are left to the analysis threads,
+			    ** and verdicts then queue up behind them so they
+			    ** are still reported in order.
+			    */
+			    if (apool_nfds() > 0
+				&& (apool_pending() > 0
+				    || (wa != NULL
+					&& analyzer_size(wa) >= ANALYSIS_ASYNC)))
 			      {
-				eprint("Analysis of %s output indicates an error", what);
-				if ((children[idx].output & OUT_IFERR) != 0)
+				struct handback *hb;
+
+				/* Along with the output files, see below. */
+				hb = (struct handback *)
+				    malloc(sizeof(struct handback));
+				if (hb == NULL)
 				  {
-				    output_show(what, children[idx].ofile,
-						children[idx].ofname, 1);
-				    output_show(what, children[idx].efile,
-						children[idx].ofname, 2);
+				    perror("malloc failed");
+				    exit(RC_FATAL);
 				  }
-				set_cmdstatus(CMD_ERROR);
+				hb->kid = children[idx];
+				hb->kid.status = status;
+				hb->bad = bad;
+				strcpy(hb->msg, msg);
+				children[idx].ofile = -1;
+				children[idx].efile = -1;
+				apool_submit(wa, hb);
+				deferred = 1;
+			      }
+			    else
+			      {
+				if (wa != NULL)
+				  {
+				    analyzer_match(wa);
+				    bad = analyzer_unmap(wa, msg, sizeof(msg));
+				    if (bad != -1)
+					memo_put(children[idx].num, bad, msg);
+				  }
+				analysis_verdict(what, &(children[idx]), bad,
+						 msg);
 			      }
 			  }
-			if (byteset_test(BSET_SHOW, WEXITSTATUS(status)) == 0)
-			    tprint(myname, MSG_STDOUT,
-				   "Child for %s exited with status %d",
-				   what, WEXITSTATUS(status));
-			else
-			    iprint("Child for %s exited (with status %d)",
-				   what, WEXITSTATUS(status));
+			if (deferred == 0)
+			    exit_shown(what, WEXITSTATUS(status));
 		      }
 		  }
 		else
@@ -1626,11 +3374,30 @@ u_int ctimeout, utest;
 		  }
 	      } else {
 		assert( WTERMSIG(status) != 0 );
-		if (WTERMSIG(status) == SIGALRM
+		if (children[idx].killed == KILL_ERROR)
+		  {
+		    /* Error was already reported, see output_error() */
+		    iprint("Child for %s was killed (%s)",
+			   what, strsignal(WTERMSIG(status)));
+		    set_cmdstatus(CMD_ERROR);
+		  }
+		else if (WTERMSIG(status) == SIGALRM
 		    || (children[idx].timedout > 0
 			&& (WTERMSIG(status) == SIGTERM
 			    || WTERMSIG(status) == SIGKILL)))
-		    if (children[idx].test == 0)
+		    if (children[idx].killed == KILL_IDLE)
+		      {
+			eprint("Child for %s was idle for too long (%s)",
+			       what, strsignal(WTERMSIG(status)));
+			set_cmdstatus(CMD_IDLE);
+		      }
+		    else if (children[idx].killed == KILL_OUTPUT)
+		      {
+			eprint("Child for %s produced too much output (%s)",
+			       what, strsignal(WTERMSIG(status)));
+			set_cmdstatus(CMD_ERROR);
+		      }
+		    else if (children[idx].test == 0)
 		      {
 			eprint("%s for %s timed out (%s)",
 			       (children[idx].analyzer == 0) ? "Child"
@@ -1659,6 +3426,37 @@ u_int ctimeout, utest;
 
 	    /* mark the slot as free */
 	    children[idx].pid = 0;
+	    if (children[idx].analysis != NULL)
+	      {
+		/* Not needed after all */
+		analyzer_close(children[idx].analysis);
+		children[idx].analysis = NULL;
+	      }
+	    if (idx > 0)
+	      {
+		if (children[idx].test == 1)
+		    running[POOL_TEST] -= 1;
+		else if (children[idx].analyzer == 1)
+		    running[POOL_ANALYZER] -= 1;
+		else
+		    running[POOL_CMD] -= 1;
+		if (children[idx].analyzer == 0)
+		    adapt_result(children[idx].seq,
+				 child_healthy(&(children[idx]), status));
+		/* Only complete runs count, not those cut short (-K) */
+		if (children[idx].test == 0 && children[idx].analyzer == 0
+		    && children[idx].killed == 0
+		    && child_healthy(&(children[idx]), status) != 0)
+		  {
+		    struct timeval now;
+
+		    gettimeofday(&now, NULL);
+		    history_update(children[idx].num,
+				   (now.tv_sec - children[idx].start.tv_sec)
+				   + (now.tv_usec - children[idx].start.tv_usec)
+				   / 1000000.0);
+		  }
+	      }
 
 	    if (idx == 0)
               {
@@ -1669,7 +3467,7 @@ u_int ctimeout, utest;
                     target_result(1);
                   }
               }
-	    else
+	    else if (retried == 0 && deferred == 0)
 	      {
 		if (children[idx].execstate != 0
 		    || (children[idx].test == 1 && children[idx].passed != 1))
@@ -1689,12 +3487,23 @@ u_int ctimeout, utest;
 	    /* Don't increment idx, catch it at the top again */
 	  }
 
+	/* Targets waiting to be retried? */
+	if (done == 1 && target_waiting() > 0 && spawn_mode != SPAWN_QUIT)
+	    done = 0;
+	/* or for a verdict? */
+	if (done == 1 && (coproc_pending() > 0 || apool_pending() > 0))
+	    done = 0;
+
 	if (done == 1)
 	    break;
       }
 
-    /* Restore saved SIGINT handler */
+    /* Restore saved SIGINT and SIGPIPE handlers */
     sigaction(SIGINT, &saved_sa, NULL);
+    sigaction(SIGPIPE, &saved_pipe, NULL);
+
+    coproc_end();
+    apool_end();
 
     free(children); /* XXX Leak */
     free(pfd);
@@ -1709,3 +3518,37 @@ u_int ctimeout, utest;
       default:          return RC_OK;
       }
 }
+
+#if defined(BENCH)
+static struct child bench_kid;
+
+/*
+** bench_parse_reset
+**	(Re)initialize the child structure used by bench_parse_child()
+*/
+void
+bench_parse_reset(output, fd)
+int output, fd;
+{
+    if (bench_kid.obuf != NULL)
+	free(bench_kid.obuf);
+    if (bench_kid.ebuf != NULL)
+	free(bench_kid.ebuf);
+    memset((void *) &bench_kid, 0, sizeof(bench_kid));
+    bench_kid.output = output;
+    bench_kid.ofile = bench_kid.efile = fd;
+    bench_kid.status = -1;
+}
+
+/*
+** bench_parse_child
+**	Public entry point to parse_child() for bench.c
+*/
+void
+bench_parse_child(analyzer, std, buffer)
+int analyzer, std;
+char *buffer;
+{
+    parse_child("bench", 0, 0, analyzer, &bench_kid, std, buffer);
+}
+#endif
@@ -17,6 +17,14 @@
 #define OUT_IFERR 0x20	/* Output only displayed on error */
 #define OUT_ERR   0x40	/* Error found in output */
 
+void loop_retry(char *);
+void loop_pools(char *);
+void loop_idle(u_int);
+void loop_caps(u_long, u_long, u_long, int);
+char *loop_input(char *, size_t *);
+void loop_ondemand(char *);
+void loop_report(void);
+void loop_errkill(char *);
 int loop(char *, u_int, int, char *, int, int, char *, u_int, char *, int);
 
 #endif
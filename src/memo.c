@@ -0,0 +1,303 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include "memo.h"
+#include "target.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+/*
+** Memoized analyzer verdicts (-Z): with many targets, most outputs tend
+** to be identical, and so are the verdicts of the analyzers looking at
+** the whole output (or of the programs they run).  The output of each
+** target is hashed as it arrives, and verdicts are remembered for the
+** duration of the run, keyed by the hashes (and lengths) of the standard
+** output and standard error output, along with the exit code.  (The
+** analyzer configuration can't change during a run.)  Two different hash
+** functions are used for each output to make collisions unlikely enough.
+*/
+#define MEMO_BUCKETS	256	/* Initial hash table size */
+
+struct key
+{
+    u_int	fnv[2], sdbm[2];	/* stdout, stderr hashes */
+    u_long	len[2];			/* stdout, stderr lengths */
+    int		status;			/* exit code */
+};
+
+struct verdict
+{
+    struct key	key;
+    int		bad;		/* 0: success, 1: error */
+    char	*msg;		/* explanation, if any */
+    struct verdict *next;
+};
+
+static int enabled;
+static struct key *keys;	/* for each target */
+static char *done;		/* key complete for each target? */
+static struct verdict **table;
+static u_int buckets, entries;
+static u_int lookups, hits;
+
+static u_int bucket(struct key *);
+static int   same(struct key *, struct key *);
+static void  grow(void);
+
+/*
+** memo_init
+**	Remember analyzer verdicts.
+*/
+void
+memo_init(void)
+{
+    enabled = 1;
+}
+
+/*
+** memo_enabled
+**	Are verdicts remembered?
+*/
+int
+memo_enabled(void)
+{
+    return enabled;
+}
+
+/*
+** memo_start
+**	The command was started on a target, start hashing its output.
+*/
+void
+memo_start(num)
+int num;
+{
+    struct key *k;
+
+    if (enabled == 0)
+	return;
+
+    if (keys == NULL)
+      {
+	keys = (struct key *) malloc(target_getmax() * sizeof(struct key));
+	done = (char *) malloc(target_getmax());
+	table = (struct verdict **) malloc(MEMO_BUCKETS
+					   * sizeof(struct verdict *));
+	if (keys == NULL || done == NULL || table == NULL)
+	  {
+	    perror("malloc failed");
+	    exit(RC_FATAL);
+	  }
+	memset((void *) done, 0, target_getmax());
+	memset((void *) table, 0, MEMO_BUCKETS * sizeof(struct verdict *));
+	buckets = MEMO_BUCKETS;
+      }
+
+    k = &(keys[num]);
+    k->fnv[0] = k->fnv[1] = 2166136261U;
+    k->sdbm[0] = k->sdbm[1] = 0;
+    k->len[0] = k->len[1] = 0;
+    k->status = 0;
+    done[num] = 0;
+}
+
+/*
+** memo_feed
+**	Hash output from a target, std being 1 for stdout and 2 for stderr.
+*/
+void
+memo_feed(num, std, buf, len)
+int num, std;
+char *buf;
+size_t len;
+{
+    struct key *k;
+    u_int fnv, sdbm;
+    u_char *p, *end;
+
+    if (enabled == 0)
+	return;
+
+    assert( std == 1 || std == 2 );
+    k = &(keys[num]);
+    fnv = k->fnv[std-1];
+    sdbm = k->sdbm[std-1];
+    end = (u_char *) buf + len;
+    for (p = (u_char *) buf; p < end; p++)
+      {
+	fnv = (fnv ^ *p) * 16777619U;
+	sdbm = *p + (sdbm << 6) + (sdbm << 16) - sdbm;
+      }
+    k->fnv[std-1] = fnv & 0xffffffffU;
+    k->sdbm[std-1] = sdbm & 0xffffffffU;
+    k->len[std-1] += len;
+}
+
+/*
+** memo_done
+**	The command completed on a target, with the given exit code.
+*/
+void
+memo_done(num, status)
+int num, status;
+{
+    if (enabled == 0)
+	return;
+
+    keys[num].status = status;
+    done[num] = 1;
+}
+
+/*
+** memo_get
+**	Look for the verdict for a target's output.  Returns 1 (and the
+**	verdict) if found, 0 otherwise.
+*/
+int
+memo_get(num, bad, msg, msglen)
+int num, *bad;
+char *msg;
+size_t msglen;
+{
+    struct verdict *v;
+
+    if (enabled == 0 || done[num] == 0)
+	return 0;
+
+    lookups += 1;
+    for (v = table[bucket(&(keys[num]))]; v != NULL; v = v->next)
+	if (same(&(v->key), &(keys[num])) != 0)
+	  {
+	    hits += 1;
+	    *bad = v->bad;
+	    msg[0] = '\0';
+	    if (v->msg != NULL)
+	      {
+		strncpy(msg, v->msg, msglen - 1);
+		msg[msglen - 1] = '\0';
+	      }
+	    target_setbynum(num);
+	    dprint("Memoized verdict for %s: %d", target_getname(), *bad);
+	    return 1;
+	  }
+    return 0;
+}
+
+/*
+** memo_put
+**	Remember the verdict for a target's output.
+*/
+void
+memo_put(num, bad, msg)
+int num, bad;
+char *msg;
+{
+    struct verdict *v;
+    u_int b;
+
+    if (enabled == 0 || done[num] == 0)
+	return;
+
+    assert( bad == 0 || bad == 1 );
+    b = bucket(&(keys[num]));
+    for (v = table[b]; v != NULL; v = v->next)
+	if (same(&(v->key), &(keys[num])) != 0)
+	    return;	/* Analyzed more than once at the same time */
+
+    v = (struct verdict *) malloc(sizeof(struct verdict));
+    if (v == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    v->key = keys[num];
+    v->bad = bad;
+    v->msg = NULL;
+    if (msg != NULL && msg[0] != '\0' && (v->msg = strdup(msg)) == NULL)
+      {
+	perror("strdup failed");
+	exit(RC_FATAL);
+      }
+    v->next = table[b];
+    table[b] = v;
+    entries += 1;
+    if (entries > buckets)
+	grow();
+}
+
+/*
+** memo_report
+**	Show how many verdicts were memoized, for the final summary.
+*/
+void
+memo_report(void)
+{
+    if (enabled == 0 || lookups == 0)
+	return;
+
+    nprint("Memoized : %u of %u verdicts (%u%%), %u distinct",
+	   hits, lookups, (hits * 100) / lookups, entries);
+}
+
+/*
+** bucket
+**	Hash table bucket for a key.
+*/
+static u_int
+bucket(k)
+struct key *k;
+{
+    return (k->fnv[0] ^ (k->fnv[1] * 31) ^ (u_int) k->status)
+	& (buckets - 1);
+}
+
+/*
+** same
+**	Are two keys the same?
+*/
+static int
+same(a, b)
+struct key *a, *b;
+{
+    return (a->fnv[0] == b->fnv[0] && a->fnv[1] == b->fnv[1]
+	    && a->sdbm[0] == b->sdbm[0] && a->sdbm[1] == b->sdbm[1]
+	    && a->len[0] == b->len[0] && a->len[1] == b->len[1]
+	    && a->status == b->status);
+}
+
+/*
+** grow
+**	Double the size of the hash table.
+*/
+static void
+grow(void)
+{
+    struct verdict **old, *v, *next;
+    u_int i, oldsz;
+
+    old = table;
+    oldsz = buckets;
+    table = (struct verdict **) malloc(2 * oldsz * sizeof(struct verdict *));
+    if (table == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    memset((void *) table, 0, 2 * oldsz * sizeof(struct verdict *));
+    buckets = 2 * oldsz;
+    for (i = 0; i < oldsz; i++)
+	for (v = old[i]; v != NULL; v = next)
+	  {
+	    next = v->next;
+	    v->next = table[bucket(&(v->key))];
+	    table[bucket(&(v->key))] = v;
+	  }
+    free(old);
+}
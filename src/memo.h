@@ -0,0 +1,22 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_MEMO_H_)
+# define _MEMO_H_
+
+void memo_init(void);
+int  memo_enabled(void);
+void memo_start(int);
+void memo_feed(int, int, char *, size_t);
+void memo_done(int, int);
+int  memo_get(int, int *, char *, size_t);
+void memo_put(int, int, char *);
+void memo_report(void);
+
+#endif
@@ -0,0 +1,665 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "analyzer.h"
+#include "byteset.h"
+#include "coproc.h"
+#include "offline.h"
+#include "status.h"
+#include "target.h"
+#include "term.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Offline re-analysis (-x): no command is run, the outputs saved by an
+** earlier run in the output directory are analyzed again, with the -a/-A
+** and -e options given this time.  Targets are split between worker
+** processes (no more than there are processors, unless the analyzer is
+** an external program) which send their verdicts back over a pipe; the
+** results are then reported in the order the targets were given.
+*/
+
+/* What was found for a target */
+#define V_LOST		0	/* worker went away */
+#define V_MISSING	1	/* no exit status saved */
+#define V_EXIT		2	/* exit status indicates an error */
+#define V_PENDING	3	/* left to the analyzer co-processes */
+#define V_ANALYZED	4	/* analyzed */
+
+/* Sent by the workers, small enough for writes to be atomic */
+struct verdict
+{
+    int		num;		/* target number */
+    int		what;		/* V_* */
+    int		status;		/* saved exit status */
+    int		bad;		/* analyzer verdict */
+    char	msg[256];	/* optional explanation */
+};
+
+/* Kept by the parent */
+struct result
+{
+    char	what;		/* V_* */
+    char	bad;		/* analyzer verdict */
+    u_char	status;		/* saved exit status */
+    char	*msg;		/* optional explanation */
+};
+
+static int  by_name(const void *, const void *);
+static int  exit_status(char *, char *, int *);
+static int  open_output(char *, char *, char *, char **);
+static int  analyze_lines(u_int, u_int, int, char *);
+static int  analyze_run(char *, char *);
+static void analyze(char *, u_int, int, struct verdict *);
+static void worker(int, int, int, char *, u_int);
+static int  get_verdict(int, struct verdict *);
+static void coprocs(char *, struct result *, int);
+
+/*
+** by_name
+**	qsort() helper: target names.
+*/
+static int
+by_name(a, b)
+const void *a, *b;
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+** offline_targets
+**	Add the targets found in the output directory, in alphabetical
+**	order.  Returns the length of the longest name.
+*/
+int
+offline_targets(odir)
+char *odir;
+{
+    DIR *dir;
+    struct dirent *de;
+    char **names;
+    int count, size, longest, i;
+
+    dir = opendir(odir);
+    if (dir == NULL)
+      {
+	fprintf(stderr, "%s: opendir(%s): %s\n", myname, odir,
+		strerror(errno));
+	exit(RC_ERROR);
+      }
+
+    names = NULL;
+    count = size = 0;
+    while ((de = readdir(dir)) != NULL)
+      {
+	size_t len;
+
+	len = strlen(de->d_name);
+	if (de->d_name[0] == '.' || len <= 5
+	    || strcmp(de->d_name + len - 5, ".exit") != 0)
+	    continue;
+	if (count == size)
+	  {
+	    size = (size == 0) ? 64 : size * 2;
+	    names = (char **) realloc(names, size * sizeof(char *));
+	    if (names == NULL)
+	      {
+		perror("realloc failed");
+		exit(RC_ERROR);
+	      }
+	  }
+	names[count] = strdup(de->d_name);
+	if (names[count] == NULL)
+	  {
+	    perror("strdup failed");
+	    exit(RC_ERROR);
+	  }
+	names[count++][len - 5] = '\0';
+      }
+    closedir(dir);
+
+    if (count > 0)
+	qsort(names, count, sizeof(char *), by_name);
+    longest = 0;
+    for (i = 0; i < count; i++)
+      {
+	int length;
+
+	length = target_add(names[i]);
+	if (length > longest)
+	    longest = length;
+	free(names[i]);
+      }
+    free(names);
+    return longest;
+}
+
+/*
+** exit_status
+**	Read the exit status saved for a target.
+*/
+static int
+exit_status(odir, target, status)
+char *odir, *target;
+int *status;
+{
+    char fname[PATH_MAX], buf[16];
+    int fd, sz;
+
+    snprintf(fname, sizeof(fname), "%s/%s.exit", odir, target);
+    fd = open(fname, O_RDONLY, 0);
+    if (fd == -1)
+	return -1;
+    sz = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (sz <= 0)
+	return -1;
+    buf[sz] = '\0';
+    buf[strcspn(buf, "\r\n")] = '\0';
+    if (buf[0] == '\0' || strspn(buf, "0123456789") != strlen(buf)
+	|| atoi(buf) > 255)
+	return -1;
+    *status = atoi(buf);
+    return 0;
+}
+
+/*
+** open_output
+**	Open one of the saved outputs of a target.
+*/
+static int
+open_output(odir, target, extension, fname)
+char *odir, *target, *extension, **fname;
+{
+    int fd;
+
+    *fname = (char *) malloc(PATH_MAX);
+    if (*fname == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    snprintf(*fname, PATH_MAX, "%s/%s.%s", odir, target, extension);
+    /* analyzer_run() needs to append (and then remove) a NUL */
+    fd = open(*fname, O_RDWR, 0);
+    if (fd == -1)
+      {
+	eprint("open(%s): %s", *fname, strerror(errno));
+	free(*fname);
+	*fname = NULL;
+      }
+    return fd;
+}
+
+/*
+** analyze_lines
+**	Feed a saved output to the line based analyzer, one line at a time,
+**	the way loop() does as the output comes.
+*/
+static int
+analyze_lines(type, what, fd, fname)
+u_int type, what;
+int fd;
+char *fname;
+{
+    struct stat sb;
+    char *buf, *start, *nl, *eol;
+    ssize_t sz;
+    size_t len;
+    int bad;
+
+    if (fstat(fd, &sb) == -1)
+      {
+	eprint("fstat(%s): %s", fname, strerror(errno));
+	return -1;
+      }
+    buf = (char *) malloc(sb.st_size + 1);
+    if (buf == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    len = 0;
+    while (len < (size_t) sb.st_size
+	   && (sz = read(fd, buf + len, sb.st_size - len)) > 0)
+	len += sz;
+    if (len < (size_t) sb.st_size)
+      {
+	eprint("read(%s): %s", fname, strerror(errno));
+	free(buf);
+	return -1;
+      }
+    buf[len] = '\0';
+
+    bad = 0;
+    start = buf;
+    while (bad == 0 && start < buf + len)
+      {
+	nl = memchr(start, '\n', buf + len - start);
+	if (nl == NULL)
+	    nl = buf + len;
+	/* Trim \r\n, just like parse_child() */
+	if (nl > start && *(nl-1) == '\r')
+	    eol = nl - 1;
+	else
+	    eol = nl;
+	*eol = '\0';
+	if (analyzer_lnrun(type, what, start, eol - start) != 0)
+	    bad = 1;
+	start = nl + 1;
+      }
+
+    free(buf);
+    return bad;
+}
+
+/*
+** analyze_run
+**	Run the external analyzer for a target, its output going wherever
+**	ours goes.
+*/
+static int
+analyze_run(odir, target)
+char *odir, *target;
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid == -1)
+      {
+	eprint("fork(): %s", strerror(errno));
+	return -1;
+      }
+    if (pid == 0)
+      {
+	char *argv[4], env[PATH_MAX];
+
+	snprintf(env, sizeof(env), "SHMUX_TARGET=%s", target);
+	putenv(env);
+	argv[0] = analyzer_cmd();
+	argv[1] = target;
+	argv[2] = odir;
+	argv[3] = NULL;
+	alarm(analyzer_timeout());
+	execvp(argv[0], argv);
+	fprintf(stderr, "%s: execvp(%s): %s\n", myname, argv[0],
+		strerror(errno));
+	_exit(127);
+      }
+
+    while (waitpid(pid, &status, 0) == -1)
+	if (errno != EINTR)
+	  {
+	    eprint("waitpid(): %s", strerror(errno));
+	    return -1;
+	  }
+    if (WIFEXITED(status) == 0)
+      {
+	eprint("Analyzer for %s killed by signal %d", target,
+	       WTERMSIG(status));
+	return -1;
+      }
+    dprint("Analyzer for %s exited with status %d", target,
+	   WEXITSTATUS(status));
+    return (WEXITSTATUS(status) == 0) ? 0 : 1;
+}
+
+/*
+** analyze
+**	Get the verdict for a target.
+*/
+static void
+analyze(odir, utest, num, v)
+char *odir;
+u_int utest;
+int num;
+struct verdict *v;
+{
+    char *name, *oname, *ename;
+    int ofd, efd;
+
+    if (target_setbynum(num) != 0)
+	abort();
+    name = target_getname();
+
+    memset((void *) v, 0, sizeof(struct verdict));
+    v->num = num;
+    if (exit_status(odir, name, &(v->status)) == -1)
+      {
+	v->what = V_MISSING;
+	return;
+      }
+    if (byteset_test(BSET_ERROR, v->status) == 0)
+      {
+	v->what = V_EXIT;
+	return;
+      }
+
+    v->what = V_ANALYZED;
+    switch (utest)
+      {
+      case ANALYZE_NONE:
+	  v->bad = 0;
+	  return;
+      case ANALYZE_COPROC:
+	  v->what = V_PENDING;
+	  return;
+      case ANALYZE_RUN:
+	  v->bad = analyze_run(odir, name);
+	  return;
+      }
+
+    v->bad = -1;
+    ofd = open_output(odir, name, "stdout", &oname);
+    if (ofd == -1)
+	return;
+    efd = open_output(odir, name, "stderr", &ename);
+    if (efd == -1)
+      {
+	close(ofd);
+	free(oname);
+	return;
+      }
+
+    if (utest == ANALYZE_LNRE || utest == ANALYZE_LNPCRE)
+      {
+	v->bad = analyze_lines(utest, ANALYZE_STDOUT, ofd, oname);
+	if (v->bad == 0)
+	    v->bad = analyze_lines(utest, ANALYZE_STDERR, efd, ename);
+      }
+    else if (utest == ANALYZE_PLUGIN)
+	v->bad = analyzer_plugin(ofd, oname, efd, ename, v->status,
+				 v->msg, sizeof(v->msg));
+    else
+	v->bad = analyzer_run(utest, ofd, oname, efd, ename);
+
+    close(ofd);
+    close(efd);
+    free(oname);
+    free(ename);
+}
+
+/*
+** worker
+**	Analyze every nth target, sending the verdicts to the parent.
+*/
+static void
+worker(fd, first, step, odir, utest)
+int fd, first, step;
+char *odir;
+u_int utest;
+{
+    struct verdict v;
+    int num, max;
+
+    max = target_getmax();
+    for (num = first; num < max; num += step)
+      {
+	analyze(odir, utest, num, &v);
+	if (write(fd, (void *) &v, sizeof(v)) != sizeof(v))
+	  {
+	    eprint("write(): %s", strerror(errno));
+	    break;
+	  }
+      }
+    close(fd);
+    fflush(NULL);
+    _exit(RC_OK);
+}
+
+/*
+** get_verdict
+**	Read the next verdict sent by the workers, returns 0 once they're
+**	all done.
+*/
+static int
+get_verdict(fd, v)
+int fd;
+struct verdict *v;
+{
+    size_t len;
+    ssize_t sz;
+
+    len = 0;
+    while (len < sizeof(struct verdict))
+      {
+	sz = read(fd, ((char *) v) + len, sizeof(struct verdict) - len);
+	if (sz == -1 && errno == EINTR)
+	    continue;
+	if (sz <= 0)
+	  {
+	    if (sz == -1)
+		eprint("read(): %s", strerror(errno));
+	    return 0;
+	  }
+	len += sz;
+      }
+    return 1;
+}
+
+/*
+** coprocs
+**	Get the verdicts of the analyzer co-processes.
+*/
+static void
+coprocs(odir, results, max)
+char *odir;
+struct result *results;
+int max;
+{
+    struct pollfd *pfd;
+    char *msg;
+    int num, bad;
+
+    coproc_start(analyzer_cmd(), analyzer_procs());
+    pfd = (struct pollfd *) malloc(coproc_nfds() * sizeof(struct pollfd));
+    if (pfd == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+
+    for (num = 0; num < max; num++)
+      {
+	if (results[num].what != V_PENDING)
+	    continue;
+	if (target_setbynum(num) != 0)
+	    abort();
+	/* Considered a failure unless a verdict comes */
+	results[num].what = V_ANALYZED;
+	results[num].bad = -1;
+	coproc_send(num, target_getname(), odir);
+      }
+
+    while (coproc_pending() > 0)
+      {
+	coproc_poll(pfd);
+	if (poll(pfd, coproc_nfds(), -1) == -1)
+	  {
+	    if (errno == EINTR)
+		continue;
+	    eprint("poll(): %s", strerror(errno));
+	    break;
+	  }
+	while ((msg = coproc_input(pfd, &num, &bad)) != NULL)
+	  {
+	    results[num].bad = bad;
+	    if (msg[0] != '\0' && (results[num].msg = strdup(msg)) == NULL)
+	      {
+		perror("strdup failed");
+		exit(RC_FATAL);
+	      }
+	  }
+      }
+
+    coproc_end();
+    free(pfd);
+}
+
+/*
+** offline
+**	Analyze again the outputs saved in odir.
+*/
+int
+offline(odir, max, utest)
+char *odir;
+int max;
+u_int utest;
+{
+    struct result *results;
+    struct verdict v;
+    pid_t *pids;
+    int count, workers, fds[2], i, num;
+
+    count = target_getmax();
+    workers = max;
+#if defined(_SC_NPROCESSORS_ONLN)
+    if (utest != ANALYZE_RUN)
+      {
+	long cpus;
+
+	/* CPU bound, no point in having more workers than processors */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && workers > cpus)
+	    workers = cpus;
+      }
+#endif
+    if (workers > count)
+	workers = count;
+
+    results = (struct result *) malloc(count * sizeof(struct result));
+    pids = (pid_t *) malloc(workers * sizeof(pid_t));
+    if (results == NULL || pids == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_FATAL);
+      }
+    memset((void *) results, 0, count * sizeof(struct result));
+
+    status_init(0, 0, utest != ANALYZE_NONE);
+
+    if (pipe(fds) == -1)
+      {
+	eprint("pipe(): %s", strerror(errno));
+	return RC_FATAL;
+      }
+    fflush(NULL);
+    for (i = 0; i < workers; i++)
+      {
+	pids[i] = fork();
+	if (pids[i] == -1)
+	  {
+	    eprint("fork(): %s", strerror(errno));
+	    break;
+	  }
+	if (pids[i] == 0)
+	  {
+	    close(fds[0]);
+	    worker(fds[1], i, workers, odir, utest);
+	  }
+      }
+    if (i < workers)
+      {
+	/* Can't do without all of them */
+	while (--i >= 0)
+	    kill(pids[i], SIGKILL);
+	workers = 0;
+      }
+    close(fds[1]);
+    dprint("%d offline workers for %d targets", workers, count);
+
+    while (get_verdict(fds[0], &v) == 1)
+      {
+	assert( v.num >= 0 && v.num < count );
+	results[v.num].what = v.what;
+	results[v.num].status = v.status;
+	results[v.num].bad = v.bad;
+	v.msg[sizeof(v.msg) - 1] = '\0';
+	if (v.msg[0] != '\0' && (results[v.num].msg = strdup(v.msg)) == NULL)
+	  {
+	    perror("strdup failed");
+	    exit(RC_FATAL);
+	  }
+      }
+    close(fds[0]);
+    for (i = 0; i < workers; i++)
+	while (waitpid(pids[i], NULL, 0) == -1 && errno == EINTR)
+	    ;
+    free(pids);
+
+    if (utest == ANALYZE_COPROC)
+	coprocs(odir, results, count);
+
+    /* Report, in order */
+    for (num = 0; num < count; num++)
+      {
+	struct result *r;
+	char *name, *msg;
+
+	if (target_setbynum(num) != 0)
+	    abort();
+	name = target_getname();
+	r = &(results[num]);
+	msg = (r->msg != NULL) ? r->msg : "";
+
+	switch (r->what)
+	  {
+	  case V_MISSING:
+	      eprint("No saved exit status for %s", name);
+	      target_restore(3, CMD_FAILURE);
+	      break;
+	  case V_EXIT:
+	      eprint("Child for %s exited with status %d", name, r->status);
+	      target_restore(4, CMD_ERROR);
+	      break;
+	  case V_ANALYZED:
+	      if (r->bad == -1)
+		{
+		  eprint("Fatal error for %s output analysis", name);
+		  target_restore(4, CMD_FAILURE);
+		  break;
+		}
+	      if (r->bad == 0)
+		{
+		  if (utest != ANALYZE_NONE)
+		      iprint("Analysis of %s output indicates a success%s%s", name, (msg[0] != '\0') ? ": " : "", msg);
+		  target_restore(4, CMD_SUCCESS);
+		}
+	      else
+		{
+		  eprint("Analysis of %s output indicates an error%s%s", name, (msg[0] != '\0') ? ": " : "", msg);
+		  target_restore(4, CMD_ERROR);
+		}
+	      if (byteset_test(BSET_SHOW, r->status) == 0)
+		  tprint(myname, MSG_STDOUT,
+			 "Child for %s exited with status %d",
+			 name, r->status);
+	      break;
+	  default:
+	      eprint("Fatal error for %s", name);
+	      target_restore(4, CMD_FAILURE);
+	      break;
+	  }
+	free(r->msg);
+      }
+    free(results);
+
+    return RC_OK;
+}
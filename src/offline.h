@@ -0,0 +1,16 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_OFFLINE_H_)
+# define _OFFLINE_H_
+
+int offline_targets(char *);
+int offline(char *, int, u_int);
+
+#endif
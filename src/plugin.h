@@ -0,0 +1,57 @@
+/*
+** Copyright (C) 2003 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_PLUGIN_H_)
+# define _PLUGIN_H_
+
+/*
+** Analyzer plugins (-a plugin): a shared object loaded by shmux, which
+** analyzes the output of each target from within shmux, rather than in
+** a separate process like the "run" analyzer.  The following functions
+** may be exported:
+**
+**	int shmux_analyzer_init(int version, const char *arg)
+**		Optional, called once when shmux starts, with
+**		SHMUX_PLUGIN_VERSION and the second -A argument (or NULL).
+**		Returns 0 unless the plugin can't be used.
+**
+**	int shmux_analyzer_analyze(const char *target, int status,
+**				   const struct shmux_output *out,
+**				   const struct shmux_output *err,
+**				   char *msg, size_t msglen)
+**		Called once the command completes on a target, unless its
+**		exit status indicates an error (see -e).  The outputs are
+**		only valid until the function returns.  Returns 0 if the
+**		command was successful, 1 if not, and -1 if the analysis
+**		failed.  An explanation may be left in msg.  For large
+**		outputs, this is called from a separate thread, but never
+**		concurrently.
+**
+**	void shmux_analyzer_finish(void)
+**		Optional, called before shmux exits.
+*/
+
+#include <sys/types.h>
+
+#define SHMUX_PLUGIN_VERSION	1
+
+struct shmux_output
+{
+    const char	*data;		/* NUL terminated (may contain other NULs) */
+    size_t	len;		/* not counting the final NUL */
+};
+
+typedef int  shmux_analyzer_init_t(int, const char *);
+typedef int  shmux_analyzer_analyze_t(const char *, int,
+				      const struct shmux_output *,
+				      const struct shmux_output *,
+				      char *, size_t);
+typedef void shmux_analyzer_finish_t(void);
+
+#endif
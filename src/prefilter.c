@@ -0,0 +1,543 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include <ctype.h>
+
+#include "prefilter.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+/*
+** Prefilter for lists of line conditions (lnregex, lnpcre): most
+** expressions can only match a line containing some literal string (e.g.
+** "ermission denied" for "[Pp]ermission denied"), so the literals of all
+** conditions are searched at once (Aho-Corasick), and only the conditions
+** whose literal was found need to be tried.  Conditions without such a
+** literal (e.g. "=.") are always tried.  The literal extraction works for
+** both POSIX extended regular expressions and PCRE, and is conservative:
+** when in doubt, a condition has no literal.
+*/
+#define LIT_MAX		64	/* Longest literal kept */
+
+/* Escaped characters with a special meaning, but no trailing argument */
+#define ESC_SIMPLE	"AbBdDeafGhHnNrRsStvVwWXzZ"
+
+struct literal
+{
+    int		cond;		/* condition number */
+    u_char	*str;
+    size_t	len;
+};
+
+struct prefilter
+{
+    int		count;		/* conditions */
+    struct literal *lits;	/* see required() */
+    int		nlits, slits;
+    int		*always;	/* conditions without a literal, in order */
+    int		nalways;
+    u_short	cls[256];	/* byte classes, 0: not in any literal */
+    int		ncls;
+    int		*delta;		/* automaton: [state * ncls + class] */
+    int		*ofirst, *ocount; /* conditions found in each state */
+    int		*outs;
+    u_int	gen, *stamp;	/* conditions found by the current scan */
+    int		*hits, *cand;
+};
+
+static void *grow(void *, size_t);
+static char *skip_class(char *);
+static char *skip_group(char *);
+static int  required(struct prefilter *, int, char *);
+
+/*
+** grow
+**	realloc() or die trying.
+*/
+static void *
+grow(ptr, size)
+void *ptr;
+size_t size;
+{
+    ptr = realloc(ptr, (size > 0) ? size : 1);
+    if (ptr == NULL)
+      {
+	perror("realloc failed");
+	exit(RC_ERROR);
+      }
+    return ptr;
+}
+
+/*
+** skip_class
+**	Find the end of a bracket expression, returns NULL if unsure.
+*/
+static char *
+skip_class(cp)
+char *cp;
+{
+    char end;
+
+    assert( *cp == '[' );
+
+    cp += 1;
+    if (*cp == '^')
+	cp += 1;
+    if (*cp == ']')
+	cp += 1;
+    while (*cp != ']')
+      {
+	/* A backslash is literal for POSIX, but not for PCRE */
+	if (*cp == '\0' || *cp == '\\')
+	    return NULL;
+	if (cp[0] == '[' && (cp[1] == ':' || cp[1] == '.' || cp[1] == '='))
+	  {
+	    end = cp[1];
+	    cp += 2;
+	    while (*cp != '\0' && (cp[0] != end || cp[1] != ']'))
+		cp += 1;
+	    if (*cp == '\0')
+		return NULL;
+	    cp += 2;
+	  }
+	else
+	    cp += 1;
+      }
+    return cp;
+}
+
+/*
+** skip_group
+**	Find the end of a (possibly nested) group, returns NULL if unsure.
+*/
+static char *
+skip_group(cp)
+char *cp;
+{
+    int depth;
+
+    assert( *cp == '(' );
+
+    depth = 0;
+    while (1)
+      {
+	switch (*cp)
+	  {
+	  case '\0':
+	    return NULL;
+	  case '\\':
+	    cp += 1;
+	    if (*cp == '\0' || *cp == 'Q')
+		return NULL;
+	    break;
+	  case '[':
+	    cp = skip_class(cp);
+	    if (cp == NULL)
+		return NULL;
+	    break;
+	  case '(':
+	    depth += 1;
+	    break;
+	  case ')':
+	    if (--depth == 0)
+		return cp;
+	    break;
+	  }
+	cp += 1;
+      }
+}
+
+/*
+** required
+**	Find a literal which any match of the expression must contain, or
+**	one for each top level alternative.  Groups and bracket expressions
+**	are skipped, and a quantified character ends the literal.  Returns 0
+**	if there isn't one.
+*/
+static int
+required(pf, cond, expr)
+struct prefilter *pf;
+int cond;
+char *expr;
+{
+    u_char run[LIT_MAX], best[LIT_MAX];
+    size_t rlen, blen;
+    char *cp;
+    int first, lit, prevlit;
+
+    first = pf->nlits;
+    rlen = blen = 0;
+    prevlit = 0;
+    for (cp = expr; ; cp++)
+      {
+	if (*cp == '\0' || *cp == '|')
+	  {
+	    /* End of an alternative, keep its longest literal */
+	    if (rlen > blen)
+	      {
+		memcpy(best, run, rlen);
+		blen = rlen;
+	      }
+	    if (blen == 0)
+		break;
+	    if (pf->nlits == pf->slits)
+	      {
+		pf->slits = (pf->slits == 0) ? 32 : pf->slits * 2;
+		pf->lits = grow(pf->lits, pf->slits * sizeof(struct literal));
+	      }
+	    pf->lits[pf->nlits].cond = cond;
+	    pf->lits[pf->nlits].str = grow(NULL, blen);
+	    memcpy(pf->lits[pf->nlits].str, best, blen);
+	    pf->lits[pf->nlits].len = blen;
+	    pf->nlits += 1;
+	    if (*cp == '\0')
+		return 1;
+	    rlen = blen = 0;
+	    prevlit = 0;
+	    continue;
+	  }
+
+	lit = -1;
+	switch (*cp)
+	  {
+	  case '\\':
+	    cp += 1;
+	    if (*cp == '\0')
+		cp = NULL;
+	    else if (isalnum((int) (u_char) *cp) != 0)
+	      {
+		/* \x41, \pL, \k<name>, \Q...\E and the like */
+		if (strchr(ESC_SIMPLE, *cp) == NULL)
+		    cp = NULL;
+	      }
+	    else if (strchr("<>`'", *cp) == NULL) /* GNU anchors */
+		lit = (u_char) *cp;
+	    break;
+	  case '[':
+	    cp = skip_class(cp);
+	    break;
+	  case '(':
+	    /* Options (e.g. "(?i)"), assertions and verbs */
+	    if (cp[1] == '?' || cp[1] == '*')
+		cp = NULL;
+	    else
+		cp = skip_group(cp);
+	    break;
+	  case ')':
+	    cp = NULL;
+	    break;
+	  case '{':
+	    /* Not an interval for PCRE, or not valid for POSIX */
+	    cp += 1 + strspn(cp + 1, "0123456789,");
+	    if (*cp != '}')
+		cp = NULL;
+	    /* FALLTHROUGH */
+	  case '*':
+	  case '?':
+	    /* The previous character is optional */
+	    if (prevlit != 0)
+		rlen -= 1;
+	    break;
+	  case '+':
+	    /* Unless more quantifiers follow (e.g. "a+?" for POSIX) */
+	    if (prevlit != 0 && strcspn(cp + 1, "*?{") < strspn(cp + 1, "*+?{"))
+		rlen -= 1;
+	    break;
+	  case '.':
+	  case '^':
+	  case '$':
+	    break;
+	  default:
+	    lit = (u_char) *cp;
+	    break;
+	  }
+	if (cp == NULL)
+	    break;
+
+	if (lit != -1)
+	  {
+	    prevlit = (rlen < LIT_MAX);
+	    if (prevlit != 0)
+		run[rlen++] = lit;
+	  }
+	else
+	  {
+	    if (rlen > blen)
+	      {
+		memcpy(best, run, rlen);
+		blen = rlen;
+	      }
+	    rlen = 0;
+	    prevlit = 0;
+	  }
+      }
+
+    /* No luck, forget about the other alternatives */
+    while (pf->nlits > first)
+	free(pf->lits[--pf->nlits].str);
+    return 0;
+}
+
+/*
+** prefilter_new
+**	Create an empty prefilter.
+*/
+struct prefilter *
+prefilter_new(void)
+{
+    struct prefilter *pf;
+
+    pf = (struct prefilter *) malloc(sizeof(struct prefilter));
+    if (pf == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    memset(pf, 0, sizeof(struct prefilter));
+    return pf;
+}
+
+/*
+** prefilter_add
+**	Add the next condition of the list.
+*/
+void
+prefilter_add(pf, expr)
+struct prefilter *pf;
+char *expr;
+{
+    pf->always = grow(pf->always, (pf->count + 1) * sizeof(int));
+    if (required(pf, pf->count, expr) == 0)
+	pf->always[pf->nalways++] = pf->count;
+    pf->count += 1;
+}
+
+/*
+** prefilter_build
+**	Build the automaton once all conditions were added, returns 0 if
+**	the prefilter is useless (no literal was found).
+*/
+int
+prefilter_build(pf)
+struct prefilter *pf;
+{
+    int i, s, t, c, nstates, nouts, souts, *fail, *queue, *ohead, *onext;
+    size_t j, total;
+
+    if (pf->nlits == 0)
+	return 0;
+
+    /* Bytes which aren't part of any literal all share class 0 */
+    memset(pf->cls, 0, sizeof(pf->cls));
+    pf->ncls = 1;
+    total = 0;
+    for (i = 0; i < pf->nlits; i++)
+	for (j = 0; j < pf->lits[i].len; j++, total++)
+	    if (pf->cls[pf->lits[i].str[j]] == 0)
+		pf->cls[pf->lits[i].str[j]] = pf->ncls++;
+
+    /* The trie of all literals */
+    pf->delta = (int *) calloc((total + 1) * pf->ncls, sizeof(int));
+    ohead = (int *) malloc((total + 1) * sizeof(int));
+    onext = (int *) malloc(pf->nlits * sizeof(int));
+    if (pf->delta == NULL || ohead == NULL || onext == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    nstates = 1;
+    ohead[0] = -1;
+    for (i = 0; i < pf->nlits; i++)
+      {
+	s = 0;
+	for (j = 0; j < pf->lits[i].len; j++)
+	  {
+	    c = pf->cls[pf->lits[i].str[j]];
+	    if (pf->delta[s * pf->ncls + c] == 0)
+	      {
+		ohead[nstates] = -1;
+		pf->delta[s * pf->ncls + c] = nstates++;
+	      }
+	    s = pf->delta[s * pf->ncls + c];
+	  }
+	onext[i] = ohead[s];
+	ohead[s] = i;
+      }
+
+    /*
+    ** Breadth first, set the failure links, and use them to fill the
+    ** missing transitions so that scanning is one lookup per byte.
+    */
+    fail = (int *) malloc(nstates * sizeof(int));
+    queue = (int *) malloc(nstates * sizeof(int));
+    if (fail == NULL || queue == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    fail[0] = 0;
+    queue[0] = 0;
+    t = 1;
+    for (i = 0; i < t; i++)
+      {
+	s = queue[i];
+	for (c = 0; c < pf->ncls; c++)
+	  {
+	    int next;
+
+	    next = pf->delta[s * pf->ncls + c];
+	    if (next == 0)
+	      {
+		if (s != 0)
+		    pf->delta[s * pf->ncls + c] =
+			pf->delta[fail[s] * pf->ncls + c];
+	      }
+	    else
+	      {
+		fail[next] = (s == 0) ? 0 : pf->delta[fail[s] * pf->ncls + c];
+		queue[t++] = next;
+	      }
+	  }
+      }
+
+    /* Conditions found in each state, including through failure links */
+    pf->ofirst = (int *) malloc(nstates * sizeof(int));
+    pf->ocount = (int *) malloc(nstates * sizeof(int));
+    if (pf->ofirst == NULL || pf->ocount == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    nouts = souts = 0;
+    for (i = 0; i < nstates; i++)
+      {
+	s = queue[i];
+	pf->ofirst[s] = nouts;
+	for (t = ohead[s]; t != -1; t = onext[t])
+	  {
+	    if (nouts == souts)
+	      {
+		souts = (souts == 0) ? 64 : souts * 2;
+		pf->outs = grow(pf->outs, souts * sizeof(int));
+	      }
+	    pf->outs[nouts++] = pf->lits[t].cond;
+	  }
+	for (t = 0; s != 0 && t < pf->ocount[fail[s]]; t++)
+	  {
+	    if (nouts == souts)
+	      {
+		souts = (souts == 0) ? 64 : souts * 2;
+		pf->outs = grow(pf->outs, souts * sizeof(int));
+	      }
+	    pf->outs[nouts++] = pf->outs[pf->ofirst[fail[s]] + t];
+	  }
+	pf->ocount[s] = nouts - pf->ofirst[s];
+      }
+    free(fail);
+    free(queue);
+    free(ohead);
+    free(onext);
+
+    for (i = 0; i < pf->nlits; i++)
+	free(pf->lits[i].str);
+    free(pf->lits);
+    pf->lits = NULL;
+    pf->nlits = pf->slits = 0;
+
+    pf->stamp = (u_int *) calloc(pf->count, sizeof(u_int));
+    pf->hits = (int *) malloc(pf->count * sizeof(int));
+    pf->cand = (int *) malloc(pf->count * sizeof(int));
+    if (pf->stamp == NULL || pf->hits == NULL || pf->cand == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    pf->gen = 0;
+
+    return pf->count - pf->nalways;
+}
+
+/*
+** prefilter_free
+**	Free a prefilter.
+*/
+void
+prefilter_free(pf)
+struct prefilter *pf;
+{
+    int i;
+
+    for (i = 0; i < pf->nlits; i++)
+	free(pf->lits[i].str);
+    free(pf->lits);
+    free(pf->always);
+    free(pf->delta);
+    free(pf->ofirst);
+    free(pf->ocount);
+    free(pf->outs);
+    free(pf->stamp);
+    free(pf->hits);
+    free(pf->cand);
+    free(pf);
+}
+
+/*
+** prefilter_scan
+**	Find which conditions may match a line: *cand is set to the list
+**	of candidates, in order, and their number is returned.
+*/
+int
+prefilter_scan(pf, str, len, cand)
+struct prefilter *pf;
+char *str;
+size_t len;
+int **cand;
+{
+    u_char *cp, *end;
+    int s, i, j, c, a, h, n, *o;
+
+    pf->gen += 1;
+    if (pf->gen == 0)
+      {
+	memset(pf->stamp, 0, pf->count * sizeof(u_int));
+	pf->gen = 1;
+      }
+
+    h = 0;
+    s = 0;
+    for (cp = (u_char *) str, end = cp + len; cp < end; cp++)
+      {
+	s = pf->delta[s * pf->ncls + pf->cls[*cp]];
+	o = pf->outs + pf->ofirst[s];
+	for (i = 0; i < pf->ocount[s]; i++)
+	    if (pf->stamp[o[i]] != pf->gen)
+	      {
+		pf->stamp[o[i]] = pf->gen;
+		pf->hits[h++] = o[i];
+	      }
+      }
+
+    /* Merge with the conditions which are always tried */
+    for (i = 1; i < h; i++)
+      {
+	c = pf->hits[i];
+	for (j = i; j > 0 && pf->hits[j - 1] > c; j--)
+	    pf->hits[j] = pf->hits[j - 1];
+	pf->hits[j] = c;
+      }
+    n = i = a = 0;
+    while (i < h || a < pf->nalways)
+	if (a == pf->nalways || (i < h && pf->hits[i] < pf->always[a]))
+	    pf->cand[n++] = pf->hits[i++];
+	else
+	    pf->cand[n++] = pf->always[a++];
+
+    *cand = pf->cand;
+    return n;
+}
@@ -0,0 +1,21 @@
+/*
+** Copyright (C) 2003 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_PREFILTER_H_)
+# define _PREFILTER_H_
+
+struct prefilter;
+
+struct prefilter *prefilter_new(void);
+void prefilter_add(struct prefilter *, char *);
+int  prefilter_build(struct prefilter *);
+void prefilter_free(struct prefilter *);
+int  prefilter_scan(struct prefilter *, char *, size_t, int **);
+
+#endif
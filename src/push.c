@@ -0,0 +1,131 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include "loop.h"
+#include "push.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Push mode (-u <file>:<path>): the file is fed to all commands (see
+** loop_input()), and the command is ours.  It writes the file next to
+** <path>, checks it with cksum(1), and only then renames it to <path>,
+** so that the file is either all there or not changed at all.  <path> is
+** single quoted, see push_init().
+*/
+#define PUSH_COMMAND	"f=%s; t=\"$f.shmux.$$\"; " \
+    "cat > \"$t\" || { rm -f \"$t\"; exit 1; }; " \
+    "set -- `cksum < \"$t\"`; " \
+    "if [ \"$1 $2\" != '%lu %lu' ]; then rm -f \"$t\"; " \
+    "echo \"shmux: $f: checksum mismatch ($1 $2)\" >&2; exit 1; fi; " \
+    "mv -f \"$t\" \"$f\""
+
+/*
+** push_cksum
+**	POSIX cksum(1) CRC of a buffer.
+*/
+u_long
+push_cksum(buf, len)
+char *buf;
+size_t len;
+{
+    static u_int table[256];
+    u_int crc;
+    size_t i, n;
+
+    if (table[1] == 0)
+	for (i = 0; i < 256; i++)
+	  {
+	    crc = i << 24;
+	    for (n = 0; n < 8; n++)
+		crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+	    table[i] = crc;
+	  }
+
+    crc = 0;
+    for (i = 0; i < len; i++)
+	crc = (crc << 8) ^ table[((crc >> 24) ^ (u_char) buf[i]) & 0xFF];
+    /* followed by the length, least significant byte first */
+    for (n = len; n > 0; n >>= 8)
+	crc = (crc << 8) ^ table[((crc >> 24) ^ n) & 0xFF];
+    return (u_long) (~crc & 0xFFFFFFFF);
+}
+
+/*
+** push_init
+**	Parse a "<file>[:<path>]" -u argument, read the file, and return
+**	the command which will put it in place on targets.
+*/
+char *
+push_init(spec)
+char *spec;
+{
+    char *file, *path, *quoted, *data, *cmd, *p, *q;
+    size_t len, sz;
+
+    file = strdup(spec);
+    if (file == NULL)
+      {
+	perror("strdup failed");
+	exit(RC_ERROR);
+      }
+    path = strchr(file, ':');
+    if (path != NULL)
+	*path++ = '\0';
+    else
+	path = file;
+    if (*file == '\0' || *path == '\0')
+      {
+	fprintf(stderr, "%s: Invalid -u argument: %s\n", myname, spec);
+	exit(RC_ERROR);
+      }
+    if (strcmp(path, "-") == 0)
+      {
+	fprintf(stderr, "%s: -u requires a path for the standard input!\n",
+		myname);
+	exit(RC_ERROR);
+      }
+
+    data = loop_input(file, &len);
+
+    /* The path is used literally: ' becomes '\'' within single quotes */
+    quoted = (char *) malloc(strlen(path) * 4 + 3);
+    if (quoted == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    q = quoted;
+    *q++ = '\'';
+    for (p = path; *p != '\0'; p++)
+	if (*p == '\'')
+	  {
+	    memcpy(q, "'\\''", 4);
+	    q += 4;
+	  }
+	else
+	    *q++ = *p;
+    *q++ = '\'';
+    *q = '\0';
+
+    sz = strlen(PUSH_COMMAND) + strlen(quoted) + 64;
+    cmd = (char *) malloc(sz);
+    if (cmd == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    snprintf(cmd, sz, PUSH_COMMAND, quoted, push_cksum(data, len),
+	     (u_long) len);
+    free(quoted);
+    free(file);
+    return cmd;
+}
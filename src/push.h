@@ -0,0 +1,16 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_PUSH_H_)
+# define _PUSH_H_
+
+u_long push_cksum(char *, size_t);
+char *push_init(char *);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux,
+** see the LICENSE file for details on your rights.
+*/
+
+#include "os.h"
+
+#include "loop.h"
+#include "push.h"
+#include "script.h"
+
+static char const rcsid[] = "@(#)$Id$";
+
+extern char *myname;
+
+/*
+** Script mode (-f <script>): rather than giving a (long) command on the
+** command line of rsh/ssh, the script is kept on targets, under
+** ~/.shmux/<cksum>-<length>.  The command is a short preamble running
+** it from there.  Only when it isn't there yet, the preamble asks for it
+** by writing SCRIPT_REQUEST, and the script is then fed to it (see
+** loop_ondemand()), checked with cksum(1) and saved before being run.
+*/
+#define SCRIPT_REQUEST	"SHMUX.SCRIPT\n"
+#define SCRIPT_COMMAND	"s=$HOME/.shmux/%lu-%lu; " \
+    "if [ ! -r \"$s\" ]; then " \
+    "umask 077; mkdir -p \"$HOME/.shmux\" || exit 1; t=\"$s.$$\"; " \
+    "echo SHMUX.SCRIPT; " \
+    "cat > \"$t\" || { rm -f \"$t\"; exit 1; }; " \
+    "set -- `cksum < \"$t\"`; " \
+    "if [ \"$1 $2\" != '%lu %lu' ]; then rm -f \"$t\"; " \
+    "echo \"shmux: $s: checksum mismatch ($1 $2)\" >&2; exit 1; fi; " \
+    "mv -f \"$t\" \"$s\" || exit 1; " \
+    "fi; exec sh \"$s\" < /dev/null"
+
+/*
+** script_init
+**	Read the script, and return the command which will run it on
+**	targets.
+*/
+char *
+script_init(file)
+char *file;
+{
+    char *data, *cmd;
+    size_t len, sz;
+    u_long sum;
+
+    data = loop_input(file, &len);
+    loop_ondemand(SCRIPT_REQUEST);
+    sum = push_cksum(data, len);
+
+    sz = strlen(SCRIPT_COMMAND) + 128;
+    cmd = (char *) malloc(sz);
+    if (cmd == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    snprintf(cmd, sz, SCRIPT_COMMAND, sum, (u_long) len, sum, (u_long) len);
+    return cmd;
+}
@@ -0,0 +1,15 @@
+/*
+** Copyright (C) 2002-2008 Christophe Kalt
+**
+** This file is part of shmux
+** see the LICENSE file for details on your rights.
+**
+** $Id$
+*/
+
+#if !defined(_SCRIPT_H_)
+# define _SCRIPT_H_
+
+char *script_init(char *);
+
+#endif
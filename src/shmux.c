@@ -18,8 +18,9 @@
 #endif
 #include <time.h>
 #include <sys/stat.h>
-#if defined(HAVE_PCRE_H)
-# include <pcre.h>
+#if defined(HAVE_PCRE2_H)
+# define PCRE2_CODE_UNIT_WIDTH 8
+# include <pcre2.h>
 #endif
 
 #if !defined(HAVE_BASENAME)
@@ -28,9 +29,19 @@
 
 #include "version.h"
 
+#include "adapt.h"
 #include "analyzer.h"
+#include "budget.h"
 #include "byteset.h"
+#include "ctl.h"
+#include "gather.h"
+#include "history.h"
+#include "journal.h"
 #include "loop.h"
+#include "memo.h"
+#include "offline.h"
+#include "push.h"
+#include "script.h"
 #include "target.h"
 #include "term.h"
 #include "units.h"
@@ -52,36 +63,61 @@ char *myname;
 #define DEFAULT_TESTTIMEOUT 15
 
 static void usage(int);
+static int  max_workers(char *);
 
 static void
 usage(detailed)
 int detailed;
 {
     fprintf(stderr, "Usage: %s [ options ] -c <command> [ - | <target1> [ <target2> ... ] ]\n", myname);
-/*    fprintf(stderr, "Usage: %s [ options ] -i [ <target1> [ <target2> ... ] ]\n", myname);*/
+    fprintf(stderr, "       %s [ options ] -f <script> [ - | <target1> [ <target2> ... ] ]\n", myname);
+    fprintf(stderr, "       %s [ options ] -u <file>[:<path>] [ - | <target1> [ <target2> ... ] ]\n", myname);
+    fprintf(stderr, "       %s [ options ] -x -o <dir> [ - | <target1> [ <target2> ... ] ]\n", myname);
     if (detailed == 0)
 	return;
     fprintf(stderr, "  -h            Print this message.\n");
     fprintf(stderr, "  -V            Output version info.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -c <command>  Command to execute on targets.\n");
+    fprintf(stderr, "  -f <script>   Script to run on targets, kept there for the next runs.\n");
     fprintf(stderr, "  -C <timeout>  Set a command timeout.\n");
+    fprintf(stderr, "  -I <timeout>  Set a command inactivity (no output) timeout.\n");
+    fprintf(stderr, "  -i <file>     Feed the file (\"-\": standard input) to the commands.\n");
+    fprintf(stderr, "  -u <file>[:<path>]  Push the file to targets, rather than run a command.\n");
+    fprintf(stderr, "  -g <dir>      Save the raw output of each command to <dir>/<target>.\n");
+    fprintf(stderr, "  -z            The output saved with -g is compressed, inflate it.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -M <max>      Maximum number of simultaneous processes (Default: %u).\n", DEFAULT_MAXWORKERS);
+    fprintf(stderr, "  -M auto[:<floor>-<ceiling>]  Adapt to observed latency and failures.\n");
+    fprintf(stderr, "  -M <max>,<tests>[,<analyzers>]  Separate limits for tests and analyzers.\n");
     fprintf(stderr, "  -r <rcmd>     Set the default method (Default: %s).\n", DEFAULT_RCMD);
     fprintf(stderr, "  -p            Ping targets to check for life.\n");
     fprintf(stderr, "  -P <millisec> Initial target timeout given to fping (Default: %s).\n", DEFAULT_PINGTIMEOUT);
     fprintf(stderr, "  -t            Send test command to verify target health.\n");
     fprintf(stderr, "  -T <seconds>  Time to wait for test answer (Default: %d).\n", DEFAULT_TESTTIMEOUT);
+    fprintf(stderr, "  -H <file>     Runtime history, to run the longest jobs first.\n");
+    fprintf(stderr, "  -W <weight>   Weight of the history vs. the order given (Default: 1).\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -S <mode>     Spawn strategy (Default: \"%s\")\n", DEFAULT_SPAWNMODE);
+    fprintf(stderr, "  -S wave[:<n>[%%]]  Spawn in growing waves, allowing <n> failures per wave.\n");
     fprintf(stderr, "  -F            Gracefully quit rather than pause\n");
+    fprintf(stderr, "  -L <budget>   Tolerate failures: <n>, <pct>%%[/<window>] or both (\"5%%,20\").\n");
     fprintf(stderr, "  -e <range>    Exit codes to consider errors (Default: \"%s\")\n", DEFAULT_ERRORCODES);
     fprintf(stderr, "  -E <range>    Exit codes to always display (Default: \"%s\")\n", DEFAULT_ERRORCODES);
+    fprintf(stderr, "  -R <n>[:<delay>]  Retry transport failures up to <n> times (Default delay: 1s).\n");
+    fprintf(stderr, "  -Y <range>    Exit codes to retry, in addition to ssh's 255.\n");
     fprintf(stderr, "  -a <type>     Analysis type (Default: %s)\n", DEFAULT_ANALYSIS);
     fprintf(stderr, "  -A <test>     Analyze output to determine success from failure.\n");
+    fprintf(stderr, "  -K <signal>   Kill commands as soon as their output indicates an error.\n");
+    fprintf(stderr, "  -Z            Reuse verdicts for identical outputs and exit codes.\n");
+    fprintf(stderr, "  -x            Analyze the outputs saved under -o again, running nothing.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -o <dir>      Send the output to files under the specified directory.\n");
+    fprintf(stderr, "  -O <size>[:<tail>]  Cap the output of each target, keeping the last <tail>.\n");
+    fprintf(stderr, "  -G <size>     Cap the output of all targets.\n");
+    fprintf(stderr, "  -k            Kill commands when their output is capped.\n");
+    fprintf(stderr, "  -j            Keep a journal of results in the output directory.\n");
+    fprintf(stderr, "  -J            Resume an interrupted run from its journal.\n");
     fprintf(stderr, "  -m            Don't mix target outputs.\n");
     fprintf(stderr, "  -b            Show bare output without target names.\n");
     fprintf(stderr, "  -B            Batch mode.\n");
@@ -89,19 +125,51 @@ int detailed;
     fprintf(stderr, "  -q            Suppress output of successful targets.\n");
     fprintf(stderr, "  -qq           Suppress target output.\n");
     fprintf(stderr, "  -Q            Suppress final summary.\n");
+    fprintf(stderr, "  -U <path>     Serve metrics and control requests on a Unix socket.\n");
     fprintf(stderr, "  -v            Display internal status messages.\n");
     fprintf(stderr, "  -D            Display internal debug messages.\n");
 }
 
+/*
+** max_workers
+**	Parse a "<max>[,<tests>[,<analyzers>]]" -M argument (or SHMUX_MAX),
+**	<max> possibly being "auto[:<floor>-<ceiling>]".
+*/
+static int
+max_workers(spec)
+char *spec;
+{
+    char *comma;
+
+    spec = strdup(spec);
+    if (spec == NULL)
+      {
+	perror("strdup failed");
+	exit(RC_ERROR);
+      }
+    comma = strchr(spec, ',');
+    if (comma != NULL)
+	*comma++ = '\0';
+    loop_pools(comma);
+
+    if (strncmp(spec, "auto", 4) == 0)
+	return adapt_init(spec);
+    adapt_init(NULL);
+    return atoi(spec);
+}
+
 int
 main(int argc, char **argv)
 {
     int badopt, rc;
     int opt_prefix, opt_status, opt_interactive, opt_quiet, opt_internal, opt_debug;
     int opt_ctimeout, opt_outmode, opt_maxworkers, opt_fail, opt_vtest;
+    int opt_journal, opt_capkill, opt_offline, opt_inflate;
+    u_long opt_cap, opt_captail, opt_gcap;
     u_int opt_test, opt_analyzer;
     char *opt_analyze, *opt_outanalysis, *opt_erranalysis;
-    char *opt_spawn, *opt_command, *opt_odir, *opt_ping, *opt_rcmd;
+    char *opt_spawn, *opt_command, *opt_odir, *opt_ping, *opt_rcmd, *opt_ctl;
+    char *opt_errkill, *opt_input, *opt_push, *opt_gather, *opt_script;
     char tdir[PATH_MAX];
     int longest;
     time_t start;
@@ -112,12 +180,15 @@ main(int argc, char **argv)
     opt_quiet = opt_internal = opt_debug = 0;
     opt_outmode = OUT_MIXED;
     if (getenv("SHMUX_MAX") != NULL)
-        opt_maxworkers = atoi(getenv("SHMUX_MAX"));
+	opt_maxworkers = max_workers(getenv("SHMUX_MAX"));
     else
         opt_maxworkers = DEFAULT_MAXWORKERS;
-    opt_ctimeout = opt_fail = opt_test = opt_vtest = 0;
+    opt_ctimeout = opt_fail = opt_test = opt_vtest = opt_journal = 0;
+    opt_capkill = opt_offline = opt_inflate = 0;
+    opt_cap = opt_captail = opt_gcap = 0;
     opt_analyze = opt_outanalysis = opt_erranalysis = NULL;
-    opt_command = opt_odir = opt_ping = NULL;
+    opt_command = opt_odir = opt_ping = opt_ctl = NULL;
+    opt_errkill = opt_input = opt_push = opt_gather = opt_script = NULL;
     opt_rcmd = getenv("SHMUX_RCMD");
     opt_spawn = NULL;
     if (getenv("SHMUX_SPAWNMODE") != NULL)
@@ -132,13 +203,14 @@ main(int argc, char **argv)
 	byteset_init(BSET_SHOW, getenv("SHMUX_SHOWCODES"));
     else
 	byteset_init(BSET_SHOW, "");
+    byteset_init(BSET_RETRY, "");
 
     badopt = 0;
     while (1)
       {
         int c;
 	
-        c = getopt(argc, argv, "a:A:bBc:C:De:E:FhmM:o:pP:qQr:sS:tT:vV");
+        c = getopt(argc, argv, "a:A:bBc:C:De:E:f:Fg:G:hH:i:I:jJkK:L:mM:o:O:pP:qQr:R:sS:tT:u:U:vVW:xY:zZ");
 	
         /* Detect the end of the options. */
         if (c == -1)
@@ -187,12 +259,55 @@ main(int argc, char **argv)
 	      opt_outmode &= ~(OUT_NULL|OUT_MIXED);
 	      opt_outmode |= OUT_ATEND;
 	      break;
+	  case 'G':
+	      opt_gcap = unit_size(optarg);
+	      break;
+	  case 'f':
+	      opt_script = optarg;
+	      break;
+	  case 'g':
+	      opt_gather = optarg;
+	      break;
+	  case 'H':
+	      history_init(optarg);
+	      break;
+	  case 'I':
+	      loop_idle(unit_time(optarg));
+	      break;
+	  case 'i':
+	      opt_input = optarg;
+	      break;
+	  case 'j':
+	      if (opt_journal == 0)
+		  opt_journal = 1;
+	      break;
+	  case 'J':
+	      opt_journal = 2;
+	      break;
+	  case 'k':
+	      opt_capkill = 1;
+	      break;
+	  case 'K':
+	      opt_errkill = optarg;
+	      break;
+	  case 'L':
+	      budget_init(optarg);
+	      break;
 	  case 'M':
-	      opt_maxworkers = atoi(optarg);
+	      opt_maxworkers = max_workers(optarg);
 	      break;
 	  case 'o':
 	      opt_odir = optarg;
 	      break;
+	  case 'O':
+	      opt_captail = 0;
+	      if (strchr(optarg, ':') != NULL)
+		{
+		  *strchr(optarg, ':') = '\0';
+		  opt_captail = unit_size(optarg + strlen(optarg) + 1);
+		}
+	      opt_cap = unit_size(optarg);
+	      break;
 	  case 'p':
 	      if (opt_ping == NULL)
 		  opt_ping = DEFAULT_PINGTIMEOUT;
@@ -231,15 +346,48 @@ main(int argc, char **argv)
 	      opt_test = atoi(optarg);
 	      opt_vtest += 1;
 	      break;
+	  case 'u':
+	      opt_push = optarg;
+	      break;
+	  case 'U':
+	      opt_ctl = optarg;
+	      break;
 	  case 'v':
 	      opt_internal = 1;
 	      break;
+	  case 'R':
+	      loop_retry(optarg);
+	      break;
+	  case 'Y':
+	      byteset_init(BSET_RETRY, optarg);
+	      break;
+	  case 'W':
+	      history_weight(optarg);
+	      break;
+	  case 'x':
+	      opt_offline = 1;
+	      break;
+	  case 'z':
+	      opt_inflate = 1;
+	      break;
+	  case 'Z':
+	      memo_init();
+	      break;
 	  case 'V':
-#if !defined(HAVE_PCRE_H)
+#if !defined(HAVE_PCRE2_H)
 	      printf("%s version %s\n", myname, SHMUX_VERSION);
 #else
-	      printf("%s version %s (PCRE version %s)\n",
-		     myname, SHMUX_VERSION, pcre_version());
+	      {
+		  char pv[64];
+		  uint32_t jit;
+
+		  pcre2_config(PCRE2_CONFIG_VERSION, pv);
+		  if (pcre2_config(PCRE2_CONFIG_JIT, &jit) != 0)
+		      jit = 0;
+		  printf("%s version %s (PCRE2 version %s%s)\n",
+			 myname, SHMUX_VERSION, pv,
+			 (jit != 0) ? ", JIT" : "");
+	      }
 #endif
 	      exit(RC_OK);
 	  case '?':
@@ -250,12 +398,27 @@ main(int argc, char **argv)
 	  }
       }
 
-    if (optind >= argc || badopt > 0 || opt_command == NULL)
+    if (badopt > 0
+	|| (opt_offline == 0 && (optind >= argc
+				 || (opt_command == NULL && opt_push == NULL
+				     && opt_script == NULL))))
       {
         usage(0);
         exit(RC_ERROR);
       }
 
+    if (opt_push != NULL && (opt_command != NULL || opt_input != NULL))
+      {
+	fprintf(stderr, "%s: -c/-i can't be used with -u!\n", myname);
+	exit(RC_ERROR);
+      }
+    if (opt_script != NULL && (opt_command != NULL || opt_input != NULL
+			       || opt_push != NULL))
+      {
+	fprintf(stderr, "%s: -c/-i/-u can't be used with -f!\n", myname);
+	exit(RC_ERROR);
+      }
+
     target_default(opt_rcmd);
     if (opt_maxworkers <= 0)
       {
@@ -266,6 +429,14 @@ main(int argc, char **argv)
     if (opt_spawn == NULL)
 	opt_spawn = DEFAULT_SPAWNMODE;
 
+    if (opt_capkill != 0 && opt_cap == 0 && opt_gcap == 0)
+      {
+	fprintf(stderr, "%s: -O or -G option required when using -k!\n",
+		myname);
+	exit(RC_ERROR);
+      }
+    loop_caps(opt_cap, opt_captail, opt_gcap, opt_capkill);
+
     opt_analyzer = analyzer_init(opt_analyze, opt_outanalysis,opt_erranalysis);
     /* -A requires -o, to avoid dangerous/reckless invocations. */
     if (opt_analyzer != ANALYZE_NONE && opt_odir == NULL)
@@ -273,6 +444,34 @@ main(int argc, char **argv)
 	fprintf(stderr, "%s: -o option required when using -a/-A!\n", myname);
 	exit(RC_ERROR);
       }
+    if (opt_errkill != NULL)
+      {
+	/* Only these can tell before the command completes */
+	if (opt_analyzer == ANALYZE_NONE || opt_analyzer == ANALYZE_RUN
+	    || opt_analyzer == ANALYZE_PLUGIN || opt_analyzer == ANALYZE_COPROC)
+	  {
+	    fprintf(stderr, "%s: -a option required when using -K!\n",
+		    myname);
+	    exit(RC_ERROR);
+	  }
+	loop_errkill(opt_errkill);
+      }
+    /* Gathered output isn't looked at */
+    if (opt_gather != NULL && opt_analyzer != ANALYZE_NONE)
+      {
+	fprintf(stderr, "%s: -a/-A can't be used with -g!\n", myname);
+	exit(RC_ERROR);
+      }
+    if (opt_inflate != 0 && opt_gather == NULL)
+      {
+	fprintf(stderr, "%s: -g option required when using -z!\n", myname);
+	exit(RC_ERROR);
+      }
+    if (memo_enabled() != 0 && opt_analyzer == ANALYZE_NONE)
+      {
+	fprintf(stderr, "%s: -a option required when using -Z!\n", myname);
+	exit(RC_ERROR);
+      }
 
     /* -? requires -o, to avoid dangerous/reckless invocations. */
     if ((opt_outmode & (OUT_NULL|OUT_IFERR)) != 0 && opt_odir == NULL)
@@ -281,6 +480,31 @@ main(int argc, char **argv)
 	exit(RC_ERROR);
       }
 
+    /* -j/-J require -o, that's where the journal lives. */
+    if (opt_journal != 0 && opt_odir == NULL)
+      {
+	fprintf(stderr, "%s: -o option required when using -j/-J!\n", myname);
+	exit(RC_ERROR);
+      }
+
+    /* -x works on the output directory of an earlier run */
+    if (opt_offline != 0)
+      {
+	if (opt_odir == NULL)
+	  {
+	    fprintf(stderr, "%s: -o option required when using -x!\n",
+		    myname);
+	    exit(RC_ERROR);
+	  }
+	if (opt_journal != 0 || memo_enabled() != 0 || opt_input != NULL
+	    || opt_push != NULL || opt_gather != NULL || opt_script != NULL)
+	  {
+	    fprintf(stderr, "%s: -f/-g/-i/-j/-J/-u/-Z can't be used with -x!\n",
+		    myname);
+	    exit(RC_ERROR);
+	  }
+      }
+
     if (opt_odir != NULL)
 	opt_outmode |= OUT_COPY;
     else if ((opt_outmode & OUT_ATEND) != 0)
@@ -295,7 +519,7 @@ main(int argc, char **argv)
 	opt_odir = tdir;
       }
 
-    if (opt_odir != NULL && mkdir(opt_odir, 0777) == -1 && errno != EEXIST)
+    if (opt_odir != NULL && opt_offline == 0 && mkdir(opt_odir, 0777) == -1 && errno != EEXIST)
       {
 	/* Create odir if it doesn't already exists */
 	fprintf(stderr, "%s: mkdir(%s): %s\n",
@@ -303,12 +527,17 @@ main(int argc, char **argv)
 	exit(RC_ERROR);
       }
 
+    if (opt_gather != NULL)
+	gather_init(opt_gather, opt_inflate);
+
     /* Should test outputs be shown? */
     if (opt_vtest > 1)
 	opt_test *= -1;
 
     /* Get list of targets */
     longest = 0;
+    if (opt_offline != 0 && optind >= argc)
+	longest = offline_targets(opt_odir);
     while (optind < argc)
       {
 	int length;
@@ -323,6 +552,13 @@ main(int argc, char **argv)
 	  {
 	    char tname[256];
 
+	    if ((opt_input != NULL && strcmp(opt_input, "-") == 0)
+		|| (opt_push != NULL && strncmp(opt_push, "-:", 2) == 0)
+		|| (opt_script != NULL && strcmp(opt_script, "-") == 0))
+	      {
+		fprintf(stderr, "%s: -f/-i/-u - and - can't both read the standard input!\n", myname);
+		exit(RC_ERROR);
+	      }
 	    optind += 1;
 	    while (fgets(tname, 256, stdin) != NULL)
 	      {
@@ -340,20 +576,53 @@ main(int argc, char **argv)
       }
     else if (longest < strlen(myname))
         longest = strlen(myname);
+
+    /* Read the commands' standard input before spawning anything */
+    if (opt_push != NULL)
+	opt_command = push_init(opt_push);
+    else if (opt_script != NULL)
+	opt_command = script_init(opt_script);
+    else if (opt_input != NULL)
+      {
+	size_t len;
+
+	loop_input(opt_input, &len);
+      }
             
+    /* Open the journal, and read it first if resuming */
+    if (opt_journal != 0)
+	journal_init(opt_odir, opt_command, opt_journal == 2);
+
+    /* Create the control socket */
+    ctl_init(opt_ctl);
+
     /* Initialize terminal */
     term_init(longest, opt_prefix, opt_status, opt_internal, opt_debug, opt_interactive);
 
+    /* Dispatch order from the runtime history */
+    if (opt_offline == 0)
+	history_load(opt_command);
+
     /* Loop through targets/commands */
     start = time(NULL);
-    rc = loop(opt_command, opt_ctimeout, opt_maxworkers, opt_spawn, opt_fail,
-	      opt_outmode, opt_odir, opt_analyzer, opt_ping, opt_test);
+    if (opt_offline != 0)
+	rc = offline(opt_odir, opt_maxworkers, opt_analyzer);
+    else
+	rc = loop(opt_command, opt_ctimeout, opt_maxworkers, opt_spawn, opt_fail,
+		  opt_outmode, opt_odir, opt_analyzer, opt_ping, opt_test);
+    ctl_end();
+    analyzer_end();
+    history_end();
+    journal_end();
 
     /* Summary of results unless asked to be quiet */
     if (opt_quiet == 0)
       {
 	nprint("");
 	target_results((int) (time(NULL) - start));
+	memo_report();
+	loop_report();
+	gather_report();
       }
 
     /* odir was temporary, remove it now */
@@ -15,6 +15,7 @@
 
 #include "target.h"
 #include "term.h"
+#include "units.h"
 
 #if defined(MAX)
 # undef MAX
@@ -23,8 +24,15 @@
 
 static char const rcsid[] = "@(#)$Id$";
 
+#define RATE_WINDOW 10	/* seconds over which the spawn rate is computed */
+
 static int spawned, inphase[5];
 static time_t spawnedchg, changed[5];
+static time_t started, ratewhen[RATE_WINDOW];
+static u_int ratecount[RATE_WINDOW];
+static u_long spawns, bytes;
+static int maxshown = -1;
+static long eta = -1;
 
 /*
 ** status_init
@@ -35,6 +43,10 @@ status_init(pings, tests, analyzer)
 int pings, tests, analyzer;
 {
     spawned = 0;
+    spawns = bytes = 0;
+    started = time(NULL);
+    memset((void *) ratewhen, 0, sizeof(ratewhen));
+    memset((void *) ratecount, 0, sizeof(ratecount));
     inphase[0] = inphase[1] = inphase[2] = inphase[3] = inphase[4] = 0;
     spawnedchg = changed[0] = changed[1] = changed[2] = changed[3] = 0;
     if (pings == 0)
@@ -55,6 +67,19 @@ int count;
 {
     spawned += count;
     spawnedchg = time(NULL);
+    if (count > 0)
+      {
+	int slot;
+
+	spawns += count;
+	slot = spawnedchg % RATE_WINDOW;
+	if (ratewhen[slot] != spawnedchg)
+	  {
+	    ratewhen[slot] = spawnedchg;
+	    ratecount[slot] = 0;
+	  }
+	ratecount[slot] += count;
+      }
 }
 
 /*
@@ -78,6 +103,81 @@ int phase, count;
     changed[phase] = time(NULL);
 }
 
+/*
+** status_read
+**	Account for output read from children.
+*/
+void
+status_read(count)
+int count;
+{
+    bytes += count;
+}
+
+/*
+** status_max
+**	Set the maximum number of children to show in the status line
+**	(or -1 to hide it).
+*/
+void
+status_max(max)
+int max;
+{
+    maxshown = max;
+}
+
+/*
+** status_eta
+**	Set the estimated time left (or -1 if unknown).
+*/
+void
+status_eta(seconds)
+long seconds;
+{
+    eta = seconds;
+}
+
+/*
+** status_get
+**	Get a snapshot of the current status.
+*/
+void
+status_get(info)
+struct status_info *info;
+{
+    time_t now;
+    int i, window;
+
+    now = time(NULL);
+    info->active = spawned;
+    info->failed = inphase[0];
+    info->alive = inphase[1];
+    info->ok = inphase[2];
+    if (inphase[4] >= 0)
+      {
+	info->run = inphase[3];
+	info->done = inphase[4];
+      }
+    else
+      {
+	info->run = -1;
+	info->done = inphase[3];
+      }
+    info->pending = target_getmax() - inphase[0] - MAX(0, inphase[1])
+	- MAX(0, inphase[2]) - inphase[3] - MAX(0, inphase[4]);
+    info->uptime = now - started;
+    info->spawns = spawns;
+    info->bytes = bytes;
+    info->eta = eta;
+
+    info->rate = 0;
+    for (i = 0; i < RATE_WINDOW; i++)
+	if (now - ratewhen[i] < RATE_WINDOW)
+	    info->rate += ratecount[i];
+    window = (now - started < RATE_WINDOW) ? now - started + 1 : RATE_WINDOW;
+    info->rate /= window;
+}
+
 /*
 ** status_update
 **	Call sprint
@@ -86,7 +186,7 @@ void
 status_update(void)
 {
     time_t now;
-    char tmp[4][80], loadavg[20], active[16];
+    char tmp[4][80], loadavg[20], active[16], left[32];
 #if defined(HAVE_GETLOADAVG) && !defined(GETLOADAVG_PRIVILEGED)
     double load[3];
     static int erroronce = 1;
@@ -108,8 +208,15 @@ status_update(void)
 
     now = time(NULL);
 
+    if (eta >= 0)
+	snprintf(left, sizeof(left), "ETA %s ", unit_rtime((u_int) eta));
+    else
+	left[0] = '\0';
+
     if (spawned == 0 && spawnedchg > 0 && (now - spawnedchg) > 1)
 	strlcpy(active, "\a[PAUSED]\a", sizeof(active));
+    else if (maxshown >= 0)
+	snprintf(active, sizeof(active), "%d/%d Active", spawned, maxshown);
     else
 	snprintf(active, sizeof(active), "%d Active", spawned);
     if (inphase[1] >= 0)
@@ -138,10 +245,10 @@ status_update(void)
 	tmp[3][0] = '\0';
       }
 
-    sprint("-- %s, %d Pending/%s%d Failed/%s%s%s%s -- %s",
+    sprint("-- %s, %d Pending/%s%d Failed/%s%s%s%s -- %s%s",
 	   active,
 	   target_getmax() - inphase[0] - MAX(0, inphase[1])
 	   - MAX(0, inphase[2]) - inphase[3] - MAX(0, inphase[4]),
 	   (now - changed[0] < 2) ? "\a" : "", inphase[0],
-	   tmp[0], tmp[1], tmp[2], tmp[3], loadavg);
+	   tmp[0], tmp[1], tmp[2], tmp[3], left, loadavg);
 }
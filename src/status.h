@@ -10,9 +10,25 @@
 #if !defined(_STATUS_H_)
 # define _STATUS_H_
 
+struct status_info
+{
+    int		active;			/* running processes */
+    int		pending, failed;
+    int		alive, ok, run, done;	/* -1 for unused phases */
+    time_t	uptime;
+    u_long	spawns;			/* processes spawned */
+    double	rate;			/* spawns per second (recently) */
+    u_long	bytes;			/* bytes read from processes */
+    long	eta;			/* seconds left, -1 if unknown */
+};
+
 void status_init(int, int, int);
 void status_spawned(int);
 void status_phase(int, int);
+void status_read(int);
+void status_max(int);
+void status_eta(long);
+void status_get(struct status_info *);
 void status_update(void);
 
 #endif
@@ -35,16 +35,35 @@ struct target
     char status;
     char phase;
     time_t when;
-    int result;		/* command status: -2: signal, -1: timed out,
-			   		    0: unknown, 1: ok, 2: error */
+    int result;		/* command status: -3: idle, -2: signal,
+			   -1: timed out, 0: unknown, 1: ok, 2: error */
+    int num;		/* target number, see target_order() */
+};
+
+/* Rarely used, kept apart so target_next() has less to scan */
+struct extra
+{
+    int attempts;	/* number of failed attempts (retried) */
+    time_t retry;	/* not to be retried before, 0 if not waiting */
+    int next;		/* next target number in the retry queue */
+    char *retries;	/* outcome of failed attempts */
+    u_long dropped;	/* output discarded (output caps) */
 };
 
 static struct target *targets = NULL;
+static struct extra *extra = NULL;	/* indexed by target number */
 static int  type,	/* default type */
 	    tcur = 0,	/* "current" target "pointer" */
 	    tmax,	/* max target pointer */
 	    tsz = 0;	/* size of targets array */
-
+static void (*notify)(int, int) = NULL;	/* final result callback */
+static int *pos = NULL;		/* target number -> index, NULL: same */
+static int waiting = 0;		/* targets waiting to be retried */
+static int retryq = -1;		/* waiting targets by retry time, -1: none */
+static int input = 0;		/* commands read their standard input */
+
+static struct target *bynum(int);
+static void retry_due(void);
 static int split_argv(const char *, int, char **);
 
 /*
@@ -83,6 +102,7 @@ char *name;
     if (tsz == 0)
       {
 	targets = (struct target *) malloc(sizeof(struct target) * 10);
+	extra = (struct extra *) malloc(sizeof(struct extra) * 10);
 	tsz = 10;
 	tmax = -1;
       }
@@ -91,8 +111,18 @@ char *name;
 	tsz *= 2;
 	targets = (struct target *) realloc(targets,
 					    sizeof(struct target) * tsz);
+	extra = (struct extra *) realloc(extra, sizeof(struct extra) * tsz);
+	if (pos != NULL)
+	  {
+	    pos = (int *) realloc(pos, sizeof(int) * tsz);
+	    if (pos == NULL)
+	      {
+		perror("realloc failed");
+		exit(RC_ERROR);
+	      }
+	  }
       }
-    if (targets == NULL)
+    if (targets == NULL || extra == NULL)
       {
 	perror("malloc/realloc failed");
 	exit(RC_ERROR);
@@ -133,6 +163,14 @@ char *name;
     targets[tmax].phase = 0;
     targets[tmax].when = 0;
     targets[tmax].result = 0;
+    targets[tmax].num = tmax;
+    if (pos != NULL)
+	pos[tmax] = tmax;
+    extra[tmax].attempts = 0;
+    extra[tmax].retry = 0;
+    extra[tmax].next = -1;
+    extra[tmax].retries = NULL;
+    extra[tmax].dropped = 0;
 
     return strlen(targets[tmax].name);
 }
@@ -204,10 +242,23 @@ u_int num;
 {
     if (num > tmax)
 	return -1;
-    tcur = num;
+    tcur = (pos != NULL) ? pos[num] : num;
     return 0;
 }
 
+/*
+** bynum
+**	Return a target given its number, wherever target_order() put it.
+*/
+static struct target *
+bynum(num)
+int num;
+{
+    assert( num >= 0 && num <= tmax );
+
+    return &targets[(pos != NULL) ? pos[num] : num];
+}
+
 /*
 ** target_getname
 **	Return the current target name.
@@ -229,7 +280,19 @@ target_getnum(void)
 {
     assert( tcur >= 0 && tcur <= tmax );
 
-    return tcur;
+    return targets[tcur].num;
+}
+
+/*
+** target_isremote
+**	Is the current target reached using rsh/ssh?
+*/
+int
+target_isremote(void)
+{
+    assert( tcur >= 0 && tcur <= tmax );
+
+    return targets[tcur].type != 0;
 }
 
 /*
@@ -267,7 +330,7 @@ char **args;
     if (buf != NULL)
         free(buf);
 
-    buf = (char *) malloc(strlen(opts));
+    buf = (char *) malloc(strlen(opts) + 1);
     if (buf == NULL)
       {
         fprintf(stderr, "%s: malloc() failed: %s\n",
@@ -336,6 +399,18 @@ char **args;
     return i;
 }
 
+/*
+** target_input
+**	Commands will (not) be fed on their standard input, rsh/ssh must
+**	then (not) be given -n.
+*/
+void
+target_input(yes)
+int yes;
+{
+    input = yes;
+}
+
 /*
 ** target_getcmd
 **	Return the current target command.
@@ -374,16 +449,21 @@ char *cmd;
 	  args[3] = NULL;
 	  return args;
       case 1:
+	{
+	  int a;
+
 	  args[0] = getenv("SHMUX_RSH");
 	  if (args[0] == NULL)
 	      args[0] = "rsh";
-	  args[1] = "-n";
+	  a = 1;
+	  if (input == 0)
+	      args[a++] = "-n";
           at = strchr(targets[tcur].name, '@');
           if (at == NULL)
             {
-              args[2] = targets[tcur].name;
-              args[3] = cmd;
-              args[4] = NULL;
+              args[a] = targets[tcur].name;
+              args[a+1] = cmd;
+              args[a+2] = NULL;
             }
           else
             {
@@ -397,26 +477,27 @@ char *cmd;
                 }
               user[i] = '\0';
 
-              args[2] = "-l";
-              args[3] = user;
-              args[4] = at+1;
-              args[5] = cmd;
-              args[6] = NULL;
+              args[a] = "-l";
+              args[a+1] = user;
+              args[a+2] = at+1;
+              args[a+3] = cmd;
+              args[a+4] = NULL;
             }
 	  return args;
+	}
       case 2:
 	  args[0] = getenv("SHMUX_SSH1");
-	  args[1] = "-1n";
+	  args[1] = (input == 0) ? "-1n" : "-1T";
 	  nopts = split_argv(getenv("SHMUX_SSH1_OPTS"), argsz - 7, &args[4]);
 	  break;
       case 3:
 	  args[0] = getenv("SHMUX_SSH2");
-	  args[1] = "-2n";
+	  args[1] = (input == 0) ? "-2n" : "-2T";
 	  nopts = split_argv(getenv("SHMUX_SSH2_OPTS"), argsz - 7, &args[4]);
 	  break;
       case 4:
 	  args[0] = NULL;
-	  args[1] = "-n";
+	  args[1] = (input == 0) ? "-n" : "-T";
 	  nopts = 0;
 	  break;
       default:
@@ -488,20 +569,62 @@ int
 target_next(phase)
 int phase;
 {
+    int i;
+
     assert( phase > 0 && phase < 5 );
 
-    tcur = 0;
-    while (tcur <= tmax)
-      {
-	if (targets[tcur].status == phase-1
-	    /* && targets[tcur].status==targets[tcur].phase true,unnecessary */
-	    && targets[tcur].phase != phase)
+    if (retryq >= 0)
+	retry_due();
+    for (i = 0; i <= tmax; i++)
+	if (targets[i].status == phase-1
+	    /* && targets[i].status == targets[i].phase true, unnecessary */
+	    && targets[i].phase != phase)
+	  {
+	    tcur = i;
 	    return 0;
-	tcur += 1;
-      }
+	  }
+    tcur = tmax + 1;
     return -1;
 }
 
+/*
+** target_order
+**	Rearrange the targets so that target_next() considers them in the
+**	order given (an array of target numbers), NULL for the order in
+**	which they were added.  Target numbers are unchanged.
+*/
+void
+target_order(order)
+int *order;
+{
+    struct target *sorted;
+    int i, num;
+
+    num = (tcur >= 0 && tcur <= tmax) ? targets[tcur].num : -1;
+    sorted = (struct target *) malloc(sizeof(struct target) * tsz);
+    if (sorted == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    for (i = 0; i <= tmax; i++)
+	sorted[i] = *bynum((order != NULL) ? order[i] : i);
+    free(targets);
+    targets = sorted;
+
+    if (pos == NULL)
+	pos = (int *) malloc(sizeof(int) * tsz);
+    if (pos == NULL)
+      {
+	perror("malloc failed");
+	exit(RC_ERROR);
+      }
+    for (i = 0; i <= tmax; i++)
+	pos[targets[i].num] = i;
+    if (num >= 0)
+	tcur = pos[num];
+}
+
 /*
 ** target_start
 **	Start new phase for current target.
@@ -515,6 +638,115 @@ target_start(void)
 
     targets[tcur].phase = targets[tcur].phase + 1;
     targets[tcur].when = time(NULL);
+    if (waiting > 0 && extra[targets[tcur].num].retry != 0)
+      {
+	extra[targets[tcur].num].retry = 0;
+	waiting -= 1;
+      }
+}
+
+/*
+** target_retry
+**	Instead of setting a result, schedule another attempt of the current
+**	phase for the current target (not before the time given).
+*/
+void
+target_retry(when, why)
+time_t when;
+char *why;
+{
+    struct extra *x;
+    int len, *prev;
+
+    assert( tcur >= 0 && tcur <= tmax );
+    assert( targets[tcur].status == targets[tcur].phase - 1 );
+    assert( targets[tcur].phase == 2 || targets[tcur].phase == 3 );
+
+    /*
+    ** The phase is left as started, so target_next() skips the target
+    ** until retry_due() takes it off the queue.
+    */
+    targets[tcur].result = 0;
+    x = &extra[targets[tcur].num];
+    x->attempts += 1;
+    x->retry = when;
+    waiting += 1;
+    prev = &retryq;
+    while (*prev >= 0 && extra[*prev].retry <= when)
+	prev = &extra[*prev].next;
+    x->next = *prev;
+    *prev = targets[tcur].num;
+
+    /* Keep track of what happened */
+    len = strlen(why) + 3;
+    if (x->retries != NULL)
+	len += strlen(x->retries);
+    x->retries = (char *) realloc(x->retries, len);
+    if (x->retries == NULL)
+      {
+	perror("realloc failed");
+	exit(RC_ERROR);
+      }
+    if (x->attempts == 1)
+	x->retries[0] = '\0';
+    else
+	strcat(x->retries, ", ");
+    strcat(x->retries, why);
+}
+
+/*
+** retry_due
+**	Make targets whose retry time has come available to target_next().
+*/
+static void
+retry_due(void)
+{
+    time_t now;
+
+    now = time(NULL);
+    while (retryq >= 0 && extra[retryq].retry <= now)
+      {
+	struct target *t;
+
+	t = bynum(retryq);
+	t->phase = t->status;
+	retryq = extra[retryq].next;
+      }
+}
+
+/*
+** target_attempts
+**	Return the number of failed attempts for the current target.
+*/
+int
+target_attempts(void)
+{
+    assert( tcur >= 0 && tcur <= tmax );
+
+    return extra[targets[tcur].num].attempts;
+}
+
+/*
+** target_waiting
+**	Return the number of targets waiting to be retried.
+*/
+int
+target_waiting(void)
+{
+    return waiting;
+}
+
+/*
+** target_dropped
+**	Account for output from the current target which was discarded.
+*/
+void
+target_dropped(bytes)
+u_long bytes;
+{
+    assert( tcur >= 0 && tcur <= tmax );
+
+    extra[targets[tcur].num].dropped += bytes;
 }
 
 /*
@@ -545,6 +777,47 @@ int ok;
 	targets[tcur].result = CMD_FAILURE;
       }
     status_phase(targets[tcur].status, 1);
+
+    if (notify != NULL
+	&& (targets[tcur].status == -1 || targets[tcur].status == 4))
+	notify(targets[tcur].phase, targets[tcur].result);
+}
+
+/*
+** target_restore
+**	Set the final state of the current target from a previous run,
+**	given the last phase started and the command status.
+*/
+void
+target_restore(phase, result)
+int phase, result;
+{
+    assert( tcur >= 0 && tcur <= tmax );
+    assert( targets[tcur].status == 0 && targets[tcur].phase == 0 );
+    assert( phase > 0 && phase <= 4 );
+    assert( result >= -3 && result <= 2 );
+
+    if (result == CMD_FAILURE)
+      {
+	targets[tcur].status = -1;
+	targets[tcur].phase = phase;
+      }
+    else
+	targets[tcur].status = targets[tcur].phase = 4;
+    targets[tcur].result = result;
+    status_phase(targets[tcur].status, 1);
+}
+
+/*
+** target_notify
+**	Register a function to be called whenever a target reaches its
+**	final state, with the last phase started and the command status.
+*/
+void
+target_notify(fn)
+void (*fn)(int, int);
+{
+    notify = fn;
 }
 
 /*
@@ -596,7 +869,7 @@ int status;
 {
     assert( tcur >= 0 && tcur <= tmax );
     assert( targets[tcur].phase == 3 || targets[tcur].phase == 4 );
-    assert( status >= -2 && status <= 2 );
+    assert( status >= -3 && status <= 2 );
 
     targets[tcur].result = status;
 }
@@ -609,8 +882,10 @@ void
 target_status(status)
 int status;
 {
+    struct target *t;
+    struct extra *x;
     int i, any, tlen;
-    char buf[16];
+    char buf[16], *retried;
 
     assert( status == STATUS_ALL     || status == STATUS_PENDING ||
 	    status == STATUS_ACTIVE  || status == STATUS_FAILED  ||
@@ -621,34 +896,57 @@ int status;
     i = 0;
     while (i <= tmax)
       {
-	if (targets[i].result < 0 && (status & STATUS_FAILED) != 0)
+	t = bynum(i);
+	x = &extra[i];
+	retried = (x->retries != NULL) ? x->retries : "";
+	if (t->result < 0 && (status & STATUS_FAILED) != 0)
 	  {
-	    assert( targets[i].result == CMD_FAILURE
-		    || targets[i].result == CMD_TIMEOUT );
-	    uprint(" [%*d] %s: %s", tlen, i,
-		   (targets[i].result == CMD_FAILURE) ?
-		   "           failed" : "        timed out",
-		   targets[i].name);
+	    assert( t->result == CMD_FAILURE
+		    || t->result == CMD_TIMEOUT
+		    || t->result == CMD_IDLE );
+	    uprint(" [%*d] %s: %s%s%s%s", tlen, i,
+		   (t->result == CMD_FAILURE) ? "           failed" :
+		   (t->result == CMD_TIMEOUT) ? "        timed out" :
+		   "             idle",
+		   t->name, (*retried != '\0') ? " (" : "", retried,
+		   (*retried != '\0') ? ")" : "");
 	    any = 1;
 	  }
-	else if (targets[i].result == CMD_ERROR
+	else if (t->result == CMD_ERROR
 		 && (status & STATUS_ERROR) != 0)
 	  {
-	    uprint(" [%*d]             error: %s", tlen, i, targets[i].name);
+	    uprint(" [%*d]             error: %s%s%s%s", tlen, i,
+		   t->name, (*retried != '\0') ? " (" : "", retried,
+		   (*retried != '\0') ? ")" : "");
 	    any = 1;
 	  }
-	else if (targets[i].result == CMD_SUCCESS
+	else if (t->result == CMD_SUCCESS
 		 && (status & STATUS_SUCCESS) != 0)
 	  {
-	    uprint(" [%*d]           success: %s", tlen, i, targets[i].name);
+	    uprint(" [%*d]           success: %s%s%s%s", tlen, i,
+		   t->name, (*retried != '\0') ? " (" : "", retried,
+		   (*retried != '\0') ? ")" : "");
 	    any = 1;
 	  }
-	else if (targets[i].status != targets[i].phase
+	else if (x->retry != 0)
+	  {
+	    /* Still in its phase as far as target_next() is concerned */
+	    if ((status & STATUS_PENDING) != 0)
+	      {
+		uprint(" [%*d]          retrying: %s [%s] (%s)", tlen, i,
+		       t->name,
+		       unit_rtime((x->retry > time(NULL))
+				  ? x->retry - time(NULL) : 0),
+		       retried);
+		any = 1;
+	      }
+	  }
+	else if (t->status != t->phase
 		 && (status & STATUS_ACTIVE) != 0)
 	  {
 	    char *what;
 
-	    switch (targets[i].phase)
+	    switch (t->phase)
 	      {
 	      case 1:
 		  what = "  [pinging] active";
@@ -666,14 +964,14 @@ int status;
 		  abort();
 	      }
 
-	    uprint(" [%*d]%s: %s [%s]", tlen, i, what, targets[i].name,
-                   unit_rtime(time(NULL) - targets[i].when));
+	    uprint(" [%*d]%s: %s [%s]", tlen, i, what, t->name,
+                   unit_rtime(time(NULL) - t->when));
 	    any = 1;
 	  }
-	else if (targets[i].phase < 3
+	else if (t->phase < 3
 		 && (status & STATUS_PENDING) != 0)
 	  {
-	    uprint(" [%*d]           pending: %s", tlen, i, targets[i].name);
+	    uprint(" [%*d]           pending: %s", tlen, i, t->name);
 	    any = 1;
 	  }
 	i += 1;
@@ -691,15 +989,20 @@ void
 target_results(seconds)
 int seconds;
 {
+    struct target *cur;
     int i, first;
-    int f, t, u, s, e;
+    int f, t, d, u, s, e;
 
-    f = t = u = s = e = 0;
+    f = t = d = u = s = e = 0;
     i = 0;
     while (i <= tmax)
       {
-	switch (targets[i].result)
+	cur = bynum(i);
+	switch (cur->result)
 	  {
+	  case -3:
+	      d += 1;
+	      break;
 	  case -2:
 	      f += 1;
 	      break;
@@ -734,16 +1037,20 @@ int seconds;
 		   seconds, (seconds > 1) ? "s" : "");
       }
 
-    if (f + t + u + s + e > 0)
+    if (f + t + d + u + s + e > 0)
       {
 	printf("Summary: ");
 	if (f > 0)
 	    printf("%d failure%s", f, (f > 1) ? "s" : "");
-	if (f > 0 && t + u + s + e > 0)
+	if (f > 0 && t + d + u + s + e > 0)
 	    printf(", ");
 	if (t > 0)
 	    printf("%d timeout%s", t, (t > 1) ? "s" : "");
-	if (t > 0 && u + s + e > 0)
+	if (t > 0 && d + u + s + e > 0)
+	    printf(", ");
+	if (d > 0)
+	    printf("%d idle", d);
+	if (d > 0 && u + s + e > 0)
 	    printf(", ");
 	if (u > 0)
 	    printf("%d unprocessed", u);
@@ -764,12 +1071,13 @@ int seconds;
     i = 0;
     while (i <= tmax)
       {
-	if (targets[i].result == CMD_FAILURE)
+	cur = bynum(i);
+	if (cur->result == CMD_FAILURE)
 	  {
 	    if (first == 1)
 		printf("Failed   : ");
 	    first = 0;
-	    printf("%s ", targets[i].name);
+	    printf("%s ", cur->name);
 	  }
 	i += 1;
       }
@@ -780,12 +1088,30 @@ int seconds;
     i = 0;
     while (i <= tmax)
       {
-	if (targets[i].result == CMD_TIMEOUT)
+	cur = bynum(i);
+	if (cur->result == CMD_TIMEOUT)
 	  {
 	    if (first == 1)
 		printf("Timed out: ");
 	    first = 0;
-	    printf("%s ", targets[i].name);
+	    printf("%s ", cur->name);
+	  }
+	i += 1;
+      }
+    if (first == 0)
+	nprint("");
+
+    first = 1;
+    i = 0;
+    while (i <= tmax)
+      {
+	cur = bynum(i);
+	if (cur->result == CMD_IDLE)
+	  {
+	    if (first == 1)
+		printf("Idle     : ");
+	    first = 0;
+	    printf("%s ", cur->name);
 	  }
 	i += 1;
       }
@@ -796,15 +1122,91 @@ int seconds;
     i = 0;
     while (i <= tmax)
       {
-	if (targets[i].result == CMD_ERROR)
+	cur = bynum(i);
+	if (cur->result == CMD_ERROR)
 	  {
 	    if (first == 1)
 		printf("Error    : ");
 	    first = 0;
-	    printf("%s ", targets[i].name);
+	    printf("%s ", cur->name);
 	  }
 	i += 1;
       }
     if (first == 0)
 	nprint("");
+
+    first = 1;
+    i = 0;
+    while (i <= tmax)
+      {
+	cur = bynum(i);
+	if (extra[i].attempts > 0)
+	  {
+	    if (first == 1)
+		printf("Retried  : ");
+	    first = 0;
+	    printf("%s(%d) ", cur->name, extra[i].attempts);
+	  }
+	i += 1;
+      }
+    if (first == 0)
+	nprint("");
+
+    first = 1;
+    i = 0;
+    while (i <= tmax)
+      {
+	cur = bynum(i);
+	if (extra[i].dropped > 0)
+	  {
+	    if (first == 1)
+		printf("Capped   : ");
+	    first = 0;
+	    printf("%s(%s) ", cur->name, unit_rsize(extra[i].dropped));
+	  }
+	i += 1;
+      }
+    if (first == 0)
+	nprint("");
+}
+
+#if defined(BENCH)
+/*
+** bench_target_reset
+**	Forget about all targets, so bench.c can start over.
+*/
+void
+bench_target_reset(void)
+{
+    while (tsz > 0 && tmax >= 0)
+      {
+	if (extra[tmax].retries != NULL)
+	    free(extra[tmax].retries);
+	free(targets[tmax--].name);
+      }
+    waiting = 0;
+    retryq = -1;
+    free(targets);
+    targets = NULL;
+    free(extra);
+    extra = NULL;
+    if (pos != NULL)
+	free(pos);
+    pos = NULL;
+    tcur = 0;
+    tsz = 0;
 }
+
+/*
+** bench_split_argv
+**	Public entry point to split_argv() for bench.c
+*/
+int
+bench_split_argv(opts, maxargs, args)
+const char *opts;
+int maxargs;
+char **args;
+{
+    return split_argv(opts, maxargs, args);
+}
+#endif
@@ -18,15 +18,25 @@ int target_setbyhname(char *);
 int target_setbynum(u_int);
 char *target_getname(void);
 int target_getnum(void);
+int target_isremote(void);
+void target_input(int);
 char **target_getcmd(char *);
 int target_next(int);
+void target_order(int *);
 void target_start(void);
+void target_dropped(u_long);
 void target_result(int);
+void target_retry(time_t, char *);
+int target_attempts(void);
+int target_waiting(void);
+void target_notify(void (*)(int, int));
+void target_restore(int, int);
 int target_pong(char *);
 void target_cmdstatus(int);
 void target_status(int);
 void target_results(int);
 
+#define CMD_IDLE	-3
 #define CMD_FAILURE	-2
 #define CMD_TIMEOUT	-1
 #define CMD_SUCCESS	 1
@@ -129,7 +129,8 @@ int maxlen, prefix, progress, internal, debug, interactive;
 	fprintf(stdout,
 	     "%*s$ itty[%d] ttyin[%d] otty[%d] etty[%d] ttyout[%d] TERM[%s]\n",
 		padding, myname, isatty(fileno(stdin)), ttyin,
-		otty, etty, fileno(ttyout), (term != NULL) ? term : "");
+		otty, etty, (ttyout != NULL) ? fileno(ttyout) : -1,
+		(term != NULL) ? term : "");
 
     if (term == NULL)
       {
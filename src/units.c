@@ -96,3 +96,62 @@ unit_rtime(u_int timeval)
 
     return timestr;
 }
+
+/*
+** unit_size
+**	Parse a size, in bytes unless followed by a unit: k(ilobytes),
+**	m(egabytes) or g(igabytes).
+*/
+u_long
+unit_size(sizestr)
+char *sizestr;
+{
+    char *unit;
+    u_long size;
+
+    size = strtoul(sizestr, &unit, 10);
+    if (unit == sizestr || (*unit != '\0' && unit[1] != '\0'))
+      {
+	fprintf(stderr, "%s: Invalid size: %s\n", myname, sizestr);
+	exit(RC_ERROR);
+      }
+    switch (*unit)
+      {
+      case 'G':
+      case 'g':
+	  return size * 1024 * 1024 * 1024;
+      case 'M':
+      case 'm':
+	  return size * 1024 * 1024;
+      case 'K':
+      case 'k':
+	  return size * 1024;
+      case '\0':
+	  return size;
+      default:
+	  fprintf(stderr, "%s: Invalid size unit: %c\n", myname, *unit);
+	  exit(RC_ERROR);
+      }
+}
+
+/*
+** unit_rsize
+**	Human readable size.
+*/
+char *
+unit_rsize(size)
+u_long size;
+{
+    static char sizestr[32];
+
+    if (size >= 1024 * 1024 * 1024)
+	snprintf(sizestr, sizeof(sizestr), "%.1fG",
+		 size / (1024.0 * 1024 * 1024));
+    else if (size >= 1024 * 1024)
+	snprintf(sizestr, sizeof(sizestr), "%.1fM", size / (1024.0 * 1024));
+    else if (size >= 1024)
+	snprintf(sizestr, sizeof(sizestr), "%.1fk", size / 1024.0);
+    else
+	snprintf(sizestr, sizeof(sizestr), "%lu", size);
+    return sizestr;
+}
@@ -12,5 +12,7 @@
 
 u_int unit_time(char *);
 char *unit_rtime(u_int);
+u_long unit_size(char *);
+char *unit_rsize(u_long);
 
 #endif
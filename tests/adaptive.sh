@@ -0,0 +1,32 @@
+#! /bin/sh
+#
+# $Id$
+#- 9
+## This set of tests exercises the adaptive concurrency (-M auto)
+#
+
+ok=0
+rm -rf odir
+
+test=`../src/shmux -M auto:4-2 -r sh -c true a 2>&1`
+if [ "$test" = "shmux: Invalid -M range: 4-2" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+test=`../src/shmux -M auto:1-3 -r sh -S all -Bsqqo odir -c true 1 2 3 4 5 6 7 8 9 10 2>&1 | grep -v second`
+if [ "$test" = "
+Summary: 10 successes" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+test=`../src/shmux -v -C 1s -M auto:1-8 -r sh -S all -Bsc 'case $SHMUX_TARGET in t*) sleep 5;; esac' a b c t1 2>&1 | grep Concurrency`
+if [ "$test" = "shmux: Concurrency reduced to 2 (connection failure or timeout)" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+rm -rf odir
+test $ok = 3 && exit 77
+exit 0
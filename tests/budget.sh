@@ -0,0 +1,59 @@
+#! /bin/sh
+#
+# $Id$
+#- 11
+## This set of tests exercises the error budget (-L)
+#
+
+ok=0
+rm -rf odir
+targets="1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20"
+
+test=`../src/shmux -L 5%x -r sh -c true a 2>&1 | head -1`
+if [ "$test" = "shmux: Invalid error budget: 5%x" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+test=`../src/shmux -M 1 -r sh -S all -L 2 -Bsqo odir -c 'case $SHMUX_TARGET in 3|5|7|9) exit 1;; esac' $targets 2>&1 | grep -v second`
+if [ "$test" = "shmux! Child for 3 exited with status 1
+shmux! Child for 5 exited with status 1
+shmux! Child for 7 exited with status 1
+shmux! Error budget exceeded: 3 targets failed
+
+Summary: 13 unprocessed, 4 successes, 3 errors
+Error    : 3 5 7 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+rm -rf odir
+test=`../src/shmux -M 1 -r sh -S check -L 20%/10 -Bsqo odir -c 'case $SHMUX_TARGET in 2|12|15|16|17) exit 1;; esac' $targets 2>&1 | grep -v second`
+if [ "$test" = "shmux! Child for 2 exited with status 1
+shmux! Child for 12 exited with status 1
+shmux! Child for 15 exited with status 1
+shmux! Child for 16 exited with status 1
+shmux! Error budget exceeded: 3 of the last 10 targets failed
+
+Summary: 4 unprocessed, 12 successes, 4 errors
+Error    : 2 12 15 16 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+# Fewer targets than the window
+rm -rf odir
+test=`../src/shmux -M 1 -r sh -S all -L 50% -Bsqo odir -c 'exit 1' 1 2 3 4 5 6 7 8 9 10 2>&1 | grep -v second`
+if [ "$test" = "shmux! Child for 1 exited with status 1
+shmux! Child for 2 exited with status 1
+shmux! Error budget exceeded: 2 of the last 2 targets failed
+
+Summary: 8 unprocessed, 2 errors
+Error    : 1 2 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+rm -rf odir
+test $ok = 4 && exit 77
+exit 0
@@ -0,0 +1,53 @@
+#! /bin/sh
+#
+# $Id$
+#- 16
+## This set of tests exercises the output caps (-O, -G and -k)
+#
+
+ok=0
+rm -rf odir
+
+test=`../src/shmux -O 10x -r sh -c true a 2>&1`
+if [ "$test" = "shmux: Invalid size unit: x" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+test=`../src/shmux -O 6:4 -r sh -Bs -c 'seq 1 10' a 2>&1 | grep -v second`
+if [ "$test" = "shmux! Output from a is over the per target cap, discarding it
+    a: 1
+    a: 2
+    a: 3
+    a: [12 bytes discarded]
+    a: 10
+
+Summary: 1 success
+Capped   : a(15) " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+test=`../src/shmux -M 1 -G 1k -r sh -S all -Bsqqo odir -c 'seq 1 1000' a b 2>&1 | grep -v second`
+if [ "$test" = "shmux! Output from a is over the global cap, discarding it
+shmux! Output from b is over the global cap, discarding it
+
+Summary: 2 successes
+Capped   : a(2.8k) b(3.8k) " -a `cat odir/a.stdout | wc -c` = 1047 ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+test=`../src/shmux -O 1k -k -r sh -Bs -c 'while :; do echo y; done' a 2>&1 | grep -v 'second\|a: y\|discarded\|Capped'`
+if [ "$test" = "shmux! Output from a is over the per target cap, discarding it
+shmux! Child for a produced too much output (Terminated)
+
+Summary: 1 error
+Error    : a " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+rm -rf odir
+test $ok = 4 && exit 77
+exit 0
@@ -0,0 +1,61 @@
+#! /bin/sh
+#
+# $Id$
+#- 8
+## This set of tests exercises the control socket (-U), using curl.
+#
+
+ok=0
+
+curl --help all 2> /dev/null | grep -q unix-socket
+if [ $? != 0 ]; then
+    printf "(skipped, curl --unix-socket unavailable)"
+    exit 77
+fi
+
+sock=control.sock
+rm -f $sock
+../src/shmux -B -U $sock -M 1 -r sh -S all -sc 'sleep 1' 1 2 3 > control.out 2>&1 &
+pid=$!
+i=0
+while [ ! -S $sock -a $i -lt 20 ]; do
+    sleep 1
+    i=`expr $i + 1`
+done
+
+test=`curl -s --unix-socket $sock http://shmux/json | grep -c '"max_active": 1,\|"target": "1", "phase": "command"'`
+if [ "$test" = "2" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+test=`curl -s --unix-socket $sock http://shmux/metrics | grep -c '^shmux_active 1$\|^shmux_targets{state="pending"} 3$'`
+if [ "$test" = "2" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+test=`curl -s -w ' %{http_code}' --unix-socket $sock http://shmux/bogus`
+if [ "$test" = "Invalid command: bogus
+ 400" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+test=`curl -s --unix-socket $sock http://shmux/max/3`
+if [ "$test" = "Maximum: 3" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+wait $pid
+test=`grep -v second control.out`
+if [ "$test" = "
+Summary: 3 successes" -a ! -S $sock ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/5"
+rm -f control.out $sock
+
+test $ok = 5 && exit 77
+exit 0
@@ -0,0 +1,52 @@
+#! /bin/sh
+#
+# $Id$
+#- 20
+## This set of tests exercises the "coproc" analyzer
+#
+
+ok=0
+
+rm -rf odir
+mkdir odir || exit 1
+test=`../src/shmux -o odir -a coproc -A ./coproc -e 1 -M 1 -r sh -S all -stc 'echo stdout; exit ${SHMUX_TARGET}' 0 2 3 4 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    0: stdout
+    2: stdout
+shmux! Analysis of 2 output indicates an error: request 2, status 2
+    3: stdout
+shmux! Invalid verdict from analyzer co-process: oops
+shmux! Fatal error for 3 output analysis
+    4: stdout
+
+Summary: 1 failure, 2 successes, 1 error
+Failed   : 3 
+Error    : 2 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+rm -rf odir
+mkdir odir || exit 1
+# A co-process going away, the other one is still used
+test=`../src/shmux -o odir -a coproc -A ./coproc -A 2 -M 1 -r sh -S all -stc 'echo stdout' 0 bad 1 4 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    0: stdout
+  bad: stdout
+shmux! Analyzer co-process is gone
+shmux! Fatal error for bad output analysis
+    1: stdout
+    4: stdout
+shmux! Analyzer co-process exited with status 1
+
+Summary: 1 failure, 3 successes
+Failed   : bad " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+rm -rf odir
+test $ok = 2 && exit 77
+exit 0
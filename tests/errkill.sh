@@ -0,0 +1,43 @@
+#! /bin/sh
+#
+# $Id$
+#- 17
+## This set of tests exercises killing commands on analyzer errors (-K)
+#
+
+ok=0
+rm -rf odir
+
+test=`../src/shmux -K 15 -r sh -c true a 2>&1`
+if [ "$test" = "shmux: -a option required when using -K!" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+mkdir odir || exit 1
+test=`../src/shmux -o odir -a lnre -K 9 -M 1 -r sh -S all -Bsc 'echo fine; echo boom 1>&2; sleep 5; echo late' a 2>&1 | grep -v second`
+if [ "$test" = "    a: fine
+shmux! Analysis of a output indicates an error
+    a! boom
+
+Summary: 1 error
+Error    : a " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+rm -rf odir
+mkdir odir || exit 1
+test=`../src/shmux -o odir -a regex -A '!fatal' -K 15 -F -M 1 -r sh -S check -Bsc 'echo fatal; sleep 5; echo late' a b 2>&1 | grep -v second`
+if [ "$test" = "    a: fatal
+shmux! Analysis of a output indicates an error
+
+Summary: 1 unprocessed, 1 error
+Error    : a " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+rm -rf odir
+test $ok = 3 && exit 77
+exit 0
@@ -0,0 +1,66 @@
+#! /bin/sh
+#
+# $Id$
+#- 26
+## This set of tests exercises gathering raw outputs (-g)
+#
+
+ok=0
+
+rm -rf odir gdir
+mkdir odir || exit 1
+# Binary, with NUL bytes, long lines and no final newline
+printf 'bin\000ary\r\n\000\377' > odir/file
+seq -s ' ' 1 20000 >> odir/file
+printf '\000' >> odir/file
+
+# Each target gets its own copy, stderr is still shown
+test=`../src/shmux -r sh -M 2 -S all -s -g gdir -c 'cat odir/file; echo done >&2' a b 2>&1 | sort | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "
+    a! done
+    b! done
+Gathered : 212.7k in 2 files under gdir
+Summary: 2 successes" ]; then
+    ok=`expr $ok + 1`
+fi
+for t in a b; do
+    cmp -s odir/file gdir/$t || ok=0
+done
+printf "$ok/1"
+
+# Compressed on the way, a truncated stream is an error
+gzip -c odir/file > odir/file.gz || exit 0
+test=`../src/shmux -r sh -s -g gdir -z -c 'test $SHMUX_TARGET = c && exec head -c 100 odir/file.gz; cat odir/file.gz' c d 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "shmux! inflate(gdir/c): truncated compressed data
+shmux! Output of c is incomplete
+
+Summary: 1 success, 1 error
+Error    : c 
+Gathered : 106.4k in 1 file under gdir" ]; then
+    ok=`expr $ok + 1`
+fi
+cmp -s odir/file gdir/d || ok=0
+printf "\b\b\b$ok/2"
+
+# Outputs ending on a multiple of the inflate buffer, and concatenated
+test=`../src/shmux -r sh -s -g gdir -z -c 'z() { head -c $1 /dev/zero | gzip -c; }; z 16384; if test $SHMUX_TARGET = 2; then z 32768; fi' 1 2 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "
+Summary: 2 successes
+Gathered : 64.0k in 2 files under gdir" ]; then
+    ok=`expr $ok + 1`
+fi
+head -c 16384 /dev/zero > odir/zero
+cmp -s odir/zero gdir/1 || ok=0
+head -c 32768 /dev/zero >> odir/zero
+cmp -s odir/zero gdir/2 || ok=0
+printf "\b\b\b$ok/3"
+
+rm -rf odir gdir
+test $ok = 3 && exit 77
+exit 0
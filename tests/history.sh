@@ -0,0 +1,49 @@
+#! /bin/sh
+#
+# $Id$
+#- 12
+## This set of tests exercises the runtime history (-H)
+#
+
+ok=0
+rm -f history
+
+test=`../src/shmux -H history -W 2 -r sh -c true a 2>&1 | head -1`
+if [ "$test" = "shmux: Invalid weight: 2 (Must be between 0 and 1)" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+cmd='case $SHMUX_TARGET in a) sleep 0.5;; c) sleep 2;; d) sleep 1;; esac; echo $SHMUX_TARGET'
+../src/shmux -H history -M 1 -r sh -S all -Bsb -c "$cmd" a b c d > /dev/null 2>&1
+test=`grep -c '^[0-9a-f]* 1 [0-9.]* [abcd]$' history`
+if [ "$test" = 4 ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+test=`../src/shmux -H history -M 1 -r sh -S all -BsbQ -c "$cmd" a b c d e 2>&1 | tr '\n' ' '`
+if [ "$test" = "c d e a b " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+test=`../src/shmux -H history -W 0 -M 1 -r sh -S all -BsbQ -c "$cmd" a b c d e 2>&1 | tr '\n' ' '`
+if [ "$test" = "a b c d e " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+# Runs cut short on errors (-K) aren't recorded
+rm -f history
+mkdir odir || exit 1
+../src/shmux -H history -o odir -a lnre -K 9 -M 1 -r sh -S all -Bsc 'test $SHMUX_TARGET = a && { echo boom 1>&2; sleep 5; }; echo ok' a b > /dev/null 2>&1
+test=`grep -v '^#' history | cut -d' ' -f4 | tr '\n' ' '`
+if [ "$test" = "b " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/5"
+
+rm -rf odir history
+test $ok = 5 && exit 77
+exit 0
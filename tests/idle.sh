@@ -0,0 +1,22 @@
+#! /bin/sh
+#
+# $Id$
+#- 15
+## This set of tests exercises the inactivity timeout (-I)
+#
+
+ok=0
+
+# b runs for longer than the timeout, but keeps producing output
+cmd='case $SHMUX_TARGET in a) sleep 10;; b) for i in 1 2 3 4; do echo $i; sleep 1; done;; esac'
+test=`../src/shmux -M 3 -I 2s -r sh -S all -Bs -c "$cmd" a b c 2>&1 | grep -v 'second\|b: '`
+if [ "$test" = "shmux! Child for a was idle for too long (Terminated)
+
+Summary: 1 idle, 2 successes
+Idle     : a " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+test $ok = 1 && exit 77
+exit 0
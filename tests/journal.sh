@@ -0,0 +1,53 @@
+#! /bin/sh
+#
+# $Id$
+#- 14
+## This set of tests exercises the results journal (-j) and resume (-J)
+#
+
+ok=0
+rm -rf odir
+
+test=`../src/shmux -J -r sh -c true a 2>&1`
+if [ "$test" = "shmux: -o option required when using -j/-J!" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+cmd='case $SHMUX_TARGET in c) exit 1;; esac'
+../src/shmux -M 1 -j -r sh -S all -Bsqqo odir -c "$cmd" a b c d > /dev/null 2>&1
+if [ `grep -c '^R ' odir/journal` = 4 -a `grep -c '^S ' odir/journal` = 4 ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+# Pretend the run was interrupted while running the command on c and d
+grep -v ' [cd]$' odir/journal > odir/journal.new
+echo "S 0 c" >> odir/journal.new
+printf "S 0 d" >> odir/journal.new
+mv odir/journal.new odir/journal
+test=`../src/shmux -M 1 -J -r sh -S all -Bsqqo odir -c "$cmd" a b c d 2>&1 | grep -v second`
+if [ "$test" = "shmux! Child for c exited with status 1
+
+Summary: 3 successes, 1 error
+Error    : c " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+if [ -f odir/c.exit.interrupted -a -f odir/d.exit.interrupted \
+     -a ! -f odir/a.exit.interrupted -a -f odir/d.exit \
+     -a `grep -c '^S ' odir/journal` = 6 ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+test=`../src/shmux -J -r sh -Bso odir -c false a 2>&1`
+if [ "$test" = "shmux: odir/journal was written for a different command!" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/5"
+
+rm -rf odir
+test $ok = 5 && exit 77
+exit 0
@@ -60,5 +60,37 @@ Error    : oink " ]; then
 fi
 printf "\b\b\b$ok/3"
 
-test $ok = 3 && exit 77
+# The first matching condition wins, whatever the prefilter finds
+rm -rf odir
+mkdir odir || exit 1
+test=`../src/shmux -o odir -a lnre -A lnregex.list -M 1 -r sh -S all -stc 'echo the colour is fine; echo warning: FATAL is just a word; echo all good; exit 0' oink 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = " oink: the colour is fine
+ oink: warning: FATAL is just a word
+ oink: all good
+
+Summary: 1 success" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+# Conditions without a literal, and alternatives
+rm -rf odir
+mkdir odir || exit 1
+test=`../src/shmux -o odir -a lnre -A lnregex.list -M 1 -r sh -S all -stc 'echo the color is fine; echo 3 problems; echo an Error; exit 0' oink 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = " oink: the color is fine
+shmux! Analysis of oink output indicates an error
+ oink: 3 problems
+ oink: an Error
+
+Summary: 1 error
+Error    : oink " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/5"
+
+test $ok = 5 && exit 77
 exit 0
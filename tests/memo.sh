@@ -0,0 +1,57 @@
+#! /bin/sh
+#
+# $Id$
+#- 22
+## This set of tests exercises memoized analyzer verdicts (-Z)
+#
+
+ok=0
+
+rm -rf odir
+mkdir odir || exit 1
+# The analyzer only runs for new outputs (or exit codes)
+test=`../src/shmux -Z -o odir -a run -A ./memo -e 1 -M 1 -r sh -S all -sc 'case ${SHMUX_TARGET} in ok*) echo fine;; *) echo bad;; esac; test ${SHMUX_TARGET} = ok4 && exit 2; exit 0' ok1 ok2 bad1 bad2 ok3 ok4 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "  ok1: fine
+  ok1: memo(ok1, 0)
+  ok2: fine
+ bad1: bad
+ bad1: memo(bad1, 0)
+shmux! Analysis of bad1 output indicates an error
+ bad2: bad
+shmux! Analysis of bad2 output indicates an error
+  ok3: fine
+  ok4: fine
+  ok4: memo(ok4, 2)
+
+Summary: 4 successes, 2 errors
+Error    : bad1 bad2 
+Memoized : 3 of 6 verdicts (50%), 3 distinct" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+rm -rf odir
+mkdir odir || exit 1
+# Regular expressions which can't be used as the output arrives
+test=`../src/shmux -Z -o odir -a regex -A '!bad[[:space:]]' -M 1 -r sh -S all -sc 'case ${SHMUX_TARGET} in ok*) echo fine;; *) echo bad;; esac' ok1 bad1 ok2 bad2 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "  ok1: fine
+ bad1: bad
+shmux! Analysis of bad1 output indicates an error
+  ok2: fine
+ bad2: bad
+shmux! Analysis of bad2 output indicates an error
+
+Summary: 2 successes, 2 errors
+Error    : bad1 bad2 
+Memoized : 2 of 4 verdicts (50%), 2 distinct" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+rm -rf odir
+test $ok = 2 && exit 77
+exit 0
@@ -0,0 +1,46 @@
+#! /bin/sh
+#
+# $Id$
+#- 23
+## This set of tests exercises offline re-analysis (-x)
+#
+
+ok=0
+
+rm -rf odir
+mkdir odir || exit 1
+../src/shmux -o odir -M 1 -r sh -S all -sc 'echo out ${SHMUX_TARGET}; test ${SHMUX_TARGET} = c && echo oops 1>&2; test ${SHMUX_TARGET} = d && exit 3; exit 0' b a c d > /dev/null 2>&1
+test $? != 0 && exit 0
+
+# All the saved targets, in order, with new conditions and exit codes
+test=`../src/shmux -o odir -x -a regex -A '=out [ab]' -A '!oops' -e 1 -s 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "shmux! Analysis of c output indicates an error
+shmux! Analysis of d output indicates an error
+
+Summary: 2 successes, 2 errors
+Error    : c d " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+# Given targets, with a line analyzer
+echo '=out [a-c]' > odir/conditions
+echo '=oops' > odir/errors
+test=`../src/shmux -o odir -x -a lnre -A odir/conditions -A odir/errors -M 2 -s d c a x 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "shmux! Child for d exited with status 3
+shmux! No saved exit status for x
+
+Summary: 1 failure, 2 successes, 1 error
+Failed   : x 
+Error    : d " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+rm -rf odir
+test $ok = 2 && exit 77
+exit 0
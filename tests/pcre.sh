@@ -0,0 +1,85 @@
+#! /bin/sh
+#
+# $Id$
+#- 18
+## This set of tests exercises the "pcre" and "lnpcre" analyzers
+#
+
+if ../src/shmux -V | grep PCRE2 > /dev/null; then
+    :
+else
+    printf "skipped"
+    exit 77
+fi
+
+ok=0
+
+rm -rf odir
+mkdir odir || exit 1
+# Basic one liner check, default stderr
+test=`../src/shmux -o odir -a pcre -A . -M 1 -r sh -S all -stc 'echo stdout; echo unknown 1>&${SHMUX_TARGET}; exit 0' 1 2 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1: stdout
+    1: unknown
+    2: stdout
+    2! unknown
+shmux! Analysis of 2 output indicates an error
+
+Summary: 1 success, 1 error
+Error    : 2 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+rm -rf odir
+mkdir odir || exit 1
+# Multi line, with a match across reads
+test=`../src/shmux -o odir -a pcre -A '=^stdout\nunknown$' -M 1 -r sh -S all -stc 'printf stdo; sleep 1; printf "ut\nunkn"; sleep 1; echo own' 1 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1: stdout
+    1: unknown
+
+Summary: 1 success" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+rm -rf odir
+mkdir odir || exit 1
+# Error found as the output comes
+test=`../src/shmux -o odir -a pcre -A '!fat\s+al' -M 1 -r sh -S all -stc 'echo fat; sleep 1; echo al; sleep 1; echo done' 1 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1: fat
+    1: al
+shmux! Analysis of 1 output indicates an error
+    1: done
+
+Summary: 1 error
+Error    : 1 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+rm -rf odir
+mkdir odir || exit 1
+# Line based, with PCRE syntax
+printf '=^\\d+ ok$\n' > odir/conditions
+test=`../src/shmux -o odir -a lnpcre -A odir/conditions -M 1 -r sh -S all -stc 'echo 12 ok; echo d ok' 1 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1: 12 ok
+shmux! Analysis of 1 output indicates an error
+    1: d ok
+
+Summary: 1 error
+Error    : 1 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+rm -rf odir
+test $ok = 4 && exit 77
+exit 0
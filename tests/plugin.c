@@ -0,0 +1,64 @@
+/*
+** $Id$
+**
+** Analyzer plugin used by plugin.sh: the command failed if its output
+** contains the word given with the second -A (Default: "error").  The
+** "slow" target takes a second to analyze.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/plugin.h"
+
+static const char *word = "error";
+static int analyzed;
+
+static int
+contains(const struct shmux_output *o)
+{
+    size_t len, i;
+
+    len = strlen(word);
+    for (i = 0; i + len <= o->len; i++)
+	if (memcmp(o->data + i, word, len) == 0)
+	    return 1;
+    return 0;
+}
+
+int
+shmux_analyzer_init(int version, const char *arg)
+{
+    if (version != SHMUX_PLUGIN_VERSION)
+	return -1;
+    if (arg != NULL)
+	word = arg;
+    return 0;
+}
+
+int
+shmux_analyzer_analyze(const char *target, int status,
+		       const struct shmux_output *out,
+		       const struct shmux_output *err, char *msg, size_t msglen)
+{
+    analyzed += 1;
+    if (strcmp(target, "bad") == 0)
+	return -1;
+    if (strcmp(target, "slow") == 0)
+	sleep(1);
+    if (contains(out) != 0 || contains(err) != 0)
+      {
+	snprintf(msg, msglen, "found \"%s\" (status %d, %lu+%lu bytes)",
+		 word, status, (unsigned long) out->len,
+		 (unsigned long) err->len);
+	return 1;
+      }
+    return 0;
+}
+
+void
+shmux_analyzer_finish(void)
+{
+    printf("plugin: %d analyzed\n", analyzed);
+}
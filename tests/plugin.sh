@@ -0,0 +1,89 @@
+#! /bin/sh
+#
+# $Id$
+#- 19
+## This set of tests exercises the "plugin" analyzer
+#
+
+rm -f plugin.so
+if ${CC-cc} -shared -fPIC -o plugin.so plugin.c > /dev/null 2>&1 \
+    && ../src/shmux -o . -a plugin -A ./plugin.so -c : 2>&1 \
+	| grep -v "without plugin support" > /dev/null; then
+    :
+else
+    rm -f plugin.so
+    printf "skipped"
+    exit 77
+fi
+
+ok=0
+
+rm -rf odir
+mkdir odir || exit 1
+test=`../src/shmux -o odir -a plugin -A ./plugin.so -M 1 -r sh -S all -stc 'echo stdout; test ${SHMUX_TARGET} = 2 && echo an error 1>&2; exit 0' 1 2 bad 3 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1: stdout
+    2: stdout
+    2! an error
+shmux! Analysis of 2 output indicates an error: found \"error\" (status 0, 7+9 bytes)
+  bad: stdout
+shmux! Fatal error for bad output analysis
+shmux! Analysis of bad output indicates an error
+    3: stdout
+plugin: 4 analyzed
+
+Summary: 2 successes, 2 errors
+Error    : 2 bad " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+rm -rf odir
+mkdir odir || exit 1
+# Argument given to the plugin, and exit codes checked first
+test=`../src/shmux -o odir -a plugin -A ./plugin.so -A FAIL -e 3 -M 1 -r sh -S all -stc 'echo FAIL; exit ${SHMUX_TARGET}' 0 3 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    0: FAIL
+shmux! Analysis of 0 output indicates an error: found \"FAIL\" (status 0, 5+0 bytes)
+    3: FAIL
+shmux! Child for 3 exited with status 3
+plugin: 1 analyzed
+
+Summary: 2 errors
+Error    : 0 3 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+rm -rf odir
+mkdir odir || exit 1
+test=`../src/shmux -o odir -a plugin -A ./missing.so -c : 1 2>&1`
+if [ $? != 0 ]; then
+    case "$test" in
+	"shmux: ./missing.so"*) ok=`expr $ok + 1`;;
+    esac
+fi
+printf "\b\b\b$ok/3"
+
+rm -rf odir
+mkdir odir || exit 1
+# Verdicts in order, even behind a large output analyzed by a thread
+test=`../src/shmux -o odir -a plugin -A ./plugin.so -M 1 -r sh -S all -sqqc 'test ${SHMUX_TARGET} = slow && seq 1 20000; echo error' slow 2 3 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "shmux! Analysis of slow output indicates an error: found \"error\" (status 0, 117091+0 bytes)
+shmux! Analysis of 2 output indicates an error: found \"error\" (status 0, 6+0 bytes)
+shmux! Analysis of 3 output indicates an error: found \"error\" (status 0, 6+0 bytes)
+plugin: 3 analyzed
+
+Summary: 3 errors
+Error    : slow 2 3 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+rm -rf odir plugin.so
+test $ok = 4 && exit 77
+exit 0
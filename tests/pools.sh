@@ -0,0 +1,50 @@
+#! /bin/sh
+#
+# $Id$
+#- 21
+## This set of tests exercises separate concurrency pools (-M)
+#
+
+ok=0
+
+rm -rf odir
+mkdir odir || exit 1
+# A single pool: the analyzer delays the next command
+test=`../src/shmux -o odir -a run -A ./pools -M 1 -r sh -S all -sc 'echo cmd' 1 2 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1: cmd
+    1: analyzed
+    2: cmd
+    2: analyzed
+
+Summary: 2 successes" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+rm -rf odir
+mkdir odir || exit 1
+# Separate pools: commands don't wait for the analyzer
+test=`../src/shmux -o odir -a run -A ./pools -M 1,,1 -r sh -S all -sc 'echo cmd' 1 2 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1: cmd
+    2: cmd
+    1: analyzed
+    2: analyzed
+
+Summary: 2 successes" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+test=`../src/shmux -M 5,10,0 -r sh -c : 1 2>&1`
+if [ $? != 0 -a "$test" = "shmux: Invalid -M pools: 10,0" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+rm -rf odir
+test $ok = 3 && exit 77
+exit 0
@@ -0,0 +1,53 @@
+#! /bin/sh
+#
+# $Id$
+#- 25
+## This set of tests exercises push mode (-u)
+#
+
+ok=0
+
+rm -rf odir
+mkdir odir || exit 1
+seq 1 50000 > odir/file || exit 0
+
+# Same file everywhere, with the summary
+test=`../src/shmux -r sh -M 2 -S all -s -u 'odir/file:odir/copy' a b c 2>&1 | grep -v second | sed 's/ fed in .*//'`
+test $? != 0 && exit 0
+
+if [ "$test" = "
+Summary: 3 successes
+Input    : 846.4k sent, 3 targets" ]; then
+    ok=`expr $ok + 1`
+fi
+cmp -s odir/file odir/copy || ok=0
+printf "$ok/1"
+
+# Truncated on the way: the checksum fails, nothing is changed
+echo old > odir/copy.d
+test=`SHMUX_SH=./pushsh ../src/shmux -r sh -s -Q -u 'odir/file:odir/copy.d' d 2>&1`
+test $? != 0 && exit 0
+
+if [ "$test" = "    d! shmux: odir/copy.d: checksum mismatch (3099201346 100)
+shmux! Child for d exited with status 1" ]; then
+    ok=`expr $ok + 1`
+fi
+test "`cat odir/copy.d`" = old || ok=0
+test "`ls odir | wc -l`" -eq 3 || ok=0
+printf "\b\b\b$ok/2"
+
+# The path is used as is
+dest="odir/it's a \$HOME; \`copy\`"
+test=`../src/shmux -r sh -s -Q -u "odir/file:$dest" e 2>&1`
+test $? != 0 && exit 0
+
+if [ "$test" = "" ]; then
+    ok=`expr $ok + 1`
+fi
+cmp -s odir/file "$dest" || ok=0
+test "`ls odir | wc -l`" -eq 4 || ok=0
+printf "\b\b\b$ok/3"
+
+rm -rf odir
+test $ok = 3 && exit 77
+exit 0
@@ -108,5 +108,52 @@ Summary: 2 successes" ]; then
 fi
 printf "\b\b\b$ok/6"
 
-test $ok = 6 && exit 77
+rm -rf odir
+mkdir odir || exit 1
+# Error found as the output comes
+test=`../src/shmux -o odir -a regex -A '!fatal' -M 1 -r sh -S all -stc 'echo fatal; sleep 1; echo done' 1 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1: fatal
+shmux! Analysis of 1 output indicates an error
+    1: done
+
+Summary: 1 error
+Error    : 1 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/7"
+
+rm -rf odir
+mkdir odir || exit 1
+# Line split across reads, and incomplete
+test=`../src/shmux -o odir -a regex -A '!fatal' -M 1 -r sh -S all -stc 'printf fat; sleep 1; printf al' 1 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    1+ fatal
+shmux! Previous line was incomplete.
+shmux! Analysis of 1 output indicates an error
+
+Summary: 1 error
+Error    : 1 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/8"
+
+rm -rf odir
+mkdir odir || exit 1
+# Large outputs, matched by the analysis threads
+test=`../src/shmux -o odir -a regex -A '!bad[[:space:]]' -M 3 -r sh -S all -sqqc 'seq 1 30000; test ${SHMUX_TARGET} = 2 && echo bad; exit 0' 1 2 3 4 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "shmux! Analysis of 2 output indicates an error
+
+Summary: 3 successes, 1 error
+Error    : 2 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/9"
+
+rm -rf odir
+test $ok = 9 && exit 77
 exit 0
@@ -0,0 +1,38 @@
+#! /bin/sh
+#
+# $Id$
+#- 13
+## This set of tests exercises retries of transport failures (-R)
+#
+
+ok=0
+rm -rf odir tries
+mkdir tries
+
+test=`../src/shmux -R x -r sh -c true a 2>&1 | head -1`
+if [ "$test" = "shmux: Invalid -R argument: x" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+cmd='n=`cat tries/$SHMUX_TARGET 2>/dev/null || echo 0`; n=`expr $n + 1`; echo $n > tries/$SHMUX_TARGET; case $SHMUX_TARGET in a) test $n -ge 2 || exit 42;; b) exit 42;; esac'
+test=`../src/shmux -M 1 -R 1 -Y 42 -r sh -S all -Bsqo odir -c "$cmd" a b c 2>&1 | grep -v second | sed 's/ in [0-9]s (/ (/'`
+if [ "$test" = "shmux! a failed (exit 42), retrying (attempt 2 of 2)
+shmux! b failed (exit 42), retrying (attempt 2 of 2)
+shmux! Child for b exited with status 42
+
+Summary: 2 successes, 1 error
+Error    : b 
+Retried  : a(1) b(1) " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+if [ -f odir/a.stdout.1 -a -f odir/b.stdout.1 -a ! -f odir/c.stdout.1 ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+rm -rf odir tries
+test $ok = 3 && exit 77
+exit 0
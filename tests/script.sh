@@ -0,0 +1,66 @@
+#! /bin/sh
+#
+# $Id$
+#- 27
+## This set of tests exercises running scripts kept on targets (-f)
+#
+
+ok=0
+
+rm -rf odir
+mkdir odir || exit 1
+cat > odir/script <<'END'
+echo "hello from $SHMUX_TARGET"
+cat
+END
+
+# The first run sends the script, and saves it (as HOME is shared)
+test=`HOME=odir ../src/shmux -r sh -M 1 -s -f odir/script a b 2>&1 | grep -v second | sed 's/ fed in .*//'`
+test $? != 0 && exit 0
+
+if [ "$test" = "    a: hello from a
+    b: hello from b
+
+Summary: 2 successes
+Input    : 36 sent, 1 target" ]; then
+    ok=`expr $ok + 1`
+fi
+test "`ls odir/.shmux`" = "1873831078-36" || ok=0
+printf "$ok/1"
+
+# Later runs use the saved copy
+echo 'echo "cached on $SHMUX_TARGET"' > odir/.shmux/1873831078-36
+test=`HOME=odir ../src/shmux -r sh -s -f odir/script c 2>&1 | grep -v second`
+test $? != 0 && exit 0
+
+if [ "$test" = "    c: cached on c
+
+Summary: 1 success" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+# A shell with startup output, before and along with the request
+rm -rf odir/.shmux
+cat > odir/sh <<'END'
+echo "Welcome to $SHMUX_TARGET"
+printf 'No newline, '
+exec /bin/sh "$@"
+END
+chmod +x odir/sh
+test=`HOME=odir SHMUX_SH=odir/sh ../src/shmux -r sh -C 10s -s -f odir/script d 2>&1 | grep -v second | sed 's/ fed in .*//'`
+test $? != 0 && exit 0
+
+if [ "$test" = "    d: Welcome to d
+    d: No newline, hello from d
+
+Summary: 1 success
+Input    : 36 sent, 1 target" ]; then
+    ok=`expr $ok + 1`
+fi
+test "`ls odir/.shmux`" = "1873831078-36" || ok=0
+printf "\b\b\b$ok/3"
+
+rm -rf odir
+test $ok = 3 && exit 77
+exit 0
@@ -0,0 +1,54 @@
+#! /bin/sh
+#
+# $Id$
+#- 24
+## This set of tests exercises feeding the commands' standard input (-i)
+#
+
+ok=0
+
+rm -f stdin.in
+seq 1 100000 > stdin.in || exit 0
+
+# All of it, to each target, larger than a pipe
+test=`../src/shmux -r sh -M 3 -S all -s -i stdin.in -c 'cksum' a b c 2>&1 | sort | grep -v second | grep -v '^Input '`
+test $? != 0 && exit 0
+
+sum=`cksum < stdin.in`
+if [ "$test" = "
+    a: $sum
+    b: $sum
+    c: $sum
+Summary: 3 successes" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+# A command not reading all of it is not an error
+test=`../src/shmux -r sh -M 2 -S all -s -i stdin.in -c 'head -2' a b 2>&1 | sort | grep -v second | grep -v '^Input '`
+test $? != 0 && exit 0
+
+if [ "$test" = "
+    a: 1
+    a: 2
+    b: 1
+    b: 2
+Summary: 2 successes" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+# From our own standard input
+test=`printf 'one\ntwo' | ../src/shmux -r sh -s -i - -c 'wc -c' a 2>&1 | grep -v second | grep -v '^Input '`
+test $? != 0 && exit 0
+
+if [ "$test" = "    a: 7
+
+Summary: 1 success" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+rm -f stdin.in
+test $ok = 3 && exit 77
+exit 0
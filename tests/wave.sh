@@ -0,0 +1,49 @@
+#! /bin/sh
+#
+# $Id$
+#- 10
+## This set of tests exercises the wave spawn strategy (-S wave)
+#
+
+ok=0
+rm -rf odir
+
+test=`../src/shmux -M 4 -r sh -S wave:x -c true a 2>&1 | head -1`
+if [ "$test" = "shmux: Invalid spawn strategy \"wave:x\"" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "$ok/1"
+
+test=`../src/shmux -v -M 4 -r sh -S wave -Bsqo odir -c true 1 2 3 4 5 6 7 8 9 10 2>&1 | grep "Starting wave"`
+if [ "$test" = "shmux: Starting wave 1 (1 target)
+shmux: Starting wave 2 (2 targets)
+shmux: Starting wave 3 (4 targets)
+shmux: Starting wave 4 (4 targets)" ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/2"
+
+rm -rf odir
+test=`../src/shmux -M 4 -r sh -S wave -Bsqo odir -c 'test $SHMUX_TARGET != 3' 1 2 3 4 5 6 7 8 9 10 2>&1 | grep -v second`
+if [ "$test" = "shmux! Child for 3 exited with status 1
+shmux! Wave 2 has too many failures (1 of 2 targets)
+
+Summary: 7 unprocessed, 2 successes, 1 error
+Error    : 3 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/3"
+
+rm -rf odir
+test=`../src/shmux -M 4 -r sh -S wave:25% -Bsqo odir -c 'test $SHMUX_TARGET != 5' 1 2 3 4 5 6 7 8 9 10 2>&1 | grep -v second`
+if [ "$test" = "shmux! Child for 5 exited with status 1
+
+Summary: 9 successes, 1 error
+Error    : 5 " ]; then
+    ok=`expr $ok + 1`
+fi
+printf "\b\b\b$ok/4"
+
+rm -rf odir
+test $ok = 4 && exit 77
+exit 0